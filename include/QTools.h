@@ -19,12 +19,17 @@
 #define QTOOLS_H
 
 #include "QTools/AppUpdater.h"
+#include "QTools/BulkFileOps.h"
 #include "QTools/ColourMappingWidget.h"
 #include "QTools/FdToolProcess.h"
+#include "QTools/FileIndex.h"
 #include "QTools/HelpAssistant.h"
 #include "QTools/HelpBrowser.h"
+#include "QTools/HelpSearchIndex.h"
 #include "QTools/KeyPressHandler.h"
+#include "QTools/NameMatcher.h"
 #include "QTools/NetworkUpdater.h"
+#include "QTools/PatchArchive.h"
 #include "QTools/PatchList.h"
 #include "QTools/PluginUIPoints.h"
 #include "QTools/PluginInterface.h"
@@ -40,6 +45,7 @@
 #include "QTools/TreeItem.h"
 #include "QTools/TreeModel.h"
 #include "QTools/TwoHandleSlider.h"
+#include "QTools/UpdateMetrics.h"
 #include "QTools/ViewNavigator.h"
 #include "QTools/VtkActorViewer.h"
 #include "QTools/VtkViewerInteractorManager.h"
@@ -18,7 +18,8 @@
 #ifndef QTOOLS_APP_UPDATER_H
 #define QTOOLS_APP_UPDATER_H
 
-#include "QTools_Export.h"
+#include "UpdateMetrics.h"
+#include "PatchArchive.h"
 #include <QThread>
 
 namespace QTools {
@@ -40,27 +41,65 @@ public:
     // Provide the update/patch archive files - typically locations of temporary files.
     // Files in archives later in the list that are in earlier archives are ignored.
     // Optionally specify paths to files to remove (rfiles) which are given relative
-    // to the application patch directory. Returns immediately and fires onFinished
-    // when updating is complete.
-    bool update( const QStringList &files, const QStringList &rfiles=QStringList());
+    // to the application patch directory. The declared formats of the archives may
+    // be given (in the same order as files) so that archives of other formats are
+    // refused. Returns immediately and fires onFinished when updating is complete.
+    bool update( const QStringList &files, const QStringList &rfiles=QStringList(),
+                 const QList<PatchArchive::Format> &formats=QList<PatchArchive::Format>());
+
+    // In background mode, the updating thread runs at low CPU priority and
+    // requests low I/O priority from the OS for its disk work. Off by default.
+    void setBackgroundMode( bool v) { _background = v;}
+    bool isBackgroundMode() const { return _background;}
+
+    // In staged mode, update only prepares the new files (or the new AppImage)
+    // in the background and records them as pending. Nothing installed is
+    // touched until applyPendingUpdate is called at the next launch.
+    void setStagedMode( bool v) { _staged = v;}
+    bool isStagedMode() const { return _staged;}
+
+    // The number of files in the last update that were already installed with
+    // identical content and so were neither replaced nor backed up.
+    int skippedFileCount() const { return _nskipped;}
+
+    // Phase times and counts of files, bytes and privileged operations from
+    // the last update. Complete once onFinished is emitted when the metrics
+    // are also written to the log as a single line of JSON.
+    const UpdateMetrics &metrics() const { return _metrics;}
+
+    // Returns true iff a staged update is waiting to be applied.
+    static bool hasPendingUpdate();
+
+    // Apply any update staged in a previous session. Call early at startup (after
+    // the QCoreApplication exists but before the main window is created). Returns
+    // an empty string if nothing was pending or the update was applied, otherwise
+    // the error. A swapped AppImage only runs from its next launch so relaunch
+    // is set true in that case and the caller may restart the application.
+    static QString applyPendingUpdate( bool *relaunch=nullptr);
 
 signals:
     void onExtracting() const;
     void onUpdating() const;
+    void onRemoving() const;
     void onRepacking() const; // Only emitted for AppImage versions
     void onFinished( const QString&) const;
 
 private:
     void run() override;
     bool _isAppImage() const;
-    bool _extractFiles( const QString&) const;
-    QString _repackAppImage( const QString&, const QString&, const QString&) const;
+    bool _extractFiles( const QString&);
+    QString _repackAppImage( const QString&, const QString&, const QString&);
     void _failFinish( const char*);
     QString _appFilePath;
     QStringList _fpaths;
     QStringList _rpaths;
+    QList<PatchArchive::Format> _formats;
     QString _relPath;
     QString _err;
+    bool _background;
+    bool _staged;
+    int _nskipped;
+    UpdateMetrics _metrics;
 };  // end class
 
 }   // end namespace
@@ -0,0 +1,73 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#ifndef QTOOLS_BULK_FILE_OPS_H
+#define QTOOLS_BULK_FILE_OPS_H
+
+/**
+ * File operations over many paths at once. On Linux when built with liburing and
+ * running on a kernel that supports the needed operations, the operations are
+ * submitted to an io_uring in batches so that many are in flight at once without
+ * a system call per operation. Otherwise (or if disabled) they're done one at a
+ * time through Qt as before. Results are the same either way and are returned in
+ * the order of the given paths. Safe to call from multiple threads at once.
+ */
+
+#include "QTools_Export.h"
+#include <QStringList>
+#include <QVector>
+
+namespace QTools {
+namespace BulkFileOps {
+
+// True if io_uring was compiled in and is supported by the running kernel.
+QTools_EXPORT bool isUringAvailable();
+
+// Set whether to use io_uring if available (true by default). Useful for comparison.
+QTools_EXPORT void setUseUring( bool);
+QTools_EXPORT bool useUring();  // True iff available and not disabled
+
+// Set the maximum number of operations in flight at once (default 64).
+QTools_EXPORT void setQueueDepth( int);
+QTools_EXPORT int queueDepth();
+
+struct FileStat
+{
+    bool exists;
+    bool isDir;
+    qint64 size;
+    qint64 mtime;   // Milliseconds since the epoch
+};  // end struct
+
+// Stat each path (following symlinks).
+QTools_EXPORT QVector<FileStat> statFiles( const QStringList&);
+
+// Remove each file returning which were removed.
+QTools_EXPORT QVector<bool> removeFiles( const QStringList&);
+
+// Rename each file in src to the path at the same index in dst. As with QFile::rename,
+// a rename fails if its destination already exists. Returns which renames succeeded.
+QTools_EXPORT QVector<bool> renameFiles( const QStringList &src, const QStringList &dst);
+
+// Copy the contents and permissions of each file in src to the path at the same index in dst.
+// As with QFile::copy, a copy fails if its destination already exists. Returns which copies succeeded.
+QTools_EXPORT QVector<bool> copyFiles( const QStringList &src, const QStringList &dst);
+
+}   // end namespace
+}   // end namespace
+
+#endif
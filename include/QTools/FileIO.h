@@ -21,6 +21,7 @@
 #include "QTools_Export.h"
 #include <QFileInfoList>
 #include <QStringList>
+#include <QVector>
 #include <QThread>
 #include <QDir>
 
@@ -28,15 +29,45 @@ namespace QTools {
 namespace FileIO {
 
 // Recursively list all files beneath the given root directory matching the given name filters.
-QTools_EXPORT QFileInfoList recursivelyListFiles( const QDir &root, const QStringList &nameFilters={"*.*"});
-
-// Recursively list files in a background thread and notify when done with signal onFoundFiles.
+// Hidden and unreadable entries are skipped. Files are listed in name order per directory with
+// a directory's files before those of its subdirectories. Directories are read in parallel by
+// up to nthreads threads (the ideal thread count if <= 0) using the calling thread and free
+// threads from the global thread pool. A directory linked to from more than one place has
+// its files listed only from the first place in this order. Name filters are wildcard
+// patterns matched case insensitively.
+QTools_EXPORT QFileInfoList recursivelyListFiles( const QDir &root, const QStringList &nameFilters={"*.*"}, int nthreads=0);
+
+// Recursively list files in a background thread. Found files are emitted in batches with
+// onFoundBatch as directories are read (in no particular order). The first batch is emitted as
+// soon as anything is found and then no more than one batch per batch interval. Progress
+// is reported with onProgress after each batch. When done (or cancelled), all found files
+// are emitted in the same order as recursivelyListFiles with signal onFoundFiles.
 class QTools_EXPORT BackgroundFilesFinder : public QThread
 { Q_OBJECT
 public:
     BackgroundFilesFinder( const QDir &root, const QStringList &nameFilters={"*.*"});
 
+    // Levels of subdirectory to descend into (0 for just the root). No limit if < 0 (default).
+    void setMaxDepth( int d) { _maxDepth = d;}
+    int maxDepth() const { return _maxDepth;}
+
+    // Stop after finding this many files. No limit if < 0 (default).
+    void setMaxCount( int n) { _maxCount = n;}
+    int maxCount() const { return _maxCount;}
+
+    // Minimum milliseconds between emitting batches of found files (default 100).
+    void setBatchInterval( int msecs) { _batchMsecs = qMax( 1, msecs);}
+    int batchInterval() const { return _batchMsecs;}
+
+    // Stop searching as soon as possible. Files found up to this point are still emitted.
+    void cancel() { requestInterruption();}
+
+    // True if the last search was cancelled before finishing.
+    bool wasCancelled() const { return _cancelled;}
+
 signals:
+    void onFoundBatch( QDir, QFileInfoList);
+    void onProgress( int dirsVisited, int filesFound);
     void onFoundFiles( QDir, QFileInfoList);
 
 protected:
@@ -45,6 +76,10 @@ protected:
 private:
     const QDir _root;
     const QStringList _nameFilters;
+    int _maxDepth;
+    int _maxCount;
+    int _batchMsecs;
+    bool _cancelled;
 };  // end class
 
 
@@ -53,8 +88,15 @@ private:
 // Returns true on successful move of all src files to dst and the files
 // at the backup location may be discarded. False is returned if any
 // of the source files could not be moved and the file system is restored
-// to the state it was in before calling this function.
-QTools_EXPORT bool moveFiles( const QString &src, const QString &dst, const QString &bck="");
+// to the state it was in before calling this function. If given, counts
+// are set to what was moved (counted as the files are moved).
+struct MoveCounts
+{
+    qint64 files = 0;       // Files moved
+    qint64 bytes = 0;       // Bytes in files moved
+    qint64 displaced = 0;   // Files at dst moved into the backup location
+};  // end struct
+QTools_EXPORT bool moveFiles( const QString &src, const QString &dst, const QString &bck="", MoveCounts *counts=nullptr);
 
 // Moves files using an external tool (set as the path FILE_MOVE_TOOL)
 // which is started in a child process via an OS mechanism to prompt
@@ -67,16 +109,61 @@ QTools_EXPORT bool removeFileAsRoot( const QString&);
 // Remove the given files using an external tool
 QTools_EXPORT bool removeFilesAsRoot( const QStringList&);
 
+// Remove files beneath src that are the same as their counterparts at the same
+// relative paths beneath dst. Files are compared on size and permissions first
+// and then content (see diffTrees). Directories under src left empty
+// are also removed (but not src itself). Returns the number of files removed.
+QTools_EXPORT int removeUnchangedFiles( const QString &src, const QString &dst);
+
 // Recursively copy files from src to dst. By default, fails if any
 // files at dst already exist otherwise set noclobber false to overwrite.
 QTools_EXPORT bool copyFiles( const QString &src, const QString &dst, bool noclobber=true);
 
-// Move file f1 to f2, then move file f0 to f1.
-// File f2 must not already exist and files f0 and f1 must exist.
+// Differences between two directory trees with paths of files (and symlinks) relative to the tree roots.
+// Files inside directories only present in one of the trees are listed individually.
+struct QTools_EXPORT TreeDiff
+{
+    QStringList added;      // Only in the source tree
+    QStringList removed;    // Only in the destination tree
+    QStringList changed;    // In both trees but different
+    QStringList same;       // In both trees and the same
+
+    bool isEmpty() const { return added.isEmpty() && removed.isEmpty() && changed.isEmpty();}
+};  // end struct
+
+// Walk the src and dst trees in parallel (using nthreads threads or twice the ideal thread count
+// if <= 0) and classify their files (including hidden files). Files are the same if their sizes
+// and modification times match or, if compareContent is true, if their sizes, permissions and
+// contents match (ignoring modification times). Symlinks are the same if their targets relative
+// to their containing directories match. Each list in the returned diff is sorted.
+QTools_EXPORT TreeDiff diffTrees( const QString &src, const QString &dst, bool compareContent=false, int nthreads=0);
+
+// Copy just the added and changed files from src to dst (in parallel) giving the copies the source
+// files' modification times, so that a subsequent diff finds them the same. If removeExtra is true,
+// files only in dst are removed together with any directories left empty that aren't in src
+// so that dst becomes a mirror of src. The diff acted upon is set in diff if not null.
+// Returns true iff all files were copied (and removed).
+QTools_EXPORT bool copyChangedFiles( const QString &src, const QString &dst, bool removeExtra=false,
+                                     bool compareContent=false, TreeDiff *diff=nullptr);
+
+// Move just the added and changed files from src into dst as moveFiles does (backing up and restoring
+// on failure). Files in src that are the same as in dst are removed first as they don't need moving
+// (and aren't restored on failure). The diff acted upon is set in diff if not null.
+QTools_EXPORT bool moveChangedFiles( const QString &src, const QString &dst, const QString &bck="",
+                                     bool compareContent=true, TreeDiff *diff=nullptr);
+
+// Atomically exchange the files or directory trees at p0 and p1 so that neither path is ever
+// missing. Both must exist on the same file system. Uses renameat2 with RENAME_EXCHANGE which
+// needs Linux >= 3.15 and file system support. Returns false (with nothing changed) otherwise.
+QTools_EXPORT bool exchangePaths( const QString &p0, const QString &p1);
+
+// Move file f1 to f2, then move file f0 to f1. The files may also be directory trees.
+// File f2 must not already exist and files f0 and f1 must exist. Where exchangePaths
+// works, f0 and f1 are exchanged before f0 is moved to f2 so that f1 is never missing.
 // Returns an empty string on success otherwise it contains the error.
 QTools_EXPORT QString swapOverFiles( const QString &f0, const QString &f1, const QString &f2);
 
-// As above but execute as root (LINUX ONLY CURRENTLY!)
+// As above but execute as root (LINUX ONLY CURRENTLY!) using UPDATE_TOOL if set.
 QTools_EXPORT QString swapOverFilesAsRoot( const QString &f0, const QString &f1, const QString &f2);
 
 // Run the AppImage packaging process on the given appDir to produce the
@@ -84,6 +171,22 @@ QTools_EXPORT QString swapOverFilesAsRoot( const QString &f0, const QString &f1,
 // user privileges. Requires the APP_IMAGE_TOOL path to be set.
 QTools_EXPORT bool packAppImage( const QString &appDir, const QString &appImageFile);
 
+// Who the current process is running as. Resolved once on first use from the
+// system user and group databases (no child processes are spawned).
+struct Identity
+{
+    QString username;   // Name of the real user
+    QString homePath;   // Home directory of the real user
+    uint uid;           // Real user ID
+    uint euid;          // Effective user ID
+    uint gid;           // Real group ID
+    uint egid;          // Effective group ID
+    QVector<uint> groups;   // Supplementary group IDs
+    bool isRoot;        // Same as isRoot()
+};  // end struct
+
+QTools_EXPORT const Identity &identity();
+
 // Checks on Windows if the current user has administator privileges
 // or on Linux if the current user is root (or rather that their
 // effective user ID is different from the actual user ID).
@@ -92,6 +195,17 @@ QTools_EXPORT bool isRoot();
 // Reliably returns the username.
 QTools_EXPORT QString username();
 
+// Preflight check of whether elevated privileges are needed to replace or remove each of
+// the given paths. A path needs elevation if it exists and either it isn't writable by
+// the current effective user, or it's not a directory and its parent directory doesn't
+// allow it to be unlinked (directories are written into rather than replaced). Paths
+// are checked in parallel with one stat per path and per distinct parent directory.
+// Returns the flags in the order of the given paths. Never true if isRoot().
+QTools_EXPORT QVector<bool> needsElevation( const QStringList &paths);
+
+// Convenience for when any of the given paths need elevation.
+QTools_EXPORT bool anyNeedElevation( const QStringList &paths);
+
 // Is the given path within the user's home directory?
 QTools_EXPORT bool inHomeDir( const QString &path);
 
@@ -0,0 +1,144 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#ifndef QTOOLS_FILE_INDEX_H
+#define QTOOLS_FILE_INDEX_H
+
+/**
+ * Persistent index of the files beneath a root directory for answering repeated
+ * listings from memory. The index is saved to a cache file and, when loaded again,
+ * only those directories changed since the index was saved are rescanned. While the
+ * index exists, directories are watched for changes (using inotify on Linux) and only
+ * the changed directories are rescanned when next queried. Directories that can't be
+ * watched (e.g. once the inotify watch limit is reached) are rescanned on every query.
+ * As with FileIO::recursivelyListFiles, hidden and unreadable entries are ignored and
+ * symbolic links to directories are followed except to a directory's own ancestors. A
+ * directory reached through more than one path only has its files listed from the first
+ * of those paths in name order.
+ * Not thread safe; use from the thread the index lives in.
+ */
+
+#include "QTools_Export.h"
+#include <QFileInfoList>
+#include <QStringList>
+#include <QObject>
+#include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QDir>
+
+class QFileSystemWatcher;
+class QSocketNotifier;
+
+namespace QTools {
+
+class NameMatcher;
+
+class QTools_EXPORT FileIndex : public QObject
+{ Q_OBJECT
+public:
+    struct File
+    {
+        QString path;   // Relative to the root
+        qint64 size;
+        qint64 mtime;   // Milliseconds since the epoch
+    };  // end struct
+
+    // Index the files beneath root. The index is saved to cacheFile or to a file
+    // named for the root under the user's cache location if not given.
+    explicit FileIndex( const QDir &root, const QString &cacheFile="", QObject *parent=nullptr);
+    ~FileIndex() override;  // Saves the index if it changed
+
+    const QDir &root() const { return _root;}
+    const QString &cacheFile() const { return _cacheFile;}
+
+    // Load the index from the cache file and check which directories changed since it was
+    // saved (only directory modification times are checked so changes to the size or
+    // modification time of existing files made while not watching won't be noticed).
+    // Returns false if there's no usable cache in which case everything is scanned when next queried.
+    bool load();
+
+    // Save the index to the cache file returning true on success.
+    bool save();
+
+    // Bring the index up to date. Happens automatically when querying.
+    void refresh();
+
+    // Discard the index and scan everything again.
+    void rebuild();
+
+    // Returns the indexed files with names matching the given filters (wildcard patterns
+    // matched case insensitively). Files are in the same order as FileIO::recursivelyListFiles.
+    QFileInfoList list( const QStringList &nameFilters={"*.*"});
+    QVector<File> files( const QStringList &nameFilters={"*.*"});
+
+    // The number of directories indexed.
+    int dirCount() const { return _dirs.size();}
+
+signals:
+    // Emitted when changes beneath the root are first noticed after a refresh.
+    void onChanged();
+
+private slots:
+    void _doOnNotified();
+    void _doOnDirectoryChanged( const QString&);
+
+private:
+    struct Entry
+    {
+        QString name;
+        qint64 size;
+        qint64 mtime;
+    };  // end struct
+
+    struct Dir
+    {
+        bool ok = false;        // False if couldn't be read
+        qint64 mtime = 0;
+        QByteArray id;          // Identifies the directory reached (through symlinks)
+        QVector<Entry> files;   // In name order
+        QStringList dirs;       // Names of subdirectories in name order
+    };  // end struct
+
+    const QDir _root;
+    const QString _cacheFile;
+    QHash<QString, Dir> _dirs;  // Keyed by path relative to the root (empty for the root)
+    QSet<QString> _dirty;       // Directories to rescan
+    bool _modified;
+    int _ifd;
+    QSocketNotifier *_notifier;
+    QFileSystemWatcher *_watcher;
+    QHash<int, QStringList> _wdPaths;  // Every path to the directory (inode) watched by a descriptor
+    QHash<QString, int> _pathWds;
+    QSet<QString> _unwatched;   // Directories that couldn't be watched
+
+    QString _absPath( const QString&) const;
+    Dir _readDir( const QString&) const;
+    void _scan( const QStringList&);
+    void _drop( const QString&);
+    void _watch( const QString&);
+    void _unwatch( const QString&);
+    void _unwatchAll();
+    void _markDirty( const QString&);
+    template <typename F> void _visit( const QString&, const NameMatcher&, F&&, QSet<QByteArray>&) const;
+    FileIndex( const FileIndex&) = delete;
+    void operator=( const FileIndex&) = delete;
+};  // end class
+
+}   // end namespace
+
+#endif
@@ -19,7 +19,7 @@
 #define QTOOLS_HELP_ASSISTANT_H
 
 #include "HelpBrowser.h"
-#include <QTemporaryDir>
+#include <QSet>
 
 namespace QTools {
 
@@ -29,24 +29,26 @@ public:
     /**
      * Pass in the directory containing html files for content.
      * There should at least be a file called "index.html" within.
-     * Upon creation, all documents in the given directory are copied
-     * into a temporary working directory to which new documents can
-     * be dynamically added using addDocument.
+     * The directory may also be within a registered Qt resource (e.g. ":/help")
+     * so that content can be packed into a binary resource file. Nothing is
+     * copied from it; files are read from it when needed. Documents added
+     * using addDocument or addContent are held in memory and are found
+     * before files in hdir.
      */
     explicit HelpAssistant( const QString& hdir, QWidget* parent=nullptr);
     ~HelpAssistant();
 
     /**
-     * Add an html file (absolute path to input file) in the working directory within the
-     * given subdirectory and return the identifying token for the page to be used later
-     * in calls to show. If the subdirectory does not exist, it will be created.
-     * Note that the subdirectory cannot be empty.
+     * Add the contents of an html file (absolute path to input file) as a document in memory
+     * within the given subdirectory and return the identifying token for the page to be used
+     * later in calls to show. The subdirectory need not exist (it's virtual) but can't be empty.
      */
     QString addDocument( const QString& subdir, const QString& htmlFileAbspath);
 
     /**
      * As above, but instead of adding a file, the explicit HTML content is provided.
-     * Without any content provided, the subdirectory is created and "" is returned.
+     * Without any content provided, the (virtual) subdirectory is created and "" is returned.
+     * The content is never written to file.
      */
     QString addContent( const QString& subdir, const QString& htmlContent="");
 
@@ -54,9 +56,20 @@ public:
      * Call after all documentation added to refresh what's displayed in the dialog.
      * Pass the path of the XML file which defines the table of contents (TOC).
      * This can include references to directories added using addContent.
+     * The pages in the TOC are then indexed for searching in the background.
      */
     void refreshContents( const QString& tocXMLFile);
 
+    /**
+     * Set whether the table of contents built by refreshContents is cached (true by default).
+     * The cache is written to cacheFile or, if not given, to a file named for the TOC file in
+     * the application's cache location. It's used as is while the TOC file, the files it
+     * references and the directories it lists are unchanged. Otherwise only the titles of
+     * changed files are reread. Documents added in memory aren't cached but are added to
+     * the cached table of contents each time.
+     */
+    void setTocCache( bool enable, const QString& cacheFile="");
+
     /**
      * Show the specified page by reference to its token. If token is empty,
      * the index page is shown. True is retured iff the content was found.
@@ -65,8 +78,11 @@ public:
 
 private:
     HelpBrowser *_dialog;
-    QTemporaryDir _workdir;
-    void _initTempHtmlDir( const QString&);
+    HelpSearchIndex *_index;
+    QString _srcdir;
+    QSet<QString> _vdirs;       // Subdirectories of added documents
+    bool _useCache;
+    QString _cacheFile;
 };  // end class
 
 }   // end namespace
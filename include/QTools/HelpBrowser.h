@@ -19,11 +19,15 @@
 #define QTOOLS_HELP_BROWSER_H
 
 #include "TreeModel.h"
+#include "HelpSearchIndex.h"
 #include <QMainWindow>
+#include <QListWidget>
+#include <QLineEdit>
 #include <QToolButton>
 #include <QTextBrowser>
 #include <QTreeView>
 #include <QSplitter>
+#include <QTimer>
 // TODO Switch to QtWebEngineView instead of QTextBrowser to use Javascript etc.
 // Note this requires optional Qt addon module which under Windows needs MSVC 2017.
 // Only do this after setting up MSVC 2017 compiler.
@@ -42,6 +46,11 @@ public:
      */
     void setRootDir( const QString&);
 
+    /**
+     * As above but content is looked for in each of the given roots in turn (first found is used).
+     */
+    void setRootDirs( const QStringList&);
+
     /**
      * Set the table of contents according to the given model which will be
      * taken ownership of and used as the QTreeView's data. Any existed model
@@ -54,20 +63,61 @@ public:
      */
     bool setContent( const QString& htmlfile);
 
+    /**
+     * Add a document held in memory with the given reference (its path relative to the roots).
+     * In memory documents are found before files in the roots. Replaces any existing document.
+     */
+    void addDocument( const QString& ref, const QString& html);
+
+    /**
+     * The documents held in memory keyed by reference.
+     */
+    const QHash<QString, QString>& documents() const { return _docs;}
+
+    /**
+     * Set the memory budget in megabytes for the parsed pages and decoded images kept so that
+     * revisiting them is instant (64MB by default). The least recently used are dropped first.
+     * Zero disables the cache.
+     */
+    void setCacheSize( int mbytes);
+
+    /**
+     * Set whether the pages before and after the current page in the table of contents
+     * are loaded into the cache while idle (true by default).
+     */
+    void setPrefetch( bool);
+
+    /**
+     * Set the index to search with the search field (not owned). Results are listed in
+     * place of the table of contents while there's a query. Pass null to disable searching.
+     */
+    void setSearchIndex( HelpSearchIndex*);
+
 protected:
     QSize sizeHint() const override { return QSize( 1150, 700);}
 
 private slots:
     void _doOnSourceChanged( const QUrl&);
+    void _doOnSearch();
+    void _doOnResultActivated( QListWidgetItem*);
+    void _doPrefetch();
 
 private:
     QString _wprfx;
-    QString _rootDir;
     QSplitter *_splitter;
     QTreeView *_tview;
-    QTextBrowser *_tbrowser;
+    QLineEdit *_searchEdit;
+    QListWidget *_results;
+    HelpSearchIndex *_index;
+    class TextBrowser;
+    TextBrowser *_tbrowser;
     QToolButton *_backButton;
     QToolButton *_fwrdButton;
+    QTimer *_prefetchTimer;
+    QStringList _prefetchRefs;
+    bool _prefetch;
+
+    QHash<QString, QString> _docs;
 
     class TreeView;
     void _setContent( const QString&);
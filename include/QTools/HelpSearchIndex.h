@@ -0,0 +1,133 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#ifndef QTOOLS_HELP_SEARCH_INDEX_H
+#define QTOOLS_HELP_SEARCH_INDEX_H
+
+/**
+ * Full text search over help pages. The words of each page (ignoring markup, scripts
+ * and styles) are kept in an inverted index of positional postings with the terms
+ * in sorted order so that the last word of a query can be matched as a prefix.
+ * Pages are (re)indexed in the background and the index is saved to a cache file
+ * so that only pages changed since (by size and modification time) are reread.
+ * Searching is safe while the index is being updated.
+ */
+
+#include "QTools_Export.h"
+#include <QThreadPool>
+#include <QReadWriteLock>
+#include <QStringList>
+#include <QObject>
+#include <QVector>
+#include <QHash>
+#include <QMap>
+#include <atomic>
+
+namespace QTools {
+
+class QTools_EXPORT HelpSearchIndex : public QObject
+{ Q_OBJECT
+public:
+    struct Hit
+    {
+        QString ref;    // Reference of the page (its path relative to the content roots)
+        QString title;  // Page title (or ref if the page has no title)
+        double score;
+    };  // end struct
+
+    // The index is loaded from and saved to cacheFile (not saved if empty).
+    explicit HelpSearchIndex( const QString &cacheFile="", QObject *parent=nullptr);
+    ~HelpSearchIndex() override;  // Waits for updates to finish then saves if changed
+
+    const QString &cacheFile() const { return _cacheFile;}
+
+    // Set the pages to index in the background as a hash of page references to file paths.
+    // On first use, the index is loaded from the cache file. Pages indexed from files not
+    // in the given hash are dropped and only new or changed files are read.
+    void update( const QHash<QString, QString> &pages);
+
+    // Index the given HTML content in the background as the page with the given reference.
+    // Pages added this way aren't saved to the cache file.
+    void addPage( const QString &ref, const QString &html);
+
+    // Returns true while updating in the background.
+    bool isUpdating() const;
+
+    // Block until background updates are finished.
+    void waitForUpdates();
+
+    // Search for pages containing all words in the query returning up to maxHits in
+    // descending order of relevance. Words in double quotes must appear together as
+    // a phrase. The last word is matched as a prefix unless followed by a space.
+    QVector<Hit> search( const QString &query, int maxHits=50) const;
+
+    // The number of pages and distinct terms in the index.
+    int pageCount() const;
+    int termCount() const;
+
+    // Save the index to the cache file returning true on success.
+    bool save();
+
+signals:
+    // Emitted (from the updating thread) after each background update.
+    void onUpdated();
+
+private:
+    struct Page
+    {
+        QString ref;
+        QString title;
+        QString file;       // Empty for pages added from content
+        qint64 size;
+        qint64 mtime;
+        qint32 length;      // Number of words including the title's
+        qint32 titleLength; // Number of words in the title (which come first)
+        QStringList terms;  // Distinct terms in the page
+        bool live;
+    };  // end struct
+
+    struct Posting
+    {
+        qint32 page;
+        QVector<qint32> positions;
+    };  // end struct
+
+    struct Parsed;
+
+    const QString _cacheFile;
+    mutable QReadWriteLock _lock;
+    QVector<Page> _pages;
+    QVector<qint32> _freeIds;                   // Of dropped pages for reuse
+    QHash<QString, int> _pageIds;               // Live pages by reference
+    QMap<QString, QVector<Posting>> _postings;  // Sorted by term for prefix lookup
+    qint64 _totalLength;                        // Sum of live page lengths
+    bool _loaded;
+    std::atomic<bool> _modified;
+    QThreadPool _pool;                          // Runs updates in order
+
+    void _ensureLoaded();
+    bool _load();
+    void _update( const QHash<QString, QString>&);
+    void _merge( const QVector<Parsed>&);
+    void _drop( int);
+    HelpSearchIndex( const HelpSearchIndex&) = delete;
+    void operator=( const HelpSearchIndex&) = delete;
+};  // end class
+
+}   // end namespace
+
+#endif
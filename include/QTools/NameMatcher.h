@@ -0,0 +1,78 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#ifndef QTOOLS_NAME_MATCHER_H
+#define QTOOLS_NAME_MATCHER_H
+
+/**
+ * Matches file names against a set of wildcard patterns (as used for QDir name filters)
+ * where * matches any run of characters, ? matches a single character, and [...] matches
+ * a single character from the set ([!...] or [^...] for characters not in the set).
+ * Patterns of the form *.ext are matched by comparing name suffixes, and the remaining
+ * patterns are compiled together into a single deterministic automaton so that names are
+ * matched in one pass over their (UTF-8) bytes without allocating. The few patterns that
+ * can't be compiled (very large or negated non-ASCII character sets) fall back to regular
+ * expressions. Matching is const and safe to do from multiple threads at once.
+ */
+
+#include "QTools_Export.h"
+#include <QRegularExpression>
+#include <QStringList>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace QTools {
+
+class QTools_EXPORT NameMatcher
+{
+public:
+    explicit NameMatcher( const QStringList &patterns={"*"}, Qt::CaseSensitivity cs=Qt::CaseInsensitive);
+
+    // Returns true iff the given UTF-8 encoded name matches at least one of the patterns.
+    bool matches( const char *name, size_t len) const;
+    bool matches( const char *name) const { return matches( name, strlen( name));}
+    bool matches( const QString&) const;
+
+    // True if every name matches (no need to call matches).
+    bool matchesEverything() const { return _all;}
+
+    const QStringList &patterns() const { return _patterns;}
+    Qt::CaseSensitivity caseSensitivity() const { return _cs;}
+
+    // The number of states in the compiled automaton.
+    int stateCount() const { return int(_accept.size());}
+
+private:
+    const QStringList _patterns;
+    const Qt::CaseSensitivity _cs;
+    bool _all;
+    std::vector<std::string> _exts;     // Suffixes (including the dot) of *.ext patterns
+    unsigned char _classes[256];        // Byte equivalence classes
+    int _nclasses;
+    std::vector<int> _table;            // Transitions (state * _nclasses + class); -1 for no match
+    std::vector<char> _accept;          // Zero if not accepting, 1 if accepting, 2 if accepting whatever follows
+    std::vector<QRegularExpression> _slow;
+
+    void _compile( const std::vector<QString>&);
+    bool _matchesExt( const char*, size_t) const;
+    bool _matchesSlow( const QString&) const;
+};  // end class
+
+}   // end namespace
+
+#endif
@@ -22,6 +22,8 @@
 #include "PatchList.h"
 #include <QNetworkAccessManager>
 #include <QTemporaryFile>
+#include <QElapsedTimer>
+#include <QTimer>
 
 namespace QTools {
 
@@ -59,6 +61,45 @@ public:
     // when complete. Returns true if updating was started.
     bool updateApp();
 
+    // Cap the rate at which data is downloaded (bytes per second). The cap is shared
+    // across all concurrent transfers. Set zero (the default) for no cap. Can be
+    // changed while downloading.
+    void setMaxDownloadRate( qint64 bytesPerSecond);
+    qint64 maxDownloadRate() const { return _maxRate;}
+
+    // In background mode, the updater thread runs its disk work with low CPU
+    // and I/O priority. Typically combined with a download rate cap.
+    void setBackgroundMode( bool);
+    bool isBackgroundMode() const;
+
+    // In staged mode, onFinishedUpdating means the update is ready and will be
+    // applied by AppUpdater::applyPendingUpdate at the next launch.
+    void setStagedMode( bool);
+    bool isStagedMode() const;
+
+    // Pause any downloads in progress keeping the data downloaded so far.
+    // Returns false if there's nothing being downloaded (or already paused).
+    bool pause();
+
+    // Resume paused downloads from where they left off (if the server accepts
+    // byte range requests - otherwise the download restarts). Returns false
+    // if not paused.
+    bool resume();
+
+    bool isPaused() const { return _paused;}
+
+    // The updater that extracts and installs the downloaded patches.
+    // Connect to its signals to follow the progress of updating.
+    const AppUpdater &appUpdater() const { return _updater;}
+
+    // Network metrics (phase times for the manifest and downloads, bytes downloaded,
+    // resumed and restarted transfers, errors) since the manifest was last refreshed.
+    const UpdateMetrics &metrics() const { return _metrics;}
+
+    // Returns {"network": {...}, "updater": {...}} from the network metrics and those
+    // of the AppUpdater. Also written to the log when updating finishes.
+    QJsonObject metricsReport() const;
+
 signals:
     void onRefreshedManifest();
 
@@ -78,28 +119,53 @@ signals:
 
 private slots:
     void _doOnReplyFinished( QNetworkReply*);
-    void _doOnDownloadProgress( QNetworkReply*);
+    void _doOnMetaDataChanged( QNetworkReply*);
+    void _doOnReadyRead( QNetworkReply*);
+    void _doOnDownloadProgress();
+    void _doOnThrottleTick();
     void _doOnFinishedUpdating( const QString&);
 
 private:
+    struct Download
+    {
+        QUrl url;
+        PatchArchive::Format format;    // Declared format of a patch archive
+        QNetworkReply *reply;   // Null when not connected (paused or finished)
+        QTemporaryFile *file;   // Receives data as it's read from the reply
+        qint64 total;           // Expected size of the whole file (-1 if unknown)
+        bool finished;
+    };  // end struct
+
     const QUrl _manifestUrl;
     const int _transferTimeout;
     const int _maxRedirects;
     QNetworkAccessManager *_nman;
     bool _isManifest;
+    bool _paused;
     PatchList _plist;
-    QList<QNetworkReply*> _nconns;
-    QList<QTemporaryFile*> _files;
+    QList<Download> _dloads;
     QString _err;
     AppUpdater _updater;
-
-    bool _writeDataToFile( QNetworkReply*);
+    UpdateMetrics _metrics;
+
+    qint64 _maxRate;    // Bytes per second (zero for no cap)
+    qint64 _mtokens;    // Thousandths of bytes that may be read right now
+    QTimer *_throttleTimer;
+    QElapsedTimer _tickClock;
+
+    bool _isThrottled() const { return _maxRate > 0;}
+    bool _isDownloading() const;
+    int _indexOf( const QNetworkReply*) const;
+    qint64 _readData( Download&, qint64);
+    bool _readThrottled();
     bool _allRepliesFinished() const;
     bool _allUpdatesDownloaded() const;
     void _resetConnections();
     void _resetDownloads();
+    void _processDownloads();
     bool _startAppUpdater();
-    QNetworkReply *_startConnection( const QUrl&, bool);
+    bool _startDownload( const QUrl&, PatchArchive::Format=PatchArchive::Format::Unknown);
+    QNetworkReply *_startConnection( const Download&);
     NetworkUpdater( const NetworkUpdater&) = delete;
     void operator=( const NetworkUpdater&) = delete;
 };  // end class
@@ -0,0 +1,52 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#ifndef QTOOLS_PATCH_ARCHIVE_H
+#define QTOOLS_PATCH_ARCHIVE_H
+
+#include "QTools_Export.h"
+#include <QStringList>
+
+namespace QTools {
+namespace PatchArchive {
+
+enum struct Format
+{
+    Unknown,
+    Zip,        // Deflate compressed zip archive
+    TarZstd     // Zstandard compressed tar archive (.tar.zst)
+};  // end enum
+
+// Returns the format named by the given string ("zip" or "tar.zst") or
+// by the extension of the given archive filename.
+QTools_EXPORT Format formatFromName( const QString&);
+
+// Returns the format of the given archive file by looking at its leading bytes.
+QTools_EXPORT Format formatOfFile( const QString&);
+
+// Extract all files from the given archive into the given directory (created if
+// necessary) clobbering any existing files with the same names. The format is
+// detected from the file's content and if an expected format is given, archives
+// of any other format are refused. Returns the paths of the extracted entries
+// or an empty list on failure. Zstandard archives made of multiple independent
+// frames (e.g. written by pzstd or in the seekable format) have their
+// frames decompressed in parallel.
+QTools_EXPORT QStringList extract( const QString &archive, const QString &dir, Format expected=Format::Unknown);
+
+}}   // end namespaces
+
+#endif
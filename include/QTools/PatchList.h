@@ -18,7 +18,7 @@
 #ifndef QTOOLS_PATCH_LIST_H
 #define QTOOLS_PATCH_LIST_H
 
-#include "QTools_Export.h"
+#include "PatchArchive.h"
 #include <boost/property_tree/ptree.hpp>
 #include <QMap>
 #include <QUrl>
@@ -36,6 +36,10 @@ public:
     bool setArchive( const QString&);
     const QString &archive() const { return _archive;}
 
+    // The declared format of the archive (zip by default).
+    void setArchiveFormat( PatchArchive::Format f) { _format = f;}
+    PatchArchive::Format archiveFormat() const { return _format;}
+
     bool addFileToModify( const QString&);
     const QStringList &mfiles() const { return _mfiles;}
 
@@ -44,6 +48,7 @@ public:
 
 private:
     QString _archive;
+    PatchArchive::Format _format;
     QStringList _mfiles;    // Files to modify
     QStringList _rfiles;    // Files to remove
 };  // end class
@@ -128,7 +133,10 @@ public:
     // Return a list of the patch URLs needed with the most recent first.
     QList<QUrl> patchURLs() const;
 
-    // Try to parse the given zip file containing XML data returning
+    // The declared archive formats of the patches (in the same order as patchURLs).
+    QList<PatchArchive::Format> patchFormats() const;
+
+    // Try to parse the given archive (zip or tar.zst) containing XML data returning
     // true iff succeeded. On return of false, call error() to return
     // the error string which is empty if this function returns false.
     bool parse( const QString &filename);
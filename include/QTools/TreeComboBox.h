@@ -20,6 +20,8 @@
 
 #include "QTools_Export.h"    // QTools
 #include <QComboBox>
+#include <QPointer>
+#include <QVector>
 
 namespace QTools {
 
@@ -27,6 +29,16 @@ class QTools_EXPORT TreeComboBox : public QComboBox
 { Q_OBJECT
 public:
     explicit TreeComboBox( QWidget* parent=nullptr);
+    ~TreeComboBox() override;
+
+    /**
+     * Filter the items shown in the popup to those with text (in the model column)
+     * containing the given text (case insensitively) plus their ancestors, which are
+     * expanded. While the popup is shown, typing adds to the filter, Backspace removes
+     * the last character and Escape clears it. The filter is cleared when the popup hides.
+     */
+    void setFilterText( const QString&);
+    const QString &filterText() const { return _filter;}
 
 protected:
     bool eventFilter( QObject*, QEvent*) override;
@@ -35,6 +47,15 @@ protected:
 
 private:
     bool _skipNextHide;
+    QString _filter;
+    class FilterIndex;
+    FilterIndex *_findex;           // Built on first use and rebuilt after the model changes
+    QPointer<QAbstractItemModel> _fmodel;
+    QVector<QMetaObject::Connection> _fconns;
+    bool _reapplyQueued;
+    void _applyFilter();
+    void _unhideAll();
+    void _doOnModelChanging();
 };  // end class
 
 }   // end namespace
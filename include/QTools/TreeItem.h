@@ -19,12 +19,21 @@
 #define QTOOLS_TREE_ITEM_H
 
 #include "QTools_Export.h"    // QTools
-#include <unordered_map>
+#include <QVarLengthArray>
 #include <QVector>
 #include <QVariant>
+#include <cstddef>
 
 namespace QTools {
 
+class TreeModel;
+
+/**
+ * Items are allocated in order from large blocks owned by the allocating thread (without
+ * locking) rather than one at a time from the heap, and hold up to two columns of data
+ * inline. A leaf item so needs no allocation of its own; an item with children has one
+ * for its array of children. A block is freed once all of its items have been deleted.
+ */
 class QTools_EXPORT TreeItem
 {
 public:
@@ -32,6 +41,9 @@ public:
     explicit TreeItem( const QVector<QVariant> &data, TreeItem *parent=nullptr);
     ~TreeItem();
 
+    static void* operator new( size_t);
+    static void operator delete( void*, size_t);
+
     void appendChild( TreeItem*);
 
     // Return this item's parent.
@@ -40,10 +52,10 @@ public:
     // Return the child at the given row (or nullptr if none).
     TreeItem *child( int row);
 
-    // Return the row the given item is on or -1 if not found (hash lookup).
+    // Return the row the given child item is on or -1 if it isn't a child (constant time).
     int childRow( const TreeItem*) const;
 
-    // Return the row this item is on with respect to this item's parent.
+    // Return the row this item is on with respect to this item's parent (constant time).
     int row() const;
 
     // The number of children items that this item is a parent of.
@@ -56,10 +68,17 @@ public:
     QVariant data( int col) const;
 
 private:
-    QVector<QVariant> _data;
+    QVarLengthArray<QVariant, 2> _data;
     TreeItem *_parent;
     QVector<TreeItem*> _children;
-    std::unordered_map<const TreeItem*, int> _rowHash;
+    TreeModel *_model;  // Set on the root of a TreeModel to keep its indexes updated
+    int _row;           // Row in parent's children
+    bool _canFetch;     // True if children may be fetched for lazily
+
+    void _insertChildren( int, const QVector<TreeItem*>&);
+    QVector<TreeItem*> _takeChildren( int, int);
+    void _renumber( int);
+    friend class TreeModel;
 };  // end class
 
 }   // end namespace
@@ -19,12 +19,17 @@
 #define QTOOLS_TREE_MODEL_H
 
 /**
- * A read only data model.
+ * A read only data model. It can be built up front (from setNewRoot) or populated
+ * lazily as views ask for children (see setProvider).
  */
 
 #include "TreeItem.h"    // QTools
 #include <QAbstractItemModel>
+#include <QThreadPool>
+#include <QMultiHash>
 #include <QString>
+#include <QHash>
+#include <functional>
 
 namespace QTools {
 
@@ -32,7 +37,26 @@ class QTools_EXPORT TreeModel : public QAbstractItemModel
 { Q_OBJECT
 public:
     explicit TreeModel( QObject *prnt = nullptr);
-    ~TreeModel() override;
+    ~TreeModel() override;  // Waits for any children being produced on worker threads
+
+    struct LazyItem
+    {
+        QVector<QVariant> data;
+        bool hasChildren;   // False if the item should never be fetched for
+    };  // end struct
+
+    // Produces the children of an item given the item's data.
+    using ChildProvider = std::function<QVector<LazyItem>( const QVector<QVariant>&)>;
+
+    /**
+     * Populate the model lazily. The children of items are produced on demand by the provider
+     * as views expand them (through canFetchMore and fetchMore) and are inserted in batches of
+     * batchSize rows per pass of the event loop. If threaded, the provider is called on a worker
+     * thread (so must be thread safe) and the model is unchanged until its results arrive. The
+     * root is fetched for if it has no children; items added by hand are never fetched for.
+     * Pass a null provider to stop fetching.
+     */
+    void setProvider( const ChildProvider&, bool threaded=false, int batchSize=256);
 
     /**
      * Set a new root for this model and return it. Do NOT delete the returned
@@ -52,15 +76,78 @@ public:
     QModelIndex parent( const QModelIndex &index) const override;
     int rowCount( const QModelIndex &parent = QModelIndex()) const override;
     int columnCount( const QModelIndex &parent = QModelIndex()) const override;
+    bool hasChildren( const QModelIndex &parent = QModelIndex()) const override;
+    bool canFetchMore( const QModelIndex &parent) const override;
+    void fetchMore( const QModelIndex &parent) override;
+
+    /**
+     * Return the index of the given item in column 0 (invalid for the root).
+     */
+    QModelIndex indexOf( TreeItem*) const;
+
+    /**
+     * Insert the given items (which must not have parents) as children of the given parent
+     * starting at the given row, taking ownership of them. Views are told of the whole batch
+     * at once. Rows are clamped to the valid range and returns the number of items inserted.
+     */
+    int insertItems( TreeItem *parent, int row, const QVector<TreeItem*>& items);
+    int appendItems( TreeItem *parent, const QVector<TreeItem*>& items);
 
     /**
-     * Linear search of the model to find the index with the given data at the given column.
+     * Remove and delete count children of the given parent starting at the given row.
+     * Returns false (removing nothing) if the rows aren't all valid.
+     */
+    bool removeItems( TreeItem *parent, int row, int count);
+
+    /**
+     * Move count children of srcParent starting at srcRow to be children of dstParent
+     * starting at dstRow (as counted before the move) keeping their descendants. Returns
+     * false (moving nothing) if the rows aren't valid or dstParent is one of the moved items
+     * or a descendant of one.
+     */
+    bool moveItems( TreeItem *srcParent, int srcRow, int count, TreeItem *dstParent, int dstRow);
+
+    /**
+     * Find the first index (in depth first order) with the given data at the given column.
+     * This is a hash lookup if the column is indexed and a search of the model otherwise.
      */
     QModelIndex find( const QVariant& data, int col) const;
 
+    /**
+     * Set whether to keep a hash index of the data in the given column for find. Items
+     * appended with TreeItem::appendChild (anywhere under the root) are indexed as they're
+     * added and the index is kept across calls to setNewRoot. Data are hashed as strings.
+     */
+    void setIndexed( int col, bool enable=true);
+    bool isIndexed( int col) const { return _indexes.contains(col);}
+
 private:
     TreeItem *_rootItem;
+    QHash<int, QMultiHash<QString, TreeItem*> > _indexes;  // Items by column data
+
+    struct Pending
+    {
+        TreeItem *item;
+        QVector<LazyItem> children;
+        int next;   // Index of the next child to insert
+    };  // end struct
+
+    ChildProvider _provider;
+    bool _threaded;
+    int _batchSize;
+    quint64 _lastFetch;
+    QHash<TreeItem*, quint64> _fetches;     // Items being fetched for by fetch ID
+    QVector<Pending> _pending;              // Fetched children yet to be inserted
+    bool _batchQueued;
+    QThreadPool _pool;
+
+    TreeItem* _item( const QModelIndex&) const;
     QModelIndex _find( TreeItem*, const QVariant&, int) const;
+    void _addToIndexes( TreeItem*);
+    void _removing( TreeItem*);
+    void _onFetched( TreeItem*, quint64, const QVector<LazyItem>&);
+    void _insertBatch();
+    friend class TreeItem;
 };  // end class
 
 }   // end namespace
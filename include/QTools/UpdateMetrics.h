@@ -0,0 +1,78 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#ifndef QTOOLS_UPDATE_METRICS_H
+#define QTOOLS_UPDATE_METRICS_H
+
+/**
+ * Wall times of named phases and named counters recorded while updating.
+ * Safe to record into and read from different threads.
+ */
+
+#include "QTools_Export.h"
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMap>
+
+namespace QTools {
+
+class QTools_EXPORT UpdateMetrics
+{
+public:
+    UpdateMetrics();
+
+    // Discard everything recorded and restart the total time.
+    void reset();
+
+    // Start timing the named phase ending the current phase (if any).
+    // Times for phases started more than once are summed.
+    void startPhase( const QString&);
+
+    // End timing of the current phase.
+    void endPhase();
+
+    // Add to the named counter.
+    void add( const QString&, qint64 n=1);
+
+    // Returns the named counter's value (zero if never added to).
+    qint64 count( const QString&) const;
+
+    // Returns the milliseconds spent in the named phase or -1 if never started.
+    qint64 phaseMsecs( const QString&) const;
+
+    // Milliseconds since the last reset.
+    qint64 totalMsecs() const;
+
+    // Returns {"totalMsecs": n, "phasesMsecs": {...}, "counts": {...}}.
+    QJsonObject toJson() const;
+
+private:
+    mutable QMutex _lock;
+    QElapsedTimer _total;
+    QElapsedTimer _phaseTimer;
+    QString _phase;
+    QMap<QString, qint64> _phases;
+    QMap<QString, qint64> _counts;
+    void _endPhase();
+    UpdateMetrics( const UpdateMetrics&) = delete;
+    void operator=( const UpdateMetrics&) = delete;
+};  // end class
+
+}   // end namespace
+
+#endif
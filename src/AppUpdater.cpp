@@ -17,9 +17,18 @@
 
 #include <AppUpdater.h>
 #include <FileIO.h> // QTools
-#include <quazip/JlCompress.h>
+#include <PatchArchive.h>
 #include <QCoreApplication>
+#include <QStandardPaths>
+#include <QSettings>
+#include <QJsonDocument>
 #include <iostream>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif _WIN32
+#include <Windows.h>
+#endif
 using QTools::AppUpdater;
 
 namespace {
@@ -41,71 +50,165 @@ void _printFileInfo( const QString &pth)
 }   // end _printFileInfo
 */
 
-bool _isFileAllowed( const QString &f, const QString &username)
-{
-    return FileIO::inHomeDir(f) || (QFileInfo(f).owner() == username);
-}   // end _isFileAllowed
+bool _isAllowed( const QStringList &flist) { return !FileIO::anyNeedElevation( flist);}
 
 
-bool _isAllowed( const QStringList &flist)
+void _addPrivilegedOp( UpdateMetrics &metrics, bool ok)
 {
-    const QString username = FileIO::username();
-    for ( const QString &f : flist)
-        if ( QFileInfo::exists( f) && !_isFileAllowed( f, username))
-            return false;
-    return true;
-}   // end _isAllowed
+    metrics.add( "privilegedOps");
+    if ( !ok)
+        metrics.add( "privilegedFailures");
+}   // end _addPrivilegedOp
 
 
-bool _updateFiles( const QString &src, const QString &tgt, const QString &bck)
+bool _updateFiles( const QString &src, const QString &tgt, const QString &bck, UpdateMetrics &metrics)
 {
     std::cerr << "[INFO] QTools::AppUpdater: Updating \"" << tgt.toStdString() << "\"\n";
+
     // Write directly directory if we have permission. Otherwise
     // invoke via process to allow OS to request permissions.
+    // What's moved is counted as it's moved (not when moved as root).
     bool ok = true;
-    if ( FileIO::isRoot() || _isAllowed( {src, tgt}))
-        ok = FileIO::moveFiles( src, tgt, bck);
+    FileIO::MoveCounts counts;
+    if ( _isAllowed( {src, tgt}))
+        ok = FileIO::moveFiles( src, tgt, bck, &counts);
     else
+    {
         ok = FileIO::moveFilesAsRoot( src, tgt, bck);
+        _addPrivilegedOp( metrics, ok);
+    }   // end else
 
     if ( !ok)
         std::cerr << "[WARNING] QTools::AppUpdater: Unable to update - file locks?\n";
+    else
+    {
+        metrics.add( "movedFiles", counts.files);
+        metrics.add( "movedBytes", counts.bytes);
+        metrics.add( "backedUpFiles", counts.displaced);
+    }   // end else
     return ok;
 }   // end _updateFiles
 
 
-void _removeFiles( const QStringList &rpaths, const QString &tgt)
+void _removeFiles( const QStringList &rpaths, const QString &tgt, UpdateMetrics &metrics)
 {
-    const QString username = FileIO::username();
-    const bool isRoot = FileIO::isRoot();
-
-    QStringList filesToRemoveWithPermission;
+    QStringList fpaths;
     for ( const QString &pth : rpaths)
     {
         const QString fpath = QFileInfo( tgt + "/" + pth).canonicalFilePath();
-        if ( !QFileInfo::exists(fpath))
-            continue;
+        if ( !fpath.isEmpty())  // Empty if the file doesn't exist
+            fpaths << fpath;
+    }   // end for
 
-        bool ok = false;
-        if ( isRoot || _isFileAllowed( fpath, username))
-            ok = QFile::remove( fpath);
-        else
-            filesToRemoveWithPermission << fpath;
+    // Check all at once which files can't be removed without elevated privileges
+    const QVector<bool> elevate = FileIO::needsElevation( fpaths);
 
-        if (!ok)
+    QStringList filesToRemoveWithPermission;
+    for ( int i = 0; i < fpaths.size(); ++i)
+    {
+        const QString &fpath = fpaths.at(i);
+        if ( elevate.at(i))
+            filesToRemoveWithPermission << fpath;
+        else if ( QFile::remove( fpath))
+            metrics.add( "removedFiles");
+        else
+        {
+            metrics.add( "removeFailures");
             std::cerr << "[WARNING] QTools::AppUpdater: Unable to remove \"" << fpath.toStdString() << "\"\n";
+        }   // end else
     }   // end for
 
     if ( !filesToRemoveWithPermission.empty())
-        if ( !FileIO::removeFilesAsRoot( filesToRemoveWithPermission))
+    {
+        const bool ok = FileIO::removeFilesAsRoot( filesToRemoveWithPermission);
+        _addPrivilegedOp( metrics, ok);
+        if ( ok)
+            metrics.add( "removedFiles", filesToRemoveWithPermission.size());
+        else
+        {
+            metrics.add( "removeFailures", filesToRemoveWithPermission.size());
             std::cerr << "[WARNING] QTools::AppUpdater: Unable to remove files as root!\n";
+        }   // end else
+    }   // end if
 }   // end _removeFiles
 
 
+QString _swapAppImage( const QString &newImg, const QString &appImg, const QString &oldImg, UpdateMetrics &metrics)
+{
+    // Swap the new AppImage for the existing one. Since the existing one
+    // is locked, move it to oldImg before replacing with the new one.
+    QString err;
+    if ( _isAllowed( {newImg, appImg}))
+        err = FileIO::swapOverFiles( newImg, appImg, oldImg);
+    else
+    {
+        err = FileIO::swapOverFilesAsRoot( newImg, appImg, oldImg);  // LINUX ONLY!
+        _addPrivilegedOp( metrics, err.isEmpty());
+    }   // end else
+    return err;
+}   // end _swapAppImage
+
+
+// Staged updates are kept per user in the application's local data directory.
+QString _pendingDir()
+{
+    return QStandardPaths::writableLocation( QStandardPaths::AppLocalDataLocation) + "/PendingUpdate";
+}   // end _pendingDir
+
+QString _pendingMarker() { return _pendingDir() + "/pending.ini";}
+
+
+// Write the marker to a temporary file first and rename so a partially
+// written marker is never seen at startup.
+bool _writePendingMarker( const QString &type, const QString &src, const QString &tgt, const QStringList &rpaths)
+{
+    const QString tmpMarker = _pendingDir() + "/pending.tmp";
+    QFile::remove( tmpMarker);
+    {
+        QSettings marker( tmpMarker, QSettings::IniFormat);
+        marker.setValue( "Type", type);
+        marker.setValue( "Source", src);
+        marker.setValue( "Target", tgt);
+        marker.setValue( "Remove", rpaths);
+        marker.sync();
+        if ( marker.status() != QSettings::NoError)
+            return false;
+    }   // end scope
+    return QFile::rename( tmpMarker, _pendingMarker());
+}   // end _writePendingMarker
+
+
+void _logMetrics( const UpdateMetrics &metrics)
+{
+    const QByteArray json = QJsonDocument( metrics.toJson()).toJson( QJsonDocument::Compact);
+    std::cerr << "[INFO] QTools::AppUpdater: Metrics " << json.toStdString() << std::endl;
+}   // end _logMetrics
+
+
+// Lower the I/O priority of the calling thread to reduce contention with other disk users.
+void _lowerThreadIOPriority()
+{
+#ifdef __linux__
+    // Values from linux/ioprio.h which isn't reliably available to userspace.
+    static const int IOPRIO_CLASS_SHIFT = 13;
+    static const int IOPRIO_CLASS_BE = 2;   // Best effort
+    static const int IOPRIO_LOWEST = 7;
+    static const int IOPRIO_WHO_PROCESS = 1;
+    // Using a "who" of zero affects only the calling thread.
+    const int ioprio = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | IOPRIO_LOWEST;
+    if ( syscall( SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) != 0)
+        std::cerr << "[WARNING] QTools::AppUpdater: Unable to lower I/O priority!\n";
+#elif _WIN32
+    // Also lowers the thread's I/O and memory priorities. Ends when the thread exits.
+    if ( !SetThreadPriority( GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN))
+        std::cerr << "[WARNING] QTools::AppUpdater: Unable to enter background mode!\n";
+#endif
+}   // end _lowerThreadIOPriority
+
 }   // end namespace
 
 
-AppUpdater::AppUpdater()
+AppUpdater::AppUpdater() : _background(false), _staged(false), _nskipped(0)
 {
     _appFilePath = QCoreApplication::applicationFilePath();
     // On Linux, recording the information below gives the location of the AppImage
@@ -133,7 +236,75 @@ bool AppUpdater::_isAppImage() const
 void AppUpdater::setAppPatchDir( const QString &rp) { _relPath = rp;}
 
 
-bool AppUpdater::update( const QStringList &fns, const QStringList &rpaths)
+bool AppUpdater::hasPendingUpdate() { return QFileInfo::exists( _pendingMarker());}
+
+
+QString AppUpdater::applyPendingUpdate( bool *relaunch)
+{
+    if ( relaunch)
+        *relaunch = false;
+
+    const QString pdir = _pendingDir();
+    if ( !hasPendingUpdate())
+    {
+        // Clear out anything left over from a previously applied update.
+        QDir( pdir).removeRecursively();
+        return "";
+    }   // end if
+
+    QString type, src, tgt;
+    QStringList rpaths;
+    {
+        const QSettings marker( _pendingMarker(), QSettings::IniFormat);
+        type = marker.value( "Type").toString();
+        src = marker.value( "Source").toString();
+        tgt = marker.value( "Target").toString();
+        rpaths = marker.value( "Remove").toStringList();
+    }   // end scope
+
+    // Remove the marker first so a failing update isn't retried on every launch.
+    QFile::remove( _pendingMarker());
+    if ( !QFileInfo::exists( src) || !QFileInfo::exists( tgt))
+    {
+        QDir( pdir).removeRecursively();
+        return tr("Pending update is incomplete!");
+    }   // end if
+
+    std::cerr << "[INFO] QTools::AppUpdater: Applying pending update to \"" << tgt.toStdString() << "\"\n";
+    UpdateMetrics metrics;
+    QString err;
+    if ( type == "AppImage")
+    {
+        metrics.startPhase( "swap");
+        const QString oldImg = pdir + "/" + QFileInfo( tgt).fileName() + ".old";
+        QFile::remove( oldImg);
+        err = _swapAppImage( src, tgt, oldImg, metrics);
+        if ( err.isEmpty() && relaunch)
+            *relaunch = true;   // This process is still running the old AppImage
+    }   // end if
+    else
+    {
+        const QString bckdir = pdir + "/Backups";
+        metrics.startPhase( "move");
+        if ( _updateFiles( src, tgt, bckdir, metrics))
+        {
+            metrics.startPhase( "remove");
+            _removeFiles( rpaths, tgt, metrics);
+        }   // end if
+        else
+            err = tr("Failed to update files!");
+        metrics.startPhase( "cleanup");
+        QDir( src).removeRecursively();
+        QDir( bckdir).removeRecursively();
+    }   // end else
+
+    metrics.endPhase();
+    _logMetrics( metrics);
+    return err;
+}   // end applyPendingUpdate
+
+
+bool AppUpdater::update( const QStringList &fns, const QStringList &rpaths, const QList<PatchArchive::Format> &fmts)
 {
     if ( _isAppImage() && FileIO::APP_IMAGE_TOOL.isEmpty())
     {
@@ -149,14 +320,20 @@ bool AppUpdater::update( const QStringList &fns, const QStringList &rpaths)
     }   // end if
 
     _rpaths = rpaths;
+    _formats = fmts;
 
-    start();
+    start( _background ? QThread::LowestPriority : QThread::InheritPriority);
     return true;
 }   // end update
 
 
 void AppUpdater::run()
 {
+    _nskipped = 0;
+    _metrics.reset();
+    if ( _background)
+        _lowerThreadIOPriority();
+
     // Create the scratch directory and required entries
     static const QString APP_NAME = QCoreApplication::applicationName();
     // The scratch directory has the application and the username since
@@ -168,8 +345,21 @@ void AppUpdater::run()
     static const QString NEW_APP_DIR = SCRATCH_DIR + "/AppDir";
     QDir( SCRATCH_DIR).removeRecursively();  // Remove this directory if present from previous runs
 
+    // Staged updates replace any previously staged update.
+    const QString PENDING_DIR = _pendingDir();
+    if ( _staged)
+    {
+        QDir( PENDING_DIR).removeRecursively();
+        if ( !QDir().mkpath( PENDING_DIR))
+            return _failFinish( "Failed to create directory for staged update!");
+    }   // end if
+
+    // Files for a staged update go directly to where they'll be applied from at next launch.
+    const QString xdir = _staged && !_isAppImage() ? PENDING_DIR + "/Files" : EXTRACT_DIR;
+
     emit onExtracting();
-    if ( !_extractFiles( EXTRACT_DIR))
+    _metrics.startPhase( "extract");
+    if ( !_extractFiles( xdir))
         return _failFinish( "Failed to extract archive!");
 
     // If this is an AppImage, files are mounted read-only so copy
@@ -177,6 +367,7 @@ void AppUpdater::run()
     static QString binDir = QCoreApplication::applicationDirPath();
     if ( _isAppImage())
     {
+        _metrics.startPhase( "copyAppDir");
         static const QString APP_DIR = QDir( binDir + "/../..").canonicalPath();
         std::cerr << "[INFO] QTools::AppUpdater: Copying "
             << APP_DIR.toStdString() << " to " << NEW_APP_DIR.toStdString() << std::endl;
@@ -185,23 +376,48 @@ void AppUpdater::run()
         binDir = QDir( NEW_APP_DIR + "/usr/bin").canonicalPath();
     }   // end if
 
-    emit onUpdating();
     const QString PATCH_DIR = QDir( binDir + "/" + _relPath).canonicalPath();
-    if ( !_updateFiles( EXTRACT_DIR, PATCH_DIR, BACKUPS_DIR))
+
+    // Cumulative patches often contain files already installed so leave those alone.
+    _metrics.startPhase( "compare");
+    _nskipped = FileIO::removeUnchangedFiles( xdir, PATCH_DIR);
+    _metrics.add( "skippedFiles", _nskipped);
+    std::cerr << "[INFO] QTools::AppUpdater: Skipping " << _nskipped << " unchanged file(s)\n";
+
+    if ( _staged && !_isAppImage())
+    {
+        if ( !_writePendingMarker( "Files", xdir, PATCH_DIR, _rpaths))
+            return _failFinish( "Failed to record staged update!");
+        _metrics.endPhase();
+        _logMetrics( _metrics);
+        emit onFinished( _err);
+        return;
+    }   // end if
+
+    emit onUpdating();
+    _metrics.startPhase( "move");
+    if ( !_updateFiles( xdir, PATCH_DIR, BACKUPS_DIR, _metrics))
         return _failFinish( "Failed to update files!");
 
     // Don't fail if files aren't removed.
-    _removeFiles( _rpaths, PATCH_DIR);
+    emit onRemoving();
+    _metrics.startPhase( "remove");
+    _removeFiles( _rpaths, PATCH_DIR, _metrics);
 
     // Repackage the updated application directory as an AppImage?
     if ( _isAppImage())
     {
         emit onRepacking();
-        static const QString NEW_APP_IMG = SCRATCH_DIR + QString("/%1-NEW.AppImage").arg(APP_NAME);
+        _metrics.startPhase( "repack");
+        const QString NEW_APP_IMG = (_staged ? PENDING_DIR : SCRATCH_DIR) + QString("/%1-NEW.AppImage").arg(APP_NAME);
         static const QString OLD_APP_IMG = SCRATCH_DIR + QString("/%1-OLD.AppImage").arg(APP_NAME);
-        _err = _repackAppImage( NEW_APP_DIR, NEW_APP_IMG, OLD_APP_IMG);
+        _err = _repackAppImage( NEW_APP_DIR, NEW_APP_IMG, _staged ? "" : OLD_APP_IMG);
+        if ( _err.isEmpty() && _staged && !_writePendingMarker( "AppImage", NEW_APP_IMG, _appFilePath, QStringList()))
+            _err = tr("Failed to record staged update!");
     }   // end if
 
+    _metrics.endPhase();
+    _logMetrics( _metrics);
     emit onFinished( _err);
 }   // end run
 
@@ -209,11 +425,14 @@ void AppUpdater::run()
 void AppUpdater::_failFinish( const char *err)
 {
     _err = tr(err);
+    _metrics.endPhase();
+    _metrics.add( "failures");
+    _logMetrics( _metrics);
     emit onFinished(err);
 }   // end _failFinish
 
 
-bool AppUpdater::_extractFiles( const QString &xdir) const
+bool AppUpdater::_extractFiles( const QString &xdir)
 {
     // Extract all files from each archive into the same temporary directory
     // in reverse order. This ensures that the newer files with the same names
@@ -221,26 +440,33 @@ bool AppUpdater::_extractFiles( const QString &xdir) const
     for ( int i = _fpaths.size() - 1; i >= 0; --i)
     {
         std::cerr << "[INFO] QTools::AppUpdater: Extracting \"" << _fpaths.at(i).toStdString() << "\"\n";
-        const QStringList flst = JlCompress::extractDir( _fpaths.at(i), xdir);
+        const QStringList flst = PatchArchive::extract( _fpaths.at(i), xdir, _formats.value( i, PatchArchive::Format::Unknown));
         if ( flst.size() == 0)
             return false;
+        _metrics.add( "archives");
+        _metrics.add( "archiveBytes", QFileInfo( _fpaths.at(i)).size());
+        for ( const QString &f : flst)
+        {
+            const QFileInfo finfo( f);
+            if ( finfo.isFile())
+            {
+                _metrics.add( "extractedFiles");
+                _metrics.add( "extractedBytes", finfo.size());
+            }   // end if
+        }   // end for
     }   // end for
     return true;
 }   // end _extractFiles
 
 
-QString AppUpdater::_repackAppImage( const QString &NEW_APP_DIR, const QString &NEW_APP_IMG, const QString &OLD_APP_IMG) const
+QString AppUpdater::_repackAppImage( const QString &NEW_APP_DIR, const QString &NEW_APP_IMG, const QString &OLD_APP_IMG)
 {
     std::cerr << "[INFO] QTools::AppUpdater: Repacking AppImage...\n";
     if ( !FileIO::packAppImage( NEW_APP_DIR, NEW_APP_IMG))
         return tr("Failed to repack AppImage!");
-
-    // Swap the new AppImage for the existing one. Since the existing one
-    // is locked, move it to OLD_APP_IMG before replacing with the new one.
-    QString err;
-    if ( FileIO::isRoot() || _isAllowed( {NEW_APP_IMG, _appFilePath}))
-        err = FileIO::swapOverFiles( NEW_APP_IMG, _appFilePath, OLD_APP_IMG);
-    else
-        err = FileIO::swapOverFilesAsRoot( NEW_APP_IMG, _appFilePath, OLD_APP_IMG);  // LINUX ONLY!
-    return err;
+    // Staged AppImages are swapped in at next launch.
+    if ( OLD_APP_IMG.isEmpty())
+        return "";
+    _metrics.startPhase( "swap");
+    return _swapAppImage( NEW_APP_IMG, _appFilePath, OLD_APP_IMG, _metrics);
 }   // end _repackAppImage
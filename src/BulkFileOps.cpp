@@ -0,0 +1,471 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#include <BulkFileOps.h>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QFile>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#ifdef QTOOLS_WITH_IO_URING
+#include <liburing.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+#endif
+
+using QTools::BulkFileOps::FileStat;
+
+
+namespace {
+
+std::atomic<bool> _useUring( true);
+std::atomic<int> _queueDepth( 64);
+
+
+FileStat _qtStat( const QString &path)
+{
+    const QFileInfo finfo( path);
+    return FileStat{ finfo.exists(), finfo.isDir(), finfo.size(), finfo.lastModified().toMSecsSinceEpoch()};
+}   // end _qtStat
+
+
+#ifdef QTOOLS_WITH_IO_URING
+const unsigned COPY_BUFFER_SIZE = 1 << 16;
+bool _available = false;
+int _umask = -1;    // Unknown if negative
+
+
+void _init()
+{
+    static std::once_flag once;
+    std::call_once( once, [](){
+        io_uring_probe *probe = io_uring_get_probe();
+        if ( probe)
+        {
+            _available = true;
+            for ( int op : {IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE,
+                            IORING_OP_CLOSE, IORING_OP_RENAMEAT, IORING_OP_UNLINKAT})
+                _available &= io_uring_opcode_supported( probe, op) != 0;
+            io_uring_free_probe( probe);
+        }   // end if
+
+        // Read rather than set the umask since setting it isn't thread safe.
+        std::ifstream status( "/proc/self/status");
+        std::string line;
+        while ( std::getline( status, line))
+            if ( line.compare( 0, 6, "Umask:") == 0)
+                _umask = int(std::stoul( line.substr(6), nullptr, 8));
+    });
+}   // end _init
+
+
+class Ring
+{
+public:
+    explicit Ring( int depth) : _depth(depth) { _ok = io_uring_queue_init( unsigned(depth), &_ring, 0) == 0;}
+    ~Ring() { if ( _ok) io_uring_queue_exit( &_ring);}
+
+    bool isOk() const { return _ok;}
+    int depth() const { return _depth;}
+
+    // Prepare the next operation tagged with id.
+    io_uring_sqe *next( intptr_t id)
+    {
+        io_uring_sqe *sqe = io_uring_get_sqe( &_ring);
+        if ( sqe)
+            io_uring_sqe_set_data( sqe, reinterpret_cast<void*>( id));
+        return sqe;
+    }   // end next
+
+    // Submit prepared operations and wait for at least one to complete calling
+    // fn with the id and result of each completion. Returns false on error.
+    template <typename F>
+    bool submitAndReap( F &&fn)
+    {
+        const int rv = io_uring_submit_and_wait( &_ring, 1);
+        if ( rv < 0 && rv != -EINTR)
+            return false;
+        io_uring_cqe *cqe = nullptr;
+        while ( io_uring_peek_cqe( &_ring, &cqe) == 0)
+        {
+            const intptr_t id = reinterpret_cast<intptr_t>( io_uring_cqe_get_data( cqe));
+            const int res = cqe->res;
+            io_uring_cqe_seen( &_ring, cqe);
+            fn( id, res);
+        }   // end while
+        return true;
+    }   // end submitAndReap
+
+private:
+    io_uring _ring;
+    bool _ok;
+    const int _depth;
+};  // end class
+
+
+std::vector<QByteArray> _encode( const QStringList &paths)
+{
+    std::vector<QByteArray> enc;
+    enc.reserve( size_t(paths.size()));
+    for ( const QString &p : paths)
+        enc.push_back( QFile::encodeName( p));
+    return enc;
+}   // end _encode
+
+
+// Run n independent operations prepared by prep with at most the queue depth in flight.
+// Results are the operations' return values with -ECANCELED for those not done.
+template <typename P>
+std::vector<int> _runAll( int n, P &&prep)
+{
+    std::vector<int> res( size_t(n), -ECANCELED);
+    Ring ring( std::max( 1, _queueDepth.load()));
+    if ( !ring.isOk())
+        return res;
+
+    int next = 0;
+    int inflight = 0;
+    while ( next < n || inflight > 0)
+    {
+        io_uring_sqe *sqe = nullptr;
+        while ( next < n && inflight < ring.depth() && (sqe = ring.next( next)))
+        {
+            prep( sqe, next++);
+            inflight++;
+        }   // end while
+
+        const bool ok = ring.submitAndReap( [&]( intptr_t id, int r)
+        {
+            res[size_t(id)] = r;
+            inflight--;
+        });
+        if ( !ok)
+            break;
+    }   // end while
+    return res;
+}   // end _runAll
+
+
+// Copies progress through these states one operation at a time with a copy per slot in the ring.
+enum CopyState { STAT, OPEN_SRC, OPEN_DST, READ, WRITE, CLOSE_SRC, CLOSE_DST};
+
+struct CopySlot
+{
+    int idx = -1;   // Index of the file being copied (-1 if idle)
+    CopyState state = STAT;
+    struct statx stx;
+    int sfd = -1;
+    int dfd = -1;
+    qint64 off = 0;
+    int rlen = 0;   // Bytes in the buffer
+    int wdone = 0;  // Bytes of the buffer written
+    std::vector<char> buf;
+};  // end struct
+
+
+std::vector<int> _uringCopy( const std::vector<QByteArray> &src, const std::vector<QByteArray> &dst)
+{
+    const int n = int(src.size());
+    std::vector<int> res( size_t(n), -ECANCELED);
+    Ring ring( std::max( 1, _queueDepth.load()));
+    if ( !ring.isOk())
+        return res;
+
+    std::vector<CopySlot> slots( size_t(std::min( n, ring.depth())));
+
+    const auto prep = [&]( int si)
+    {
+        CopySlot &s = slots[size_t(si)];
+        io_uring_sqe *sqe = ring.next( si);
+        const char *sp = src[size_t(s.idx)].constData();
+        const char *dp = dst[size_t(s.idx)].constData();
+        switch ( s.state)
+        {
+            case STAT:
+                io_uring_prep_statx( sqe, AT_FDCWD, sp, 0, STATX_MODE | STATX_SIZE, &s.stx);
+                break;
+            case OPEN_SRC:
+                io_uring_prep_openat( sqe, AT_FDCWD, sp, O_RDONLY | O_CLOEXEC, 0);
+                break;
+            case OPEN_DST:
+                io_uring_prep_openat( sqe, AT_FDCWD, dp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, s.stx.stx_mode & 07777);
+                break;
+            case READ:
+                io_uring_prep_read( sqe, s.sfd, s.buf.data(), COPY_BUFFER_SIZE, __u64(s.off));
+                break;
+            case WRITE:
+                io_uring_prep_write( sqe, s.dfd, s.buf.data() + s.wdone, unsigned(s.rlen - s.wdone), __u64(s.off + s.wdone));
+                break;
+            case CLOSE_SRC:
+                io_uring_prep_close( sqe, s.sfd);
+                break;
+            case CLOSE_DST:
+                io_uring_prep_close( sqe, s.dfd);
+                break;
+        }   // end switch
+    };  // end prep
+
+    int nextFile = 0;
+    const auto start = [&]( int si)
+    {
+        CopySlot &s = slots[size_t(si)];
+        s.idx = -1;
+        if ( nextFile >= n)
+            return;
+        s.idx = nextFile++;
+        s.state = STAT;
+        s.sfd = s.dfd = -1;
+        s.off = 0;
+        if ( s.buf.empty())
+            s.buf.resize( COPY_BUFFER_SIZE);
+        prep( si);
+    };  // end start
+
+    // Failures are cleaned up synchronously since they should be rare.
+    const auto fail = [&]( int si, int err)
+    {
+        CopySlot &s = slots[size_t(si)];
+        if ( s.sfd >= 0)
+            close( s.sfd);
+        if ( s.dfd >= 0)
+        {
+            close( s.dfd);
+            unlink( dst[size_t(s.idx)].constData());
+        }   // end if
+        res[size_t(s.idx)] = err;
+        start( si);
+    };  // end fail
+
+    for ( int si = 0; si < int(slots.size()); ++si)
+        start( si);
+
+    bool busy = !slots.empty();
+    while ( busy)
+    {
+        const bool ok = ring.submitAndReap( [&]( intptr_t id, int r)
+        {
+            const int si = int(id);
+            CopySlot &s = slots[size_t(si)];
+            if ( r < 0 || (s.state == WRITE && r == 0))
+            {
+                if ( s.state == CLOSE_SRC)
+                    s.sfd = -1;
+                else if ( s.state == CLOSE_DST)
+                    s.dfd = -1;
+                fail( si, r < 0 ? r : -EIO);
+                return;
+            }   // end if
+
+            switch ( s.state)
+            {
+                case STAT:
+                    if ( S_ISDIR( s.stx.stx_mode))
+                    {
+                        fail( si, -EISDIR);
+                        return;
+                    }   // end if
+                    s.state = OPEN_SRC;
+                    break;
+                case OPEN_SRC:
+                    s.sfd = r;
+                    s.state = OPEN_DST;
+                    break;
+                case OPEN_DST:
+                    s.dfd = r;
+                    if ( _umask < 0 || (s.stx.stx_mode & 07777 & mode_t(_umask)))
+                        fchmod( s.dfd, s.stx.stx_mode & 07777);   // Creation mode was masked
+                    s.state = READ;
+                    break;
+                case READ:
+                    if ( r == 0)
+                        s.state = CLOSE_SRC;
+                    else
+                    {
+                        s.rlen = r;
+                        s.wdone = 0;
+                        s.state = WRITE;
+                    }   // end else
+                    break;
+                case WRITE:
+                    s.wdone += r;
+                    if ( s.wdone >= s.rlen)
+                    {
+                        s.off += s.rlen;
+                        s.state = READ;
+                    }   // end if
+                    break;
+                case CLOSE_SRC:
+                    s.sfd = -1;
+                    s.state = CLOSE_DST;
+                    break;
+                case CLOSE_DST:
+                    s.dfd = -1;
+                    res[size_t(s.idx)] = 0;
+                    start( si);
+                    return;
+            }   // end switch
+            prep( si);
+        });
+
+        if ( !ok)
+        {
+            for ( int si = 0; si < int(slots.size()); ++si)
+                if ( slots[size_t(si)].idx >= 0)
+                    fail( si, -ECANCELED);
+            break;
+        }   // end if
+
+        busy = false;
+        for ( const CopySlot &s : slots)
+            busy |= s.idx >= 0;
+    }   // end while
+
+    return res;
+}   // end _uringCopy
+#endif
+
+}   // end namespace
+
+
+bool QTools::BulkFileOps::isUringAvailable()
+{
+#ifdef QTOOLS_WITH_IO_URING
+    _init();
+    return _available;
+#else
+    return false;
+#endif
+}   // end isUringAvailable
+
+
+void QTools::BulkFileOps::setUseUring( bool v) { _useUring = v;}
+bool QTools::BulkFileOps::useUring() { return _useUring && isUringAvailable();}
+
+void QTools::BulkFileOps::setQueueDepth( int d) { _queueDepth = std::max( 1, d);}
+int QTools::BulkFileOps::queueDepth() { return _queueDepth;}
+
+
+QVector<FileStat> QTools::BulkFileOps::statFiles( const QStringList &paths)
+{
+    QVector<FileStat> stats( paths.size());
+#ifdef QTOOLS_WITH_IO_URING
+    if ( useUring())
+    {
+        const std::vector<QByteArray> enc = _encode( paths);
+        std::vector<struct statx> stxs( enc.size());
+        const std::vector<int> res = _runAll( paths.size(), [&]( io_uring_sqe *sqe, int i)
+        {
+            io_uring_prep_statx( sqe, AT_FDCWD, enc[size_t(i)].constData(), 0, STATX_TYPE | STATX_SIZE | STATX_MTIME, &stxs[size_t(i)]);
+        });
+        for ( int i = 0; i < paths.size(); ++i)
+        {
+            const struct statx &stx = stxs[size_t(i)];
+            if ( res[size_t(i)] == 0)
+                stats[i] = FileStat{ true, S_ISDIR( stx.stx_mode), qint64(stx.stx_size),
+                                     qint64(stx.stx_mtime.tv_sec) * 1000 + stx.stx_mtime.tv_nsec / 1000000};
+            else if ( res[size_t(i)] == -ENOENT || res[size_t(i)] == -ENOTDIR)
+                stats[i] = FileStat{ false, false, 0, 0};
+            else
+                stats[i] = _qtStat( paths.at(i));
+        }   // end for
+        return stats;
+    }   // end if
+#endif
+    for ( int i = 0; i < paths.size(); ++i)
+        stats[i] = _qtStat( paths.at(i));
+    return stats;
+}   // end statFiles
+
+
+QVector<bool> QTools::BulkFileOps::removeFiles( const QStringList &paths)
+{
+    QVector<bool> done( paths.size());
+#ifdef QTOOLS_WITH_IO_URING
+    if ( useUring())
+    {
+        const std::vector<QByteArray> enc = _encode( paths);
+        const std::vector<int> res = _runAll( paths.size(), [&]( io_uring_sqe *sqe, int i)
+        {
+            io_uring_prep_unlinkat( sqe, AT_FDCWD, enc[size_t(i)].constData(), 0);
+        });
+        for ( int i = 0; i < paths.size(); ++i)
+            done[i] = res[size_t(i)] == 0 || (res[size_t(i)] == -ECANCELED && QFile::remove( paths.at(i)));
+        return done;
+    }   // end if
+#endif
+    for ( int i = 0; i < paths.size(); ++i)
+        done[i] = QFile::remove( paths.at(i));
+    return done;
+}   // end removeFiles
+
+
+QVector<bool> QTools::BulkFileOps::renameFiles( const QStringList &src, const QStringList &dst)
+{
+    const int n = std::min( src.size(), dst.size());
+    QVector<bool> done( n);
+#ifdef QTOOLS_WITH_IO_URING
+    if ( useUring())
+    {
+        const std::vector<QByteArray> senc = _encode( src);
+        const std::vector<QByteArray> denc = _encode( dst);
+        const std::vector<int> res = _runAll( n, [&]( io_uring_sqe *sqe, int i)
+        {
+            io_uring_prep_renameat( sqe, AT_FDCWD, senc[size_t(i)].constData(), AT_FDCWD, denc[size_t(i)].constData(), RENAME_NOREPLACE);
+        });
+        // Qt copies across file systems and copes with file systems not supporting RENAME_NOREPLACE.
+        for ( int i = 0; i < n; ++i)
+        {
+            const int r = res[size_t(i)];
+            done[i] = r == 0 || ((r == -ECANCELED || r == -EXDEV || r == -EINVAL) && QFile::rename( src.at(i), dst.at(i)));
+        }   // end for
+        return done;
+    }   // end if
+#endif
+    for ( int i = 0; i < n; ++i)
+        done[i] = QFile::rename( src.at(i), dst.at(i));
+    return done;
+}   // end renameFiles
+
+
+QVector<bool> QTools::BulkFileOps::copyFiles( const QStringList &src, const QStringList &dst)
+{
+    const int n = std::min( src.size(), dst.size());
+    QVector<bool> done( n);
+#ifdef QTOOLS_WITH_IO_URING
+    if ( useUring())
+    {
+        const std::vector<int> res = _uringCopy( _encode( src.mid( 0, n)), _encode( dst.mid( 0, n)));
+        for ( int i = 0; i < n; ++i)
+            done[i] = res[size_t(i)] == 0 || (res[size_t(i)] == -ECANCELED && QFile::copy( src.at(i), dst.at(i)));
+        return done;
+    }   // end if
+#endif
+    for ( int i = 0; i < n; ++i)
+        done[i] = QFile::copy( src.at(i), dst.at(i));
+    return done;
+}   // end copyFiles
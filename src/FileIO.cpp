@@ -16,15 +16,42 @@
  ************************************************************************/
 
 #include <FileIO.h>
+#include <BulkFileOps.h>
 #include <QProcess>
+#include <QThreadPool>
+#include <QMutex>
+#include <QSet>
+#include <QHash>
 #include <QTemporaryDir>
 #include <QTemporaryFile>
 #include <QTextStream>
+#include <NameMatcher.h>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <set>
 
-#ifdef __linux__    // For getuid and geteuid
+#ifdef __linux__    // For getuid, geteuid, getgroups and getpwuid_r
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <strings.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <grp.h>
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
 #endif
 
 // Definitions for these namespace variables
@@ -37,105 +64,771 @@ namespace {
 static const QString CHK_STR = ",.afdf63,f803c,,3b[]()";
 
 
-bool _moveFiles( const QString &src, const QString &dst, const QString &bck)
+QString toolPath( const QString &atool)
+{
+    const QFileInfo file(atool);
+    return file.exists( atool) && file.isExecutable() ? file.canonicalFilePath() : "";
+}   // end toolPath
+
+
+// Atomically exchange the two paths returning 0 on success or the error number on failure.
+int _exchange( const QString &p0, const QString &p1)
 {
+#if defined(__linux__) && defined(SYS_renameat2)
+    if ( syscall( SYS_renameat2, AT_FDCWD, QFile::encodeName( p0).constData(),
+                                 AT_FDCWD, QFile::encodeName( p1).constData(), RENAME_EXCHANGE) == 0)
+        return 0;
+    return errno;
+#else
+    return ENOSYS;
+#endif
+}   // end _exchange
+
+
+// A file to move from src to dst with any file at dst moved to bck.
+struct MoveOp
+{
+    QString src;
+    QString dst;
+    QString bck;
+    qint64 size;
+};  // end struct
+
+
+// Make the directories beneath dst and bck for the files beneath src collecting the
+// files to move and (in sdirs) the source directories in the order they're found.
+void _planMove( const QString &src, const QString &dst, const QString &bck, std::vector<MoveOp> &ops, QStringList &sdirs)
+{
+    const QFileInfo sinfo(src);
+    if ( !sinfo.isDir())
+    {
+        ops.push_back( MoveOp{src, dst, bck, sinfo.size()});
+        return;
+    }   // end if
+
+    QDir().mkpath(dst); // Does nothing if already exists
+    QDir().mkpath(bck); // Does nothing if already exists
+    sdirs.append(src);
+    for ( const QString &nm : QDir(src).entryList( QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot))
+        _planMove( src + "/" + nm, dst + "/" + nm, bck + "/" + nm, ops, sdirs);
+}   // end _planMove
+
+
+// Displaced files are exchanged into place where possible so their paths are never missing
+// and the rest are moved aside first. The renames are then done in bulk in two batches:
+// everything displaced into the backup location and then everything else into place.
+bool _moveFiles( const QString &src, const QString &dst, const QString &bck, QTools::FileIO::MoveCounts *counts)
+{
+    std::vector<MoveOp> ops;
+    QStringList sdirs;
+    _planMove( src, dst, bck, ops, sdirs);
+
+    QStringList dsts;
+    for ( const MoveOp &op : ops)
+        dsts.append( op.dst);
+    const QVector<QTools::BulkFileOps::FileStat> dstats = QTools::BulkFileOps::statFiles( dsts);
+
+    QStringList asrc, adst; // Into the backup location
+    std::vector<size_t> aops;
+    std::vector<bool> exchanged;
+    QStringList bsrc, bdst; // Into place
+    std::vector<size_t> bops;
+    for ( size_t i = 0; i < ops.size(); ++i)
+    {
+        const MoveOp &op = ops[i];
+        if ( !dstats.at(int(i)).exists)
+        {
+            bsrc.append( op.src);
+            bdst.append( op.dst);
+            bops.push_back(i);
+            continue;
+        }   // end if
+
+        const bool exch = _exchange( op.src, op.dst) == 0;
+        asrc.append( exch ? op.src : op.dst);   // The displaced file is now at src if exchanged
+        adst.append( op.bck);
+        aops.push_back(i);
+        exchanged.push_back( exch);
+    }   // end for
+
     bool ok = true;
-    if ( QFileInfo(src).isDir())
+    qint64 nfiles = 0;
+    qint64 nbytes = 0;
+    qint64 ndisplaced = 0;
+
+    const QVector<bool> amoved = QTools::BulkFileOps::renameFiles( asrc, adst);
+    for ( size_t j = 0; j < aops.size(); ++j)
     {
-        QDir().mkpath(dst); // Does nothing if already exists
-        QDir().mkpath(bck); // Does nothing if already exists
-        for ( const QString &nm : QDir(src).entryList( QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot))
-            if ( !(ok = _moveFiles( src + "/" + nm, dst + "/" + nm, bck + "/" + nm)))
-                break;
-        if ( ok)
-            ok = QDir().rmdir(src); // Remove the source directory
+        const MoveOp &op = ops[aops[j]];
+        if ( !amoved.at(int(j)))
+            ok = false;
+        else if ( exchanged[j])
+        {
+            nfiles++;
+            nbytes += op.size;
+            ndisplaced++;
+        }   // end else if
+        else
+        {
+            bsrc.append( op.src);
+            bdst.append( op.dst);
+            bops.push_back( aops[j]);
+        }   // end else
+    }   // end for
+
+    if ( ok)
+    {
+        const QVector<bool> bmoved = QTools::BulkFileOps::renameFiles( bsrc, bdst);
+        for ( size_t j = 0; j < bops.size(); ++j)
+        {
+            const size_t i = bops[j];
+            if ( !bmoved.at(int(j)))
+            {
+                ok = false;
+                continue;
+            }   // end if
+            nfiles++;
+            nbytes += ops[i].size;
+            if ( dstats.at(int(i)).exists)
+                ndisplaced++;
+        }   // end for
     }   // end if
-    else
+
+    // Remove the source directories (now empty) deepest first.
+    for ( int i = sdirs.size() - 1; ok && i >= 0; --i)
+        ok = QDir().rmdir( sdirs.at(i));
+
+    if ( counts)
     {
-        if ( QFileInfo::exists(dst))
-            ok = QFile::rename(dst, bck);
-        if ( ok)
-            ok = QFile::rename(src, dst);
-    }   // end else
+        counts->files += nfiles;
+        counts->bytes += nbytes;
+        counts->displaced += ndisplaced;
+    }   // end if
     return ok;
 }   // end _moveFiles
 
 
-bool _copyFiles( const QString &src, const QString &dst, QFileInfoList &symLinks, bool noclobber)
+// Make the directories beneath dst for the files beneath src collecting the files to copy
+// (as parallel lists of source and destination paths) and the symlinks to recreate.
+void _planCopy( const QString &src, const QString &dst, QStringList &srcs, QStringList &dsts, QFileInfoList &symLinks)
 {
-    static const std::string WRNSTR = "[WARNING] QTools::FileInfo: Unable to ";
-
-    bool ok = true;
     const QFileInfo sinfo(src);
-
     if ( sinfo.isDir())
     {
         QDir().mkpath(dst); // Does nothing if already exists
         for ( const QString &nm : QDir(src).entryList( QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot))
-            if ( !(ok = _copyFiles( src + "/" + nm, dst + "/" + nm, symLinks, noclobber)))
-                break;
+            _planCopy( src + "/" + nm, dst + "/" + nm, srcs, dsts, symLinks);
     }   // end if
     else if ( sinfo.isSymbolicLink() || sinfo.isShortcut())
         symLinks.append(sinfo);
     else
     {
-        if ( QFileInfo::exists(dst) && !noclobber && !QFile::remove(dst))
+        srcs.append(src);
+        dsts.append(dst);
+    }   // end else
+}   // end _planCopy
+
+
+bool _isSameFile( const QString &f0, const QString &f1)
+{
+    const QFileInfo i0(f0);
+    const QFileInfo i1(f1);
+    if ( !i1.exists() || i1.isSymLink() || !i1.isFile()
+            || i0.size() != i1.size() || i0.permissions() != i1.permissions())
+        return false;
+
+    QFile file0(f0);
+    QFile file1(f1);
+    if ( !file0.open( QIODevice::ReadOnly) || !file1.open( QIODevice::ReadOnly))
+        return false;
+
+    // Compare chunk by chunk stopping at the first difference.
+    static const qint64 CHUNK_SIZE = 1 << 16;
+    while ( !file0.atEnd())
+        if ( file0.read( CHUNK_SIZE) != file1.read( CHUNK_SIZE))
+            return false;
+    return true;
+}   // end _isSameFile
+
+
+// Remove empty directories beneath dir (but not dir itself).
+void _removeEmptyDirs( const QString &dir)
+{
+    for ( const QString &nm : QDir(dir).entryList( QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden | QDir::NoSymLinks))
+    {
+        const QString dpath = dir + "/" + nm;
+        _removeEmptyDirs( dpath);
+        QDir().rmdir( dpath);  // Fails if not empty
+    }   // end for
+}   // end _removeEmptyDirs
+
+
+// Remove directories beneath dst (but not dst itself) that aren't in src if they're empty.
+void _removeDirsNotIn( const QString &dst, const QString &src)
+{
+    for ( const QString &nm : QDir(dst).entryList( QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden | QDir::NoSymLinks))
+    {
+        const QString dpath = dst + "/" + nm;
+        const QString spath = src + "/" + nm;
+        _removeDirsNotIn( dpath, spath);
+        if ( !QFileInfo( spath).isDir())
+            QDir().rmdir( dpath);  // Fails if not empty
+    }   // end for
+}   // end _removeDirsNotIn
+
+
+// Recreate the symlink (or shortcut) in the source tree at the corresponding place in the
+// destination tree with its target remapped to be relative to the destination tree.
+bool _copyLink( const QFileInfo &sinfo, const QString &sAbsPth, const QString &dAbsPth)
+{
+    QString lnkSrc = sinfo.absoluteFilePath();
+    QString lnkTgt = sinfo.symLinkTarget();
+
+    lnkSrc.replace( sAbsPth, dAbsPth);  // lnkSrc will end with ".lnk" on Windows
+
+    // The link target may not be inside src - if so this replacement has no effect.
+    // lnkTgt is assumed to be inside src, but the target path might include src
+    // so replace. This will have no effect if src is not in the target path.
+    lnkTgt.replace( sAbsPth, dAbsPth);
+
+    // Finally, ensure the target is relative to the destination.
+    lnkTgt = QDir( dAbsPth).relativeFilePath( lnkTgt);
+
+    return QFile::link( lnkTgt, lnkSrc);
+}   // end _copyLink
+
+
+// Relative target of a symlink from its containing directory.
+QString _linkTarget( const QFileInfo &finfo) { return QDir( finfo.absolutePath()).relativeFilePath( finfo.symLinkTarget());}
+
+
+QString _joinPath( const QString &rel, const QString &nm) { return rel.isEmpty() ? nm : rel + "/" + nm;}
+
+
+// Compares directories of the two trees pairwise with each pair of directories (and each
+// directory present in only one tree) read as a separate task in a pool of threads.
+class TreeDiffer
+{
+public:
+    TreeDiffer( const QString &src, const QString &dst, bool content) : _src(src), _dst(dst), _content(content) {}
+
+    QTools::FileIO::TreeDiff diff( int nthreads)
+    {
+        if ( nthreads <= 0)
+            nthreads = 2 * std::max( 1, QThread::idealThreadCount());
+        _pool.setMaxThreadCount( nthreads);
+        _diffDirs( "");
+        _pool.waitForDone();
+
+        // Files needing their content compared are done last so directory reading isn't held up.
+        const int n = _compare.size();
+        std::vector<char> same( size_t(n), 0);
+        for ( int i = 0; i < n; ++i)
         {
-            std::cerr << WRNSTR << "remove \"" << dst.toLocal8Bit().toStdString() << "\"!" << std::endl;
-            ok = false;
-        }   // end if
+            const QString &rpath = _compare.at(i);
+            _pool.start( QRunnable::create( [&, i](){ same[size_t(i)] = _isSameFile( _src + "/" + rpath, _dst + "/" + rpath);}));
+        }   // end for
+        _pool.waitForDone();
+        for ( int i = 0; i < n; ++i)
+            (same[size_t(i)] ? _diff.same : _diff.changed).append( _compare.at(i));
+
+        _diff.added.sort();
+        _diff.removed.sort();
+        _diff.changed.sort();
+        _diff.same.sort();
+        return _diff;
+    }   // end diff
+
+private:
+    const QString _src;
+    const QString _dst;
+    const bool _content;
+    QThreadPool _pool;
+    QMutex _lock;
+    QTools::FileIO::TreeDiff _diff;
+    QStringList _compare;
+
+    static QFileInfoList _entries( const QString &dpath)
+    {
+        return QDir( dpath).entryInfoList( QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System);
+    }   // end _entries
+
+    static bool _isRealDir( const QFileInfo &finfo) { return finfo.isDir() && !finfo.isSymLink();}
+
+    void _add( QStringList &lst, const QString &rpath)
+    {
+        QMutexLocker locker( &_lock);
+        lst.append( rpath);
+    }   // end _add
 
-        if ( ok && !QFile::copy( src, dst))
+    void _spawn( const std::function<void()> &fn) { _pool.start( QRunnable::create( fn));}
+
+    // List everything beneath the directory at rel in the given tree into lst.
+    void _listAll( const QString &root, const QString &rel, QStringList &lst)
+    {
+        for ( const QFileInfo &finfo : _entries( _joinPath( root, rel)))
         {
-            std::cerr << WRNSTR << "copy \"" << dst.toLocal8Bit().toStdString() << "\" - file exists!" << std::endl;
-            ok = false;
-        }   // end if
-    }   // end else
+            const QString crel = _joinPath( rel, finfo.fileName());
+            if ( _isRealDir( finfo))
+                _spawn( [this, &root, crel, &lst](){ _listAll( root, crel, lst);});
+            else
+                _add( lst, crel);
+        }   // end for
+    }   // end _listAll
+
+    void _diffDirs( const QString &rel)
+    {
+        QHash<QString, QFileInfo> dinfos;
+        for ( const QFileInfo &finfo : _entries( _joinPath( _dst, rel)))
+            dinfos.insert( finfo.fileName(), finfo);
 
-    return ok;
-}   // end _copyFiles
+        for ( const QFileInfo &sinfo : _entries( _joinPath( _src, rel)))
+        {
+            const QString crel = _joinPath( rel, sinfo.fileName());
+            const auto it = dinfos.find( sinfo.fileName());
+            if ( it == dinfos.end())
+            {
+                if ( _isRealDir( sinfo))
+                    _spawn( [this, crel](){ _listAll( _src, crel, _diff.added);});
+                else
+                    _add( _diff.added, crel);
+                continue;
+            }   // end if
+
+            const QFileInfo dinfo = *it;
+            dinfos.erase( it);
+            if ( _isRealDir( sinfo) && _isRealDir( dinfo))
+                _spawn( [this, crel](){ _diffDirs( crel);});
+            else if ( sinfo.isSymLink() || dinfo.isSymLink())
+                _add( sinfo.isSymLink() && dinfo.isSymLink() && _linkTarget( sinfo) == _linkTarget( dinfo) ? _diff.same : _diff.changed, crel);
+            else if ( sinfo.isDir() != dinfo.isDir() || sinfo.size() != dinfo.size())
+                _add( _diff.changed, crel);
+            else if ( _content)
+                _add( _compare, crel);
+            else
+                _add( sinfo.lastModified() == dinfo.lastModified() ? _diff.same : _diff.changed, crel);
+        }   // end for
+
+        for ( const QFileInfo &dinfo : dinfos)
+        {
+            const QString crel = _joinPath( rel, dinfo.fileName());
+            if ( _isRealDir( dinfo))
+                _spawn( [this, crel](){ _listAll( _dst, crel, _diff.removed);});
+            else
+                _add( _diff.removed, crel);
+        }   // end for
+    }   // end _diffDirs
+};  // end class
 
 
-void _recursivelyListFiles( const QDir &dir, const QStringList &nameFilters, QFileInfoList &files)
+#ifdef __linux__
+// As returned by getdents64 (glibc doesn't declare it).
+struct LinuxDirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};  // end struct
+#endif
+
+
+struct DirNode
 {
-    const QFileInfoList fentries = dir.entryInfoList( nameFilters, QDir::Files | QDir::Readable);
-    for ( const QFileInfo &finfo : fentries)
-        files.append(finfo);
-    const QFileInfoList dentries = dir.entryInfoList( QDir::AllDirs | QDir::NoDotAndDotDot | QDir::Readable);
-    for ( const QFileInfo &finfo : dentries)
+    std::string name;   // Name within the parent directory
+    std::string path;   // Path to open
+    int depth = 0;      // Zero for the root
+    const DirNode *parent = nullptr;
+    std::pair<quint64, quint64> id; // Device and inode (if hasId)
+    bool hasId = false;
+    std::vector<std::string> files; // Matching file names
+    std::vector<std::unique_ptr<DirNode>> children;
+};  // end struct
+
+
+struct WalkOptions
+{
+    int nthreads = 0;   // Most threads reading (including the caller's) - the ideal thread count if <= 0
+    int maxDepth = -1;  // Levels of subdirectory to descend into (no limit if < 0)
+    int maxCount = -1;  // Maximum number of files to find (no limit if < 0)
+    std::function<bool()> isCancelled;
+    // Called (from a reading thread) with each directory once read. It's not called with the
+    // walker's lock held so may be called concurrently for different directories.
+    std::function<void( const DirNode&)> onRead;
+};  // end struct
+
+
+// Reads directories taking them from a shared stack. The thread calling wait does the reading
+// with helpers taken from the global thread pool only while there's more than one directory
+// waiting to be read and the pool has threads free, so small trees are read serially.
+// On Linux, uses getdents64 directly with a large buffer and d_type so that nothing is stat'd
+// unless the file system doesn't give the type (or it's a symlink). Raw file names are matched
+// against the compiled name filters and nothing else is created for entries that don't match.
+// A directory that's also one of its ancestors (via a symlink) isn't read, but a directory
+// reached through more than one symlink is read for each; see _collectFiles.
+class DirWalker
+{
+public:
+    DirWalker( const QStringList &nameFilters, const WalkOptions &opts)
+        : _nameFilters(nameFilters), _matcher(nameFilters), _opts(opts), _maxHelpers(0), _nhelpers(0), _pending(0), _nfound(0), _halted(false)
     {
-        const QDir dpath( finfo.filePath());
-        _recursivelyListFiles( dpath, nameFilters, files);
-    }   // end for
-}   // end _recursivelyListFiles
+        const int nthreads = _opts.nthreads > 0 ? _opts.nthreads : QThread::idealThreadCount();
+        _maxHelpers = std::max( 0, nthreads - 1);
+    }   // end ctor
 
-}   // end namespace
+    // Set the root to start reading from.
+    void start( DirNode *root)
+    {
+        _stack.push_back( root);
+        _pending = 1;
+    }   // end start
+
+    // Read everything from the root and block until done.
+    void wait()
+    {
+        _work( false);
+        std::unique_lock<std::mutex> lock( _lock);
+        _cv.wait( lock, [this](){ return _nhelpers == 0;});
+    }   // end wait
+
+    // True if reading stopped early due to cancellation or reaching the maximum file count.
+    bool halted() const { return _halted;}
+
+private:
+    const QStringList _nameFilters;
+    const NameMatcher _matcher;
+    const WalkOptions _opts;
+    int _maxHelpers;
+    int _nhelpers;  // Pool threads currently helping
+    std::mutex _lock;
+    std::condition_variable _cv;
+    std::vector<DirNode*> _stack;
+    int _pending;   // Directories on the stack or being read
+    int _nfound;
+    bool _halted;
+
+    // Called with the lock held to start a helper for each waiting directory beyond the first.
+    void _addHelpers()
+    {
+        while ( _nhelpers < _maxHelpers && int(_stack.size()) > _nhelpers + 1)
+        {
+            _nhelpers++;
+            if ( !QThreadPool::globalInstance()->tryStart( [this](){ _work( true);}))
+            {
+                _nhelpers--;
+                break;
+            }   // end if
+        }   // end while
+    }   // end _addHelpers
+
+    // Helpers return as soon as the stack is empty rather than waiting on it.
+    void _work( bool helper)
+    {
+        std::vector<char> buf( 1 << 16);
+        while ( true)
+        {
+            DirNode *node = nullptr;
+            {
+                std::unique_lock<std::mutex> lock( _lock);
+                if ( !helper)
+                    _cv.wait( lock, [this](){ return !_stack.empty() || _pending == 0;});
+                if ( _stack.empty())
+                {
+                    if ( helper)
+                    {
+                        _nhelpers--;
+                        _cv.notify_all();
+                    }   // end if
+                    return;
+                }   // end if
+                if ( _halted || (_opts.isCancelled && _opts.isCancelled()))
+                {
+                    _halted = true;
+                    _pending -= int(_stack.size());
+                    _stack.clear();
+                    _cv.notify_all();
+                    continue;
+                }   // end if
+                node = _stack.back();
+                _stack.pop_back();
+            }   // end scope
+
+            _read( node, buf);
+
+            {
+                std::lock_guard<std::mutex> lock( _lock);
+                if ( _opts.maxCount >= 0 && _nfound + int(node->files.size()) >= _opts.maxCount)
+                {
+                    node->files.resize( size_t(_opts.maxCount - _nfound));
+                    _halted = true;
+                }   // end if
+                _nfound += int(node->files.size());
+                if ( _halted || (_opts.maxDepth >= 0 && node->depth >= _opts.maxDepth))
+                    node->children.clear();
+            }   // end scope
+
+            // The node is still counted as pending so the walk can't finish before this returns.
+            if ( _opts.onRead)
+                _opts.onRead( *node);
+
+            std::lock_guard<std::mutex> lock( _lock);
+            for ( std::unique_ptr<DirNode> &child : node->children)
+                _stack.push_back( child.get());
+            _pending += int(node->children.size()) - 1;
+            _addHelpers();
+            _cv.notify_all();
+        }   // end while
+    }   // end _work
+
+    void _addChild( DirNode *node, const char *nm)
+    {
+        std::unique_ptr<DirNode> child( new DirNode);
+        child->name = nm;
+        child->path = node->path + "/" + nm;
+        child->depth = node->depth + 1;
+        child->parent = node;
+        node->children.push_back( std::move( child));
+    }   // end _addChild
+
+#ifdef __linux__
+    void _read( DirNode *node, std::vector<char> &buf)
+    {
+        const int fd = open( node->path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if ( fd < 0)
+            return;
+
+        struct stat dst;
+        if ( fstat( fd, &dst) == 0)
+        {
+            node->id = {quint64(dst.st_dev), quint64(dst.st_ino)};
+            node->hasId = true;
+            for ( const DirNode *p = node->parent; p; p = p->parent)
+            {
+                if ( p->hasId && p->id == node->id)  // Symlink cycle
+                {
+                    close( fd);
+                    return;
+                }   // end if
+            }   // end for
+        }   // end if
+
+        long n = 0;
+        while ( (n = syscall( SYS_getdents64, fd, buf.data(), buf.size())) > 0)
+        {
+            for ( long pos = 0; pos < n;)
+            {
+                const LinuxDirent64 *d = reinterpret_cast<const LinuxDirent64*>( buf.data() + pos);
+                pos += d->d_reclen;
+                const char *nm = d->d_name;
+                if ( nm[0] == '.')  // Hidden entries (including . and ..) are skipped
+                    continue;
+
+                unsigned char type = d->d_type;
+                if ( type == DT_UNKNOWN || type == DT_LNK)  // Follow links as QDir does
+                {
+                    struct stat st;
+                    if ( fstatat( fd, nm, &st, 0) != 0)
+                        continue;
+                    type = S_ISDIR( st.st_mode) ? DT_DIR : S_ISREG( st.st_mode) ? DT_REG : DT_UNKNOWN;
+                }   // end if
+
+                if ( type == DT_DIR)
+                {
+                    if ( faccessat( fd, nm, R_OK, 0) == 0)
+                        _addChild( node, nm);
+                }   // end if
+                else if ( type == DT_REG && _matcher.matches( nm) && faccessat( fd, nm, R_OK, 0) == 0)
+                    node->files.push_back( nm);
+            }   // end for
+        }   // end while
+        close( fd);
+
+        // Order by name ignoring case as QDir does by default.
+        const auto nameLess = []( const std::string &a, const std::string &b)
+        {
+            const int c = strcasecmp( a.c_str(), b.c_str());
+            return c < 0 || (c == 0 && a < b);
+        };  // end nameLess
+        std::sort( node->files.begin(), node->files.end(), nameLess);
+        std::sort( node->children.begin(), node->children.end(),
+                [&]( const std::unique_ptr<DirNode> &a, const std::unique_ptr<DirNode> &b){ return nameLess( a->name, b->name);});
+    }   // end _read
+#else
+    void _read( DirNode *node, std::vector<char>&)
+    {
+        const QDir dir( QString::fromLocal8Bit( node->path.c_str()));
+        for ( const QString &fname : dir.entryList( _nameFilters, QDir::Files | QDir::Readable))
+            node->files.push_back( fname.toLocal8Bit().toStdString());
+        for ( const QString &dname : dir.entryList( QDir::AllDirs | QDir::NoDotAndDotDot | QDir::Readable))
+            _addChild( node, dname.toLocal8Bit().constData());
+    }   // end _read
+#endif
+};  // end class
+
+
+QString _dirPath( const DirNode &node) { return QString::fromLocal8Bit( node.path.c_str());}
 
 
-QFileInfoList QTools::FileIO::recursivelyListFiles( const QDir &root, const QStringList &nameFilters)
+// Collect files in name order. A directory read more than once (through different symlinks)
+// only has its files collected from the first place it's found in this order.
+void _collectFiles( const DirNode *node, QFileInfoList &files, std::set<std::pair<quint64, quint64>> &seen)
+{
+    if ( node->hasId && !seen.insert( node->id).second)
+        return;
+    const QString dpath = _dirPath( *node);
+    for ( const std::string &f : node->files)
+        files.append( QFileInfo( dpath + "/" + QString::fromLocal8Bit( f.c_str())));
+    for ( const std::unique_ptr<DirNode> &child : node->children)
+        _collectFiles( child.get(), files, seen);
+}   // end _collectFiles
+
+
+QFileInfoList _collectFiles( const DirNode *root)
 {
     QFileInfoList files;
-    _recursivelyListFiles( root, nameFilters, files);
+    std::set<std::pair<quint64, quint64>> seen;
+    _collectFiles( root, files, seen);
     return files;
+}   // end _collectFiles
+
+
+std::string _rootPath( const QDir &root) { return root.path().toLocal8Bit().toStdString();}
+
+}   // end namespace
+
+
+QFileInfoList QTools::FileIO::recursivelyListFiles( const QDir &root, const QStringList &nameFilters, int nthreads)
+{
+    DirNode rnode;
+    rnode.path = _rootPath( root);
+    WalkOptions opts;
+    opts.nthreads = nthreads;
+    DirWalker walker( nameFilters, opts);
+    walker.start( &rnode);
+    walker.wait();
+    return _collectFiles( &rnode);
 }   // end recursivelyListFiles
 
 
 QTools::FileIO::BackgroundFilesFinder::BackgroundFilesFinder( const QDir &root, const QStringList &nameFilters)
-    : _root(root), _nameFilters(nameFilters) {}
+    : _root(root), _nameFilters(nameFilters), _maxDepth(-1), _maxCount(-1), _batchMsecs(100), _cancelled(false) {}
 
 
 void QTools::FileIO::BackgroundFilesFinder::run()
 {
-    QFileInfoList files;
-    _recursivelyListFiles( _root, _nameFilters, files);
-    emit onFoundFiles( _root, files);
+    _cancelled = false;
+
+    // Worker threads add found files to the batch which this thread emits at most
+    // once per batch interval, except for the very first which is emitted immediately.
+    std::mutex block;
+    std::condition_variable bcv;
+    QFileInfoList batch;
+    bool emitted = false;
+    bool done = false;
+    int ndirs = 0;
+    int nfiles = 0;
+
+    WalkOptions opts;
+    opts.maxDepth = _maxDepth;
+    opts.maxCount = _maxCount;
+    opts.isCancelled = [this](){ return isInterruptionRequested();};
+    opts.onRead = [&]( const DirNode &node)
+    {
+        // Build this directory's part of the batch on the reading thread before taking the lock.
+        const QString dpath = _dirPath( node);
+        QFileInfoList found;
+        found.reserve( int(node.files.size()));
+        for ( const std::string &f : node.files)
+            found.append( QFileInfo( dpath + "/" + QString::fromLocal8Bit( f.c_str())));
+
+        std::lock_guard<std::mutex> lock( block);
+        batch.append( found);
+        ndirs++;
+        nfiles += int(node.files.size());
+        if ( !emitted && !batch.isEmpty())
+            bcv.notify_one();
+    };  // end onRead
+
+    DirNode rnode;
+    rnode.path = _rootPath( _root);
+    DirWalker walker( _nameFilters, opts);
+    walker.start( &rnode);
+    std::thread waiter( [&]()
+    {
+        walker.wait();
+        std::lock_guard<std::mutex> lock( block);
+        done = true;
+        bcv.notify_one();
+    });
+
+    std::unique_lock<std::mutex> lock( block);
+    while ( true)
+    {
+        bcv.wait_for( lock, std::chrono::milliseconds( _batchMsecs), [&](){ return done || (!emitted && !batch.isEmpty());});
+        const bool finished = done;
+        QFileInfoList found;
+        found.swap( batch);
+        emitted |= !found.isEmpty();
+        const int nd = ndirs;
+        const int nf = nfiles;
+        lock.unlock();
+        if ( !found.isEmpty())
+            emit onFoundBatch( _root, found);
+        emit onProgress( nd, nf);
+        lock.lock();
+        if ( finished)
+            break;
+    }   // end while
+    lock.unlock();
+    waiter.join();
+
+    _cancelled = isInterruptionRequested();
+    emit onFoundFiles( _root, _collectFiles( &rnode));
 }   // end run
 
 
 bool QTools::FileIO::copyFiles( const QString &src, const QString &dst, bool noclobber)
 {
+    static const std::string WRNSTR = "[WARNING] QTools::FileInfo: Unable to ";
+
+    QStringList srcs, dsts;
     QFileInfoList symLinks;
-    if ( !_copyFiles( src, dst, symLinks, noclobber))
+    _planCopy( src, dst, srcs, dsts, symLinks);
+
+    bool ok = true;
+    if ( !noclobber)
+    {
+        QStringList rpaths;
+        const QVector<BulkFileOps::FileStat> dstats = BulkFileOps::statFiles( dsts);
+        for ( int i = 0; i < dsts.size(); ++i)
+            if ( dstats.at(i).exists)
+                rpaths.append( dsts.at(i));
+        const QVector<bool> removed = BulkFileOps::removeFiles( rpaths);
+        for ( int i = 0; i < rpaths.size(); ++i)
+        {
+            if ( !removed.at(i))
+            {
+                std::cerr << WRNSTR << "remove \"" << rpaths.at(i).toLocal8Bit().toStdString() << "\"!" << std::endl;
+                ok = false;
+            }   // end if
+        }   // end for
+    }   // end if
+
+    if ( !ok)
+        return false;
+
+    const QVector<bool> copied = BulkFileOps::copyFiles( srcs, dsts);
+    for ( int i = 0; i < dsts.size(); ++i)
+    {
+        if ( !copied.at(i))
+        {
+            std::cerr << WRNSTR << "copy \"" << dsts.at(i).toLocal8Bit().toStdString() << "\" - file exists!" << std::endl;
+            ok = false;
+        }   // end if
+    }   // end for
+
+    if ( !ok)
         return false;
 
     if ( symLinks.isEmpty())    // No symlinks/shortcuts so we're done!
@@ -145,29 +838,211 @@ bool QTools::FileIO::copyFiles( const QString &src, const QString &dst, bool noc
     const QString sAbsPth = QFileInfo(src).absoluteFilePath();
     const QString dAbsPth = QFileInfo(dst).absoluteFilePath();
     for ( const QFileInfo &sinfo : symLinks)
+        if ( !_copyLink( sinfo, sAbsPth, dAbsPth))
+            return false;
+
+    return true;
+}   // end copyFiles
+
+
+int QTools::FileIO::removeUnchangedFiles( const QString &src, const QString &dst)
+{
+    QStringList fpaths;
+    for ( const QString &rpath : diffTrees( src, dst, true).same)
+        fpaths.append( src + "/" + rpath);
+    const QVector<bool> removed = BulkFileOps::removeFiles( fpaths);
+    _removeEmptyDirs( src);
+    return int(std::count( removed.begin(), removed.end(), true));
+}   // end removeUnchangedFiles
+
+
+QTools::FileIO::TreeDiff QTools::FileIO::diffTrees( const QString &src, const QString &dst, bool compareContent, int nthreads)
+{
+    return TreeDiffer( src, dst, compareContent).diff( nthreads);
+}   // end diffTrees
+
+
+namespace {
+
+// Set the modification time of the given file. This needs the file open for
+// writing which its (copied) permissions may not allow.
+void _setModTime( const QString &fpath, const QDateTime &mtime)
+{
+    QFile file(fpath);
+    const QFile::Permissions perms = file.permissions();
+    if ( !(perms & QFile::WriteOwner))
+        file.setPermissions( perms | QFile::WriteOwner);
+    if ( file.open( QIODevice::Append))
     {
-        QString lnkSrc = sinfo.absoluteFilePath();
-        QString lnkTgt = sinfo.symLinkTarget();
+        file.setFileTime( mtime, QFileDevice::FileModificationTime);
+        file.close();
+    }   // end if
+    if ( !(perms & QFile::WriteOwner))
+        file.setPermissions( perms);
+}   // end _setModTime
 
-        lnkSrc.replace( sAbsPth, dAbsPth);  // lnkSrc will end with ".lnk" on Windows
+}   // end namespace
 
-        // The link target may not be inside src - if so this replacement has no effect.
-        // lnkTgt is assumed to be inside src, but the target path might include src
-        // so replace. This will have no effect if src is not in the target path.
-        lnkTgt.replace( sAbsPth, dAbsPth);
 
-        // Finally, ensure the target is relative to the destination.
-        lnkTgt = QDir( dAbsPth).relativeFilePath( lnkTgt);
+// Anything at the destination is removed first. Regular files are then copied in bulk with the
+// lists split across a pool of threads (in parallel even when BulkFileOps falls back to Qt).
+// Symlinks and directories are copied one at a time and source modification times set after.
+bool QTools::FileIO::copyChangedFiles( const QString &src, const QString &dst, bool removeExtra, bool compareContent, TreeDiff *udiff)
+{
+    static const std::string WRNSTR = "[WARNING] QTools::FileIO::copyChangedFiles: Unable to ";
+
+    const TreeDiff diff = diffTrees( src, dst, compareContent);
+    if ( udiff)
+        *udiff = diff;
+
+    const QStringList rpaths = diff.added + diff.changed;
+
+    // Make the directories first so the copying can be done in parallel.
+    QSet<QString> dirs;
+    for ( const QString &rpath : rpaths)
+        dirs.insert( QFileInfo( dst + "/" + rpath).path());
+    for ( const QString &dpath : dirs)
+        QDir().mkpath( dpath);
+
+    // Stat the source and destination paths in parallel (QFileInfo caches what's read).
+    const int n = rpaths.size();
+    QVector<QFileInfo> sinfos( n), dinfos( n);
+    QThreadPool pool;
+    for ( int i = 0; i < n; ++i)
+    {
+        pool.start( QRunnable::create( [&, i]()
+        {
+            sinfos[i] = QFileInfo( src + "/" + rpaths.at(i));
+            sinfos[i].lastModified();
+            sinfos[i].isSymLink();
+            dinfos[i] = QFileInfo( dst + "/" + rpaths.at(i));
+            dinfos[i].exists();
+            dinfos[i].isSymLink();
+        }));
+    }   // end for
+    pool.waitForDone();
 
-        if ( !QFile::link( lnkTgt, lnkSrc))
-            return false;
+    // Remove what's in the way. Only directories are removed one at a time.
+    bool ok = true;
+    std::vector<char> failed( size_t(n), 0);
+    QStringList rmpaths;
+    std::vector<int> rmidx;
+    for ( int i = 0; i < n; ++i)
+    {
+        const QFileInfo &dinfo = dinfos.at(i);
+        if ( dinfo.isDir() && !dinfo.isSymLink())
+            failed[size_t(i)] = !QDir( dinfo.filePath()).removeRecursively();
+        else if ( dinfo.exists() || dinfo.isSymLink())
+        {
+            rmpaths.append( dinfo.filePath());
+            rmidx.push_back(i);
+        }   // end else if
+    }   // end for
+    const QVector<bool> removed = BulkFileOps::removeFiles( rmpaths);
+    for ( int j = 0; j < rmpaths.size(); ++j)
+        failed[size_t(rmidx[size_t(j)])] = !removed.at(j);
+    for ( int i = 0; i < n; ++i)
+    {
+        if ( failed[size_t(i)])
+        {
+            std::cerr << WRNSTR << "remove \"" << dinfos.at(i).filePath().toLocal8Bit().toStdString() << "\"!" << std::endl;
+            ok = false;
+        }   // end if
     }   // end for
 
-    return true;
-}   // end copyFiles
+    // Copy symlinks and directories here and collect the regular files to copy in bulk.
+    const QString sAbsPth = QFileInfo(src).absoluteFilePath();
+    const QString dAbsPth = QFileInfo(dst).absoluteFilePath();
+    QStringList csrcs, cdsts;
+    std::vector<int> cidx;
+    for ( int i = 0; i < n; ++i)
+    {
+        if ( failed[size_t(i)])
+            continue;
+        const QFileInfo &sinfo = sinfos.at(i);
+        bool cok = true;
+        if ( sinfo.isSymLink())
+            cok = _copyLink( sinfo, sAbsPth, dAbsPth);
+        else if ( sinfo.isDir())
+            cok = copyFiles( sinfo.filePath(), dinfos.at(i).filePath());
+        else
+        {
+            csrcs.append( sinfo.filePath());
+            cdsts.append( dinfos.at(i).filePath());
+            cidx.push_back(i);
+        }   // end else
+        if ( !cok)
+        {
+            std::cerr << WRNSTR << "copy \"" << sinfo.filePath().toLocal8Bit().toStdString() << "\"!" << std::endl;
+            ok = false;
+        }   // end if
+    }   // end for
+
+    const int nc = csrcs.size();
+    std::vector<char> copied( size_t(nc), 0);
+    const int nchunks = std::min( nc, std::max( 1, pool.maxThreadCount()));
+    for ( int c = 0; c < nchunks; ++c)
+    {
+        const int b = int( qint64(nc) * c / nchunks);
+        const int e = int( qint64(nc) * (c + 1) / nchunks);
+        pool.start( QRunnable::create( [&, b, e]()
+        {
+            const QVector<bool> done = BulkFileOps::copyFiles( csrcs.mid( b, e - b), cdsts.mid( b, e - b));
+            for ( int j = b; j < e; ++j)
+            {
+                copied[size_t(j)] = done.at(j - b);
+                if ( copied[size_t(j)])
+                    _setModTime( cdsts.at(j), sinfos.at( cidx[size_t(j)]).lastModified());
+            }   // end for
+        }));
+    }   // end for
+    pool.waitForDone();
+    for ( int j = 0; j < nc; ++j)
+    {
+        if ( !copied[size_t(j)])
+        {
+            std::cerr << WRNSTR << "copy \"" << csrcs.at(j).toLocal8Bit().toStdString() << "\"!" << std::endl;
+            ok = false;
+        }   // end if
+    }   // end for
 
+    if ( removeExtra)
+    {
+        QStringList fpaths;
+        for ( const QString &rpath : diff.removed)
+            fpaths.append( dst + "/" + rpath);
+        const QVector<bool> removed = BulkFileOps::removeFiles( fpaths);
+        for ( int i = 0; i < removed.size(); ++i)
+        {
+            if ( !removed.at(i))
+            {
+                std::cerr << "[WARNING] QTools::FileIO::copyChangedFiles: Unable to remove \""
+                          << diff.removed.at(i).toLocal8Bit().toStdString() << "\"!" << std::endl;
+                ok = false;
+            }   // end if
+        }   // end for
+        _removeDirsNotIn( dst, src);
+    }   // end if
 
-bool QTools::FileIO::moveFiles( const QString &src, const QString &dst, const QString &ubck)
+    return ok;
+}   // end copyChangedFiles
+
+
+bool QTools::FileIO::moveChangedFiles( const QString &src, const QString &dst, const QString &bck, bool compareContent, TreeDiff *udiff)
+{
+    const TreeDiff diff = diffTrees( src, dst, compareContent);
+    if ( udiff)
+        *udiff = diff;
+    QStringList fpaths;
+    for ( const QString &rpath : diff.same)
+        fpaths.append( src + "/" + rpath);
+    BulkFileOps::removeFiles( fpaths);
+    _removeEmptyDirs( src);
+    return moveFiles( src, dst, bck);
+}   // end moveChangedFiles
+
+
+bool QTools::FileIO::moveFiles( const QString &src, const QString &dst, const QString &ubck, MoveCounts *counts)
 {
     QString bck = ubck;
     QTemporaryDir tdir;
@@ -182,14 +1057,18 @@ bool QTools::FileIO::moveFiles( const QString &src, const QString &dst, const QS
     }   // end if
 
     bool ok = true;
-    if ( !_moveFiles( src, dst, bck))
+    MoveCounts mcounts;
+    if ( !_moveFiles( src, dst, bck, &mcounts))
     {
         std::cerr << "[WARNING] QTools::FileIO::moveFiles: Move failed - restoring..." << std::endl;
-        if ( !_moveFiles( bck, dst, src))
+        mcounts = MoveCounts();
+        if ( !_moveFiles( bck, dst, src, nullptr))
             std::cerr << "[WARNING] QTools::FileIO::moveFiles: Restore failed!! Possible data loss!" << std::endl;
         ok = false;
     }   // end if
 
+    if ( counts)
+        *counts = mcounts;
     return ok;
 }   // end moveFiles
 
@@ -231,11 +1110,25 @@ QString _checkSwapFiles( const QString &fnew, const QString &fcur, const QString
 }   // end namespace
 
 
+bool QTools::FileIO::exchangePaths( const QString &p0, const QString &p1)
+{
+    const int err = _exchange( p0, p1);
+    if ( err != 0 && err != ENOSYS && err != EINVAL)    // Not supported by the kernel or file system
+        std::cerr << "[WARNING] QTools::FileIO::exchangePaths: " << strerror(err) << std::endl;
+    return err == 0;
+}   // end exchangePaths
+
+
 QString QTools::FileIO::swapOverFiles( const QString &fnew, const QString &fcur, const QString &fold)
 {
     const QString err = _checkSwapFiles( fnew, fcur, fold);
     if ( !err.isEmpty())
         return err;
+
+    // Exchanging new and current first means the current path is never missing.
+    if ( exchangePaths( fnew, fcur))
+        return QDir().rename( fnew, fold) ? "" : "Failed to move old file out of new file's path!";
+
     if ( !QFile::rename( fcur, fold))
         return "Failed to move current file to old!";
     if ( !QFile::rename( fnew, fcur))
@@ -254,7 +1147,19 @@ QString QTools::FileIO::swapOverFilesAsRoot( const QString &fnew, const QString
     if ( !err.isEmpty())
         return err;
 
-    // Create a temporary bash script to perform the shuffle
+    const QString afnew = QFileInfo( fnew).absoluteFilePath();
+    const QString afcur = QFileInfo( fcur).absoluteFilePath();
+    const QString afold = QFileInfo( fold).absoluteFilePath();
+
+    // Prefer the update tool which swaps atomically where the file system allows
+    const QString program = toolPath(UPDATE_TOOL);
+    if ( !program.isEmpty())
+    {
+        const bool ok = QProcess::execute( "pkexec", {program, CHK_STR, "swap", afnew, afcur, afold}) == 0;
+        return ok ? "" : "Process execution failed!";
+    }   // end if
+
+    // Otherwise create a temporary bash script to perform the shuffle
     QTemporaryDir tdir;
     if ( !tdir.isValid())
         return "Unable to create temporary directory!";
@@ -263,10 +1168,6 @@ QString QTools::FileIO::swapOverFilesAsRoot( const QString &fnew, const QString
     if ( !tfile.open(QIODevice::WriteOnly | QIODevice::Text))
         return "Unable to open script file!";
 
-    const QString afnew = QFileInfo( fnew).absoluteFilePath();
-    const QString afcur = QFileInfo( fcur).absoluteFilePath();
-    const QString afold = QFileInfo( fold).absoluteFilePath();
-
     QTextStream out(&tfile);
     out << "#!/usr/bin/env sh" << Qt::endl;
     out << "mv -f " << afcur << " " << afold << Qt::endl;
@@ -334,47 +1235,188 @@ Cleanup:
 }   // end isRunningAsAdmin
 #endif
 
+}   // end namespace
 
-QString toolPath( const QString &atool)
-{
-    const QFileInfo file(atool);
-    return file.exists( atool) && file.isExecutable() ? file.canonicalFilePath() : "";
-}   // end toolPath
 
-}   // end namespace
+namespace {
 
+using Identity = QTools::FileIO::Identity;
 
-bool QTools::FileIO::isRoot()
+Identity _resolveIdentity()
 {
-    bool isr = false;
+    Identity id;
+    id.uid = id.euid = id.gid = id.egid = 0;
 #ifdef _WIN32
-    isr = isRunningAsAdmin();
+    char wuname[256];
+    DWORD nuname = sizeof(wuname);
+    if ( GetUserName( wuname, &nuname))
+        id.username = QString( wuname).trimmed();
+    id.isRoot = isRunningAsAdmin();
 #elif __linux__
-    isr = getuid() != geteuid();
+    id.uid = getuid();
+    id.euid = geteuid();
+    id.gid = getgid();
+    id.egid = getegid();
+    id.isRoot = id.uid != id.euid;
+
+    // Use the password database rather than environment variables which are unreliable
+    long bufsz = sysconf( _SC_GETPW_R_SIZE_MAX);
+    if ( bufsz <= 0)
+        bufsz = 16384;
+    std::vector<char> buf( static_cast<size_t>(bufsz));
+    struct passwd pwd;
+    struct passwd *res = nullptr;
+    if ( getpwuid_r( id.uid, &pwd, buf.data(), buf.size(), &res) == 0 && res)
+    {
+        id.username = QString::fromLocal8Bit( pwd.pw_name);
+        id.homePath = QString::fromLocal8Bit( pwd.pw_dir);
+    }   // end if
+    else
+        std::cerr << "[WARNING] QTools::FileIO::identity: No password entry for user " << id.uid << std::endl;
+
+    const int ngroups = getgroups( 0, nullptr);
+    if ( ngroups > 0)
+    {
+        std::vector<gid_t> gids( static_cast<size_t>(ngroups));
+        const int n = getgroups( ngroups, gids.data());
+        for ( int i = 0; i < n; ++i)
+            id.groups.append( gids[size_t(i)]);
+    }   // end if
+#else
+    id.isRoot = false;
+#endif
+    if ( id.homePath.isEmpty())
+        id.homePath = QDir::homePath();
+    return id;
+}   // end _resolveIdentity
+
+
+struct PathStat
+{
+    bool exists;
+    bool isDir;
+    bool writable;  // Entries can be created, replaced or removed (directories) or contents changed (files)
+#ifdef __linux__
+    bool sticky;
+    uint uid;
 #endif
-    return isr;
-}   // end isRoot
+};  // end struct
+
+
+PathStat _statPath( const QString &path, const Identity &id)
+{
+    PathStat ps;
+    ps.exists = ps.isDir = ps.writable = false;
+#ifdef __linux__
+    ps.sticky = false;
+    ps.uid = 0;
+    struct stat st;
+    if ( ::stat( QFile::encodeName( path).constData(), &st) != 0)
+        return ps;
+    ps.exists = true;
+    ps.isDir = S_ISDIR( st.st_mode);
+    ps.sticky = (st.st_mode & S_ISVTX) != 0;
+    ps.uid = st.st_uid;
+
+    // Changing a directory's entries needs search as well as write permission. Only the
+    // mode bits are considered (as was the case with the owner check this replaces).
+    const mode_t need = ps.isDir ? S_IWUSR | S_IXUSR : S_IWUSR;
+    if ( id.euid == 0)
+        ps.writable = true;
+    else if ( st.st_uid == id.euid)
+        ps.writable = (st.st_mode & need) == need;
+    else if ( st.st_gid == id.egid || id.groups.contains( st.st_gid))
+        ps.writable = (st.st_mode & (need >> 3)) == (need >> 3);
+    else
+        ps.writable = (st.st_mode & (need >> 6)) == (need >> 6);
+#else
+    const QFileInfo finfo( path);
+    ps.exists = finfo.exists();
+    ps.isDir = finfo.isDir();
+    ps.writable = ps.exists && finfo.isWritable();  // Needs NTFS permission lookup enabled (see needsElevation)
+#endif
+    return ps;
+}   // end _statPath
+
+}   // end namespace
 
 
-QString QTools::FileIO::username()
+const Identity &QTools::FileIO::identity()
 {
-    QString user;
-    // Use the following methods which are more reliable than
-    // accessing environment variables user (UNIX) or username (Windows)
+    static const Identity id = _resolveIdentity();
+    return id;
+}   // end identity
+
+
+bool QTools::FileIO::isRoot() { return identity().isRoot;}
+
+
+QString QTools::FileIO::username() { return identity().username;}
+
+
+QVector<bool> QTools::FileIO::needsElevation( const QStringList &paths)
+{
+    const Identity &id = identity();
+    QVector<bool> elevate( paths.size(), false);
+    if ( id.isRoot || paths.isEmpty())
+        return elevate;
+
+    // Stat the paths and their distinct parent directories together
+    QStringList spaths = paths;
+    QVector<int> pidx( paths.size());
+    QHash<QString, int> parents;
+    for ( int i = 0; i < paths.size(); ++i)
+    {
+        const QString parent = QFileInfo( paths.at(i)).absolutePath();
+        if ( !parents.contains( parent))
+        {
+            parents.insert( parent, spaths.size());
+            spaths.append( parent);
+        }   // end if
+        pidx[i] = parents.value( parent);
+    }   // end for
+
+    std::vector<PathStat> stats( size_t(spaths.size()));
+    QThreadPool pool;
+    pool.setMaxThreadCount( 2 * std::max( 1, QThread::idealThreadCount()));   // Mostly waiting on I/O
 #ifdef _WIN32
-    char wuname[256];
-    DWORD nuname = sizeof(wuname);
-    if (GetUserName(wuname, &nuname))
-        user = wuname;
-#elif __linux__
-    QProcess process;
-    process.setProcessChannelMode( QProcess::MergedChannels);
-    process.start("whoami");
-    if ( process.waitForFinished(-1))
-        user = process.readAllStandardOutput();
+    // The (non-atomic) counter is only changed here and not by the threads reading it.
+    qt_ntfs_permission_lookup++;
+#endif
+    for ( int i = 0; i < spaths.size(); ++i)
+        pool.start( QRunnable::create( [&, i](){ stats[size_t(i)] = _statPath( spaths.at(i), id);}));
+    pool.waitForDone();
+#ifdef _WIN32
+    qt_ntfs_permission_lookup--;
+#endif
+
+    for ( int i = 0; i < paths.size(); ++i)
+    {
+        const PathStat &ps = stats[size_t(i)];
+        if ( !ps.exists)
+            continue;
+        bool ok = ps.writable;
+        if ( ok && !ps.isDir)
+        {
+            const PathStat &pps = stats[size_t(pidx[i])];
+            ok = pps.writable;
+#ifdef __linux__
+            // Only the owner of the file or directory can unlink from a sticky directory
+            if ( ok && pps.sticky)
+                ok = ps.uid == id.euid || pps.uid == id.euid;
 #endif
-    return user.trimmed();
-}   // end username
+        }   // end if
+        elevate[i] = !ok;
+    }   // end for
+    return elevate;
+}   // end needsElevation
+
+
+bool QTools::FileIO::anyNeedElevation( const QStringList &paths)
+{
+    const QVector<bool> elevate = needsElevation( paths);
+    return std::any_of( elevate.begin(), elevate.end(), []( bool b){ return b;});
+}   // end anyNeedElevation
 
 
 bool QTools::FileIO::inHomeDir( const QString &path)
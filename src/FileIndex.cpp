@@ -0,0 +1,514 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#include <FileIndex.h>
+#include <NameMatcher.h>
+#include <QCryptographicHash>
+#include <QFileSystemWatcher>
+#include <QStandardPaths>
+#include <QSocketNotifier>
+#include <QDataStream>
+#include <QThreadPool>
+#include <QDateTime>
+#include <QSaveFile>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+using QTools::FileIndex;
+
+
+namespace {
+
+const quint32 CACHE_MAGIC = 0x51544649; // "QTFI"
+const quint32 CACHE_VERSION = 2;
+
+#ifdef __linux__
+const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE
+                          | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+#endif
+
+
+QString _defaultCacheFile( const QDir &root)
+{
+    const QByteArray hash = QCryptographicHash::hash( root.absolutePath().toUtf8(), QCryptographicHash::Sha1).toHex();
+    return QStandardPaths::writableLocation( QStandardPaths::CacheLocation) + "/FileIndex/" + hash + ".idx";
+}   // end _defaultCacheFile
+
+
+QString _join( const QString &rel, const QString &nm) { return rel.isEmpty() ? nm : rel + "/" + nm;}
+
+
+QString _parent( const QString &rel)
+{
+    const int i = rel.lastIndexOf('/');
+    return i < 0 ? "" : rel.left(i);
+}   // end _parent
+
+
+// Identify the directory at the given path following symlinks. On Linux this is the device and
+// inode as used by FileIO::recursivelyListFiles; elsewhere the canonical path is used instead.
+QByteArray _dirId( const QString &apath)
+{
+#ifdef __linux__
+    struct stat st;
+    if ( stat( apath.toLocal8Bit().constData(), &st) != 0)
+        return QByteArray();
+    const quint64 id[2] = { quint64(st.st_dev), quint64(st.st_ino)};
+    return QByteArray( reinterpret_cast<const char*>(id), sizeof(id));
+#else
+    return QFileInfo( apath).canonicalFilePath().toUtf8();
+#endif
+}   // end _dirId
+
+}   // end namespace
+
+
+FileIndex::FileIndex( const QDir &root, const QString &cacheFile, QObject *parent)
+    : QObject(parent), _root(root),
+      _cacheFile( cacheFile.isEmpty() ? _defaultCacheFile( root) : cacheFile),
+      _modified(false), _ifd(-1), _notifier(nullptr), _watcher(nullptr)
+{
+#ifdef __linux__
+    _ifd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC);
+    if ( _ifd >= 0)
+    {
+        _notifier = new QSocketNotifier( _ifd, QSocketNotifier::Read, this);
+        connect( _notifier, &QSocketNotifier::activated, this, &FileIndex::_doOnNotified);
+    }   // end if
+    else
+        std::cerr << "[WARNING] QTools::FileIndex: Unable to initialise inotify; changes won't be noticed!" << std::endl;
+#else
+    _watcher = new QFileSystemWatcher( this);
+    connect( _watcher, &QFileSystemWatcher::directoryChanged, this, &FileIndex::_doOnDirectoryChanged);
+#endif
+}   // end ctor
+
+
+FileIndex::~FileIndex()
+{
+    if ( _modified)
+        save();
+#ifdef __linux__
+    if ( _ifd >= 0)
+        close( _ifd);
+#endif
+}   // end dtor
+
+
+bool FileIndex::load()
+{
+    QFile file( _cacheFile);
+    if ( !file.open( QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in( &file);
+    in.setVersion( QDataStream::Qt_5_12);
+    quint32 magic, version;
+    QString rpath;
+    quint32 ndirs;
+    in >> magic >> version >> rpath >> ndirs;
+    if ( in.status() != QDataStream::Ok || magic != CACHE_MAGIC || version != CACHE_VERSION || rpath != _root.absolutePath())
+        return false;
+
+    QHash<QString, Dir> dirs;
+    dirs.reserve( int(ndirs));
+    for ( quint32 i = 0; i < ndirs && in.status() == QDataStream::Ok; ++i)
+    {
+        QString rel;
+        Dir dir;
+        quint32 nfiles;
+        in >> rel >> dir.mtime >> dir.id >> dir.dirs >> nfiles;
+        dir.ok = true;
+        dir.files.resize( int(nfiles));
+        for ( Entry &e : dir.files)
+            in >> e.name >> e.size >> e.mtime;
+        dirs.insert( rel, dir);
+    }   // end for
+
+    if ( in.status() != QDataStream::Ok || !dirs.contains(""))
+    {
+        std::cerr << "[WARNING] QTools::FileIndex::load: Corrupt index file " << _cacheFile.toStdString() << std::endl;
+        return false;
+    }   // end if
+
+    _unwatchAll();
+    _dirs = dirs;
+    _dirty.clear();
+    _modified = false;
+
+    // Check directory modification times and identities in parallel and watch everything.
+    const QStringList rels = _dirs.keys();
+    QVector<qint64> mtimes( rels.size());
+    QVector<QByteArray> ids( rels.size());
+    QThreadPool pool;
+    for ( int i = 0; i < rels.size(); ++i)
+    {
+        pool.start( QRunnable::create( [&, i]()
+        {
+            const QString apath = _absPath( rels[i]);
+            mtimes[i] = QFileInfo( apath).lastModified().toMSecsSinceEpoch();
+            ids[i] = _dirId( apath);
+        }));
+    }   // end for
+    pool.waitForDone();
+    for ( int i = 0; i < rels.size(); ++i)
+    {
+        const Dir &dir = _dirs[rels[i]];
+        if ( mtimes[i] != dir.mtime || ids[i] != dir.id)
+            _dirty.insert( rels[i]);
+        _watch( rels[i]);
+    }   // end for
+
+    return true;
+}   // end load
+
+
+bool FileIndex::save()
+{
+    QDir().mkpath( QFileInfo( _cacheFile).absolutePath());
+    QSaveFile file( _cacheFile);
+    if ( !file.open( QIODevice::WriteOnly))
+    {
+        std::cerr << "[WARNING] QTools::FileIndex::save: Unable to open " << _cacheFile.toStdString() << std::endl;
+        return false;
+    }   // end if
+
+    QDataStream out( &file);
+    out.setVersion( QDataStream::Qt_5_12);
+    out << CACHE_MAGIC << CACHE_VERSION << _root.absolutePath() << quint32(_dirs.size());
+    for ( auto it = _dirs.constBegin(); it != _dirs.constEnd(); ++it)
+    {
+        const Dir &dir = it.value();
+        out << it.key() << dir.mtime << dir.id << dir.dirs << quint32(dir.files.size());
+        for ( const Entry &e : dir.files)
+            out << e.name << e.size << e.mtime;
+    }   // end for
+
+    if ( out.status() != QDataStream::Ok || !file.commit())
+    {
+        std::cerr << "[WARNING] QTools::FileIndex::save: Unable to write " << _cacheFile.toStdString() << std::endl;
+        return false;
+    }   // end if
+
+    _modified = false;
+    return true;
+}   // end save
+
+
+void FileIndex::refresh()
+{
+    if ( !_dirs.contains(""))
+        _scan( {""});
+    else
+    {
+        _dirty.unite( _unwatched);  // Changes to these aren't notified
+        if ( !_dirty.isEmpty())
+        {
+            const QStringList dirty = _dirty.values();
+            _dirty.clear();
+            _scan( dirty);
+        }   // end if
+    }   // end else
+}   // end refresh
+
+
+void FileIndex::rebuild()
+{
+    _unwatchAll();
+    _dirs.clear();
+    _dirty.clear();
+    _scan( {""});
+}   // end rebuild
+
+
+// Visit in name order. A directory reached through more than one path (via symlinks)
+// only has its files visited from the first place it's found in this order.
+template <typename F>
+void FileIndex::_visit( const QString &rel, const NameMatcher &matcher, F &&fn, QSet<QByteArray> &seen) const
+{
+    const auto it = _dirs.constFind( rel);
+    if ( it == _dirs.constEnd())
+        return;
+    if ( !it->id.isEmpty())
+    {
+        if ( seen.contains( it->id))
+            return;
+        seen.insert( it->id);
+    }   // end if
+    for ( const Entry &e : it->files)
+        if ( matcher.matches( e.name))
+            fn( rel, e);
+    for ( const QString &nm : it->dirs)
+        _visit( _join( rel, nm), matcher, fn, seen);
+}   // end _visit
+
+
+QFileInfoList FileIndex::list( const QStringList &nameFilters)
+{
+    refresh();
+    QFileInfoList files;
+    const QString rpath = _root.path();
+    QSet<QByteArray> seen;
+    _visit( "", NameMatcher( nameFilters), [&]( const QString &rel, const Entry &e){ files.append( QFileInfo( _join( rpath, _join( rel, e.name))));}, seen);
+    return files;
+}   // end list
+
+
+QVector<FileIndex::File> FileIndex::files( const QStringList &nameFilters)
+{
+    refresh();
+    QVector<File> files;
+    QSet<QByteArray> seen;
+    _visit( "", NameMatcher( nameFilters), [&]( const QString &rel, const Entry &e){ files.append( File{_join( rel, e.name), e.size, e.mtime});}, seen);
+    return files;
+}   // end files
+
+
+QString FileIndex::_absPath( const QString &rel) const { return _join( _root.path(), rel);}
+
+
+FileIndex::Dir FileIndex::_readDir( const QString &rel) const
+{
+    Dir dir;
+    const QString apath = _absPath( rel);
+    const QFileInfo dinfo( apath);
+    if ( !dinfo.isDir() || !dinfo.isReadable())
+        return dir;
+    dir.ok = true;
+    dir.mtime = dinfo.lastModified().toMSecsSinceEpoch();
+    dir.id = _dirId( apath);
+
+    // A directory that's also one of its ancestors (via a symlink) isn't read. The ancestors
+    // were read on earlier levels of the scan so their identities are already known.
+    if ( !dir.id.isEmpty())
+    {
+        for ( QString arel = rel; !arel.isEmpty();)
+        {
+            arel = _parent( arel);
+            if ( _dirs.value( arel).id == dir.id)
+                return dir;
+        }   // end for
+    }   // end if
+
+    const QDir qdir( apath);
+    for ( const QFileInfo &finfo : qdir.entryInfoList( QDir::Files | QDir::Readable, QDir::Name | QDir::IgnoreCase))
+        dir.files.append( Entry{finfo.fileName(), finfo.size(), finfo.lastModified().toMSecsSinceEpoch()});
+
+    for ( const QFileInfo &finfo : qdir.entryInfoList( QDir::AllDirs | QDir::NoDotAndDotDot | QDir::Readable, QDir::Name | QDir::IgnoreCase))
+        dir.dirs.append( finfo.fileName());
+
+    return dir;
+}   // end _readDir
+
+
+void FileIndex::_scan( const QStringList &rels)
+{
+    // Directories are read a level at a time in parallel. Rescanned directories
+    // may have new subdirectories that need reading in turn on the next level.
+    QStringList level = rels;
+    while ( !level.isEmpty())
+    {
+        QVector<Dir> read( level.size());
+        QThreadPool pool;
+        for ( int i = 0; i < level.size(); ++i)
+            pool.start( QRunnable::create( [&, i](){ read[i] = _readDir( level[i]);}));
+        pool.waitForDone();
+
+        QStringList next;
+        for ( int i = 0; i < level.size(); ++i)
+        {
+            const QString &rel = level[i];
+            if ( !read[i].ok)   // Gone so parent will be (or has been) rescanned
+            {
+                if ( rel.isEmpty())
+                    _drop( rel);
+                continue;
+            }   // end if
+
+            // Ignore if the parent was rescanned and no longer has this directory.
+            if ( !rel.isEmpty() && !_dirs.value( _parent( rel)).dirs.contains( rel.mid( rel.lastIndexOf('/') + 1)))
+                continue;
+
+            const QStringList odirs = _dirs.value( rel).dirs;
+            for ( const QString &nm : odirs)
+                if ( !read[i].dirs.contains( nm))
+                    _drop( _join( rel, nm));
+            for ( const QString &nm : read[i].dirs)
+            {
+                const QString crel = _join( rel, nm);
+                if ( !odirs.contains( nm) || !_dirs.contains( crel))
+                    next.append( crel);
+            }   // end for
+
+            _dirs[rel] = read[i];
+            _watch( rel);
+        }   // end for
+
+        level = next;
+    }   // end while
+    _modified = true;
+}   // end _scan
+
+
+void FileIndex::_drop( const QString &rel)
+{
+    const auto it = _dirs.find( rel);
+    if ( it == _dirs.end())
+        return;
+    const QStringList cdirs = it->dirs;
+    _dirs.erase( it);
+    _dirty.remove( rel);
+    _unwatch( rel);
+    for ( const QString &nm : cdirs)
+        _drop( _join( rel, nm));
+}   // end _drop
+
+
+void FileIndex::_watch( const QString &rel)
+{
+#ifdef __linux__
+    if ( _ifd < 0)
+        return;
+    const int wd = inotify_add_watch( _ifd, _absPath( rel).toLocal8Bit().constData(), WATCH_MASK);
+    if ( wd >= 0)
+    {
+        // The descriptor is per inode so directories reached through more than one path share it.
+        if ( _pathWds.value( rel, wd) != wd)    // Path now reaches a different directory
+            _unwatch( rel);
+        QStringList &rels = _wdPaths[wd];
+        if ( !rels.contains( rel))
+            rels.append( rel);
+        _pathWds[rel] = wd;
+        _unwatched.remove( rel);
+    }   // end if
+    else if ( errno != ENOENT)  // Gone so parent will be rescanned
+    {
+        if ( _unwatched.isEmpty())
+        {
+            std::cerr << "[WARNING] QTools::FileIndex::_watch: Unable to watch " << _absPath( rel).toStdString()
+                      << " (" << strerror( errno) << "); unwatched directories will be rescanned on every refresh!" << std::endl;
+        }   // end if
+        _unwatched.insert( rel);
+    }   // end else if
+#else
+    _watcher->addPath( _absPath( rel));
+#endif
+}   // end _watch
+
+
+void FileIndex::_unwatch( const QString &rel)
+{
+#ifdef __linux__
+    _unwatched.remove( rel);
+    if ( _pathWds.contains( rel))
+    {
+        const int wd = _pathWds.take( rel);
+        const auto it = _wdPaths.find( wd);
+        if ( it != _wdPaths.end() && it->removeAll( rel) > 0 && it->isEmpty())
+        {
+            _wdPaths.erase( it);
+            inotify_rm_watch( _ifd, wd);
+        }   // end if
+    }   // end if
+#else
+    _watcher->removePath( _absPath( rel));
+#endif
+}   // end _unwatch
+
+
+void FileIndex::_unwatchAll()
+{
+#ifdef __linux__
+    for ( auto it = _wdPaths.constBegin(); it != _wdPaths.constEnd(); ++it)
+        inotify_rm_watch( _ifd, it.key());
+    _wdPaths.clear();
+    _pathWds.clear();
+    _unwatched.clear();
+#else
+    const QStringList dirs = _watcher->directories();
+    if ( !dirs.isEmpty())
+        _watcher->removePaths( dirs);
+#endif
+}   // end _unwatchAll
+
+
+void FileIndex::_markDirty( const QString &rel)
+{
+    const bool wasClean = _dirty.isEmpty();
+    if ( _dirs.contains( rel))
+        _dirty.insert( rel);
+    if ( wasClean && !_dirty.isEmpty())
+        emit onChanged();
+}   // end _markDirty
+
+
+void FileIndex::_doOnNotified()
+{
+#ifdef __linux__
+    alignas(struct inotify_event) char buf[1 << 14];
+    ssize_t n = 0;
+    while ( (n = read( _ifd, buf, sizeof(buf))) > 0)
+    {
+        for ( ssize_t pos = 0; pos < n;)
+        {
+            const struct inotify_event *ev = reinterpret_cast<const struct inotify_event*>( buf + pos);
+            pos += ssize_t( sizeof(struct inotify_event) + ev->len);
+
+            if ( ev->mask & IN_Q_OVERFLOW)  // Lost events so check everything
+            {
+                for ( auto it = _dirs.constBegin(); it != _dirs.constEnd(); ++it)
+                    _markDirty( it.key());
+                continue;
+            }   // end if
+
+            if ( !_wdPaths.contains( ev->wd))
+                continue;
+            const QStringList rels = _wdPaths.value( ev->wd);
+            if ( ev->mask & IN_IGNORED)
+            {
+                _wdPaths.remove( ev->wd);
+                for ( const QString &rel : rels)
+                    if ( _pathWds.value( rel) == ev->wd)
+                        _pathWds.remove( rel);
+            }   // end if
+            else if ( ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+            {
+                for ( const QString &rel : rels)
+                    _markDirty( rel.isEmpty() ? rel : _parent( rel));
+            }   // end else if
+            else
+            {
+                for ( const QString &rel : rels)
+                    _markDirty( rel);
+            }   // end else
+        }   // end for
+    }   // end while
+#endif
+}   // end _doOnNotified
+
+
+void FileIndex::_doOnDirectoryChanged( const QString &apath)
+{
+    const QString rel = _root.relativeFilePath( apath);
+    _markDirty( rel == "." ? "" : rel);
+}   // end _doOnDirectoryChanged
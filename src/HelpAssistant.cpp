@@ -21,98 +21,371 @@
 #include <QDir>
 #include <QFileInfo>
 #include <QTextStream>
-#include <QTemporaryFile>
+#include <QRandomGenerator>
 #include <QTextDocument>
+#include <QThreadPool>
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QHash>
+#include <QSet>
 #include <boost/property_tree/xml_parser.hpp>
-#include <boost/algorithm/string.hpp>
-#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
 #include <iostream>
+#include <sstream>
+#include <vector>
 using QTools::HelpAssistant;
 using QTools::HelpBrowser;
 using QTools::TreeModel;
 using QTools::TreeItem;
 using PTree = boost::property_tree::ptree;
-namespace BFS = boost::filesystem;
 
 namespace {
 
-std::string titleFromHTMLHead( const std::string& htmlfile)
+// Resolves paths relative to a list of content root directories with earlier roots taking
+// precedence. Also gives the documents held in memory (and their virtual directories) which
+// are kept out of the (cached) part of the table of contents read from the roots.
+class ContentRoots
 {
-    QFile file( QString::fromStdString(htmlfile));
+public:
+    ContentRoots( const QStringList &roots, const QHash<QString, QString> &docs, const QSet<QString> &vdirs)
+        : _roots(roots), _docs(docs), _vdirs(vdirs) {}
+
+    const QStringList &roots() const { return _roots;}
+
+    QString doc( const QString &rpath) const { return _docs.value( QDir::cleanPath( rpath));}
+
+    // Return the references of the documents in memory in the given relative directory in name order.
+    QStringList docs( const QString &rdir) const
+    {
+        QStringList refs;
+        const QString dprfx = QDir::cleanPath( rdir) + "/";
+        for ( auto it = _docs.constBegin(); it != _docs.constEnd(); ++it)
+            if ( it.key().startsWith( dprfx) && !it.key().mid( dprfx.size()).contains('/'))
+                refs.append( it.key());
+        std::sort( refs.begin(), refs.end());
+        return refs;
+    }   // end docs
+
+    bool isVirtualDir( const QString &rpath) const { return _vdirs.contains( QDir::cleanPath( rpath));}
+
+    // Return the path of the first existing file or directory with the given relative path.
+    QString find( const QString &rpath) const
+    {
+        for ( const QString &root : _roots)
+        {
+            const QString fpath = root + "/" + rpath;
+            if ( QFileInfo::exists( fpath))
+                return fpath;
+        }   // end for
+        return "";
+    }   // end find
+
+    bool isDir( const QString &rpath) const
+    {
+        for ( const QString &root : _roots)
+            if ( QFileInfo( root + "/" + rpath).isDir())
+                return true;
+        return false;
+    }   // end isDir
+
+    // Return the names of the html files in the given relative directory across all roots.
+    QStringList htmlFiles( const QString &rdir) const
+    {
+        QStringList fnames;
+        for ( const QString &root : _roots)
+            for ( const QString &fname : QDir( root + "/" + rdir).entryList( {"*.html"}, QDir::Files))
+                if ( !fnames.contains( fname))
+                    fnames.append( fname);
+        return fnames;
+    }   // end htmlFiles
+
+    // Return the given relative path within every root (whether existing or not).
+    QStringList paths( const QString &rpath) const
+    {
+        QStringList fpaths;
+        for ( const QString &root : _roots)
+            fpaths << root + "/" + rpath;
+        return fpaths;
+    }   // end paths
+
+private:
+    const QStringList _roots;
+    const QHash<QString, QString> &_docs;
+    const QSet<QString> &_vdirs;
+};  // end class
+
+
+// Full parse of the HTML to get its title.
+QString _titleFromHTML( const QString& html)
+{
+    QTextDocument doc;
+    doc.setHtml( html);
+    return doc.metaInformation( QTextDocument::MetaInformation::DocumentTitle);
+}   // end _titleFromHTML
+
+
+// Full parse of the HTML file to get its title. Used for files the head scanner can't deal with.
+QString titleFromHTMLHead( const QString& htmlfile)
+{
+    QFile file( htmlfile);
     if ( !file.open( QIODevice::ReadOnly | QIODevice::Text))
         return "";
     QTextStream in(&file);
-    QString fcontents = in.readAll();
-    QTextDocument doc;
-    doc.setHtml( fcontents);
-    return doc.metaInformation( QTextDocument::MetaInformation::DocumentTitle).toStdString();
+    return _titleFromHTML( in.readAll());
 }   // end titleFromHTMLHead
 
 
-bool readSection( const std::string& tdir, const PTree& section, TreeItem* root)
+enum struct TitleScan
+{
+    FOUND,  // Title read
+    NONE,   // Head has no title (or the file couldn't be read)
+    NOHEAD, // End of head not found
+    PARSE   // Title needs the full parse
+};  // end enum
+
+
+// Return the first case insensitive occurrence of lowercase needle in [b,e) or e if not found.
+const char *_findNoCase( const char *b, const char *e, const char *needle)
+{
+    return std::search( b, e, needle, needle + strlen(needle),
+            []( char c, char n){ return std::tolower( static_cast<unsigned char>(c)) == n;});
+}   // end _findNoCase
+
+
+// Scan the HTML in [b,e) up to the end of its head for the title.
+TitleScan _scanHead( const char *b, const char *e, QString &title)
+{
+    const char *hend = _findNoCase( b, e, "</head");
+    if ( hend == e)
+        return TitleScan::NOHEAD;
+    const char *t = _findNoCase( b, hend, "<title");
+    if ( t == hend)
+        return TitleScan::NONE;
+    t = std::find( t, hend, '>');
+    if ( t == hend)
+        return TitleScan::PARSE;
+    ++t;
+    const char *tend = _findNoCase( t, hend, "</title");
+    // Titles with entities or markup are left to the full parse
+    if ( tend == hend || std::find( t, tend, '&') != tend || std::find( t, tend, '<') != tend)
+        return TitleScan::PARSE;
+    title = QString::fromUtf8( t, int(tend - t)).simplified();
+    return title.isEmpty() ? TitleScan::NONE : TitleScan::FOUND;
+}   // end _scanHead
+
+
+// Read the title from the given HTML file reading only as far as the end of its head.
+TitleScan _readTitle( const QString &htmlfile, QString &title)
+{
+    QFile file( htmlfile);
+    if ( !file.open( QIODevice::ReadOnly))
+        return TitleScan::NONE;
+
+    const qint64 fsize = file.size();
+    const uchar *data = fsize > 0 ? file.map( 0, fsize) : nullptr;
+    if ( data)
+    {
+        const char *b = reinterpret_cast<const char*>(data);
+        const TitleScan res = _scanHead( b, b + fsize, title);
+        return res == TitleScan::NOHEAD ? TitleScan::PARSE : res;
+    }   // end if
+
+    // Not mappable (e.g. a compressed resource) so read in chunks until the end of the head is found.
+    static const qint64 CHUNK = 4096;
+    static const int MAX_HEAD = 1 << 20;
+    QByteArray head;
+    TitleScan res = TitleScan::NOHEAD;
+    while ( res == TitleScan::NOHEAD && !file.atEnd() && head.size() < MAX_HEAD)
+    {
+        head += file.read( CHUNK);
+        res = _scanHead( head.constData(), head.constData() + head.size(), title);
+    }   // end while
+    return res == TitleScan::NOHEAD ? TitleScan::PARSE : res;
+}   // end _readTitle
+
+
+// Get the title of a document in memory.
+QString _docTitle( const QString &html)
+{
+    const QByteArray bytes = html.toUtf8();
+    QString title;
+    const TitleScan res = _scanHead( bytes.constData(), bytes.constData() + bytes.size(), title);
+    if ( res == TitleScan::PARSE || res == TitleScan::NOHEAD)
+        title = _titleFromHTML( html).simplified();
+    return title;
+}   // end _docTitle
+
+
+// An entry in the table of contents. Entries are kept in TOC order (parents before children).
+struct TocEntry
+{
+    QString title;  // Title if given explicitly or once read from file
+    QString ref;    // Path relative to the content roots
+    QString file;   // Path of the file to read the title from if not given (empty for documents in memory)
+    int parent;     // Index of the parent entry or -1 if top level
+    QString dir;    // Directory of files listed by the section (if any)
+    bool noDir;     // True if the directory isn't in any root so the section is kept only if documents were added to it
+};  // end struct
+
+
+// Set the titles of the given entries from the head of their files in parallel.
+void _readTitles( std::vector<TocEntry>& entries, const std::vector<int>& todo)
+{
+    std::vector<TitleScan> res( todo.size());
+    QThreadPool pool;
+    for ( size_t i = 0; i < todo.size(); ++i)
+    {
+        TocEntry &e = entries[size_t(todo[i])];
+        pool.start( QRunnable::create( [&res, &e, i](){ res[i] = _readTitle( e.file, e.title);}));
+    }   // end for
+    pool.waitForDone();
+
+    // Fall back to a full parse (in this thread since it uses QTextDocument) for anything not straightforward.
+    for ( size_t i = 0; i < todo.size(); ++i)
+    {
+        TocEntry &e = entries[size_t(todo[i])];
+        if ( res[i] == TitleScan::PARSE)
+            e.title = titleFromHTMLHead( e.file).simplified();
+    }   // end for
+}   // end _readTitles
+
+
+const quint32 CACHE_MAGIC = 0x51544843; // "QTHC"
+const quint32 CACHE_VERSION = 3;
+
+// Size and modification time of a file or directory. Both -1 if it doesn't exist.
+using Stamp = QPair<qint64, qint64>;
+
+
+QString _defaultCacheFile( const QString &tocXMLFile)
+{
+    const QByteArray hash = QCryptographicHash::hash( QFileInfo(tocXMLFile).absoluteFilePath().toUtf8(), QCryptographicHash::Sha1).toHex();
+    return QStandardPaths::writableLocation( QStandardPaths::CacheLocation) + "/HelpAssistant/" + hash + ".toc";
+}   // end _defaultCacheFile
+
+
+// Stamp the given paths in parallel.
+QHash<QString, Stamp> _stamp( const QStringList &paths)
+{
+    QVector<Stamp> stamps( paths.size());
+    QThreadPool pool;
+    for ( int i = 0; i < paths.size(); ++i)
+        pool.start( QRunnable::create( [&, i](){
+            const QFileInfo finfo( paths.at(i));
+            stamps[i] = finfo.exists() ? Stamp( finfo.isDir() ? 0 : finfo.size(), finfo.lastModified().toMSecsSinceEpoch()) : Stamp( -1, -1);
+        }));
+    pool.waitForDone();
+
+    QHash<QString, Stamp> hash;
+    hash.reserve( paths.size());
+    for ( int i = 0; i < paths.size(); ++i)
+        hash.insert( paths.at(i), stamps.at(i));
+    return hash;
+}   // end _stamp
+
+
+// A previously built table of contents with the stamps of everything it was built from.
+struct TocCache
+{
+    QStringList roots;                  // The content roots the TOC was built with
+    QHash<QString, Stamp> deps;         // The TOC file, the entries' files, and the directories listed
+    QHash<QString, QString> titles;     // Titles read from files (keyed by file path)
+    std::vector<TocEntry> entries;
+
+    bool load( const QString &cfile)
+    {
+        QFile file( cfile);
+        if ( !file.open( QIODevice::ReadOnly))
+            return false;
+
+        QDataStream in( &file);
+        in.setVersion( QDataStream::Qt_5_12);
+        quint32 magic, version, nentries;
+        in >> magic >> version;
+        if ( in.status() != QDataStream::Ok || magic != CACHE_MAGIC || version != CACHE_VERSION)
+            return false;
+
+        in >> roots >> deps >> titles >> nentries;
+        entries.resize( nentries);
+        for ( size_t i = 0; i < entries.size() && in.status() == QDataStream::Ok; ++i)
+        {
+            TocEntry &e = entries[i];
+            qint32 parent;
+            in >> e.title >> e.ref >> e.file >> parent >> e.dir >> e.noDir;
+            e.parent = parent;
+            if ( parent >= qint32(i))
+                in.setStatus( QDataStream::ReadCorruptData);
+        }   // end for
+
+        if ( in.status() != QDataStream::Ok)
+        {
+            std::cerr << "[WARNING] QTools::HelpAssistant::refreshContents: Corrupt TOC cache " << cfile.toStdString() << std::endl;
+            *this = TocCache();
+            return false;
+        }   // end if
+        return true;
+    }   // end load
+
+    bool save( const QString &cfile) const
+    {
+        QDir().mkpath( QFileInfo( cfile).absolutePath());
+        QSaveFile file( cfile);
+        if ( !file.open( QIODevice::WriteOnly))
+            return false;
+
+        QDataStream out( &file);
+        out.setVersion( QDataStream::Qt_5_12);
+        out << CACHE_MAGIC << CACHE_VERSION << roots << deps << titles << quint32(entries.size());
+        for ( const TocEntry &e : entries)
+            out << e.title << e.ref << e.file << qint32(e.parent) << e.dir << e.noDir;
+        return out.status() == QDataStream::Ok && file.commit();
+    }   // end save
+};  // end struct
+
+
+bool readSection( const ContentRoots& croots, const PTree& section, int parent, std::vector<TocEntry>& entries, QStringList& deps)
 {
     static const std::string istr = " QTools::HelpAssistant::readSection: ";
-    std::string fileref = section.get<std::string>("<xmlattr>.ref", "");
-    if ( fileref.empty())
+    const QString fileref = QString::fromStdString( section.get<std::string>("<xmlattr>.ref", ""));
+    if ( fileref.isEmpty())
     {
         std::cerr << "[WARNING]" << istr << "Section has no ref (file path) attribute!" << std::endl;
         return false;
     }   // end else
 
     // If the given file reference does not exist, it is skipped.
-    const std::string htmlfile = tdir + "/" + fileref;
-    if ( !BFS::exists(htmlfile))
+    const QString htmlfile = croots.find( fileref);
+    if ( htmlfile.isEmpty())
     {
-        std::cerr << "[WARNING]" << istr << "Skipping section with file path: " << htmlfile << "; it does not exist!" << std::endl;
+        deps << croots.paths( fileref);  // So the TOC is rebuilt if it appears
+        std::cerr << "[WARNING]" << istr << "Skipping section with file path: " << fileref.toStdString() << "; it does not exist!" << std::endl;
         return true;
     }   // end if
 
     // Get if this section specifies a directory to read in arbitrary HTML files placed there.
-    const std::string dirref = section.get<std::string>("<xmlattr>.dir", "");
-    const std::string dpath = tdir + "/" + dirref;
-    // If the directory reference was given but it does not exist, then skip this section.
-    if ( !dirref.empty() && !BFS::is_directory(dpath))
-    {
-        std::cerr << "[WARNING]" << istr << "Skipping section with directory path: " << dpath << "; it does not exist!" << std::endl;
-        return true;
-    }   // end if
-
-    TreeItem *node = root;
+    const QString dirref = QString::fromStdString( section.get<std::string>("<xmlattr>.dir", ""));
+    // If the directory reference was given but it does not exist, then this section is
+    // skipped unless documents are added in memory to the directory (see _addDocs).
+    const bool noDir = !dirref.isEmpty() && !croots.isDir( dirref);
 
-    // Get this section's title (if explicitly defined - otherwise it's obtained from HTML head).
-    std::string title = section.get<std::string>("<xmlattr>.title", "");
-    if ( title.empty())
-        title = titleFromHTMLHead( htmlfile);
-    if ( title.empty())
-    {
-        std::cerr << "[WARNING]" << istr << "Skipping section; title not given explicitly in section, and HTML has no title tag in head!" << std::endl;
-        return true;
-    }   // end if
+    // Get this section's title (if explicitly defined - otherwise it's obtained from HTML head later).
+    const QString title = QString::fromStdString( section.get<std::string>("<xmlattr>.title", ""));
+    entries.push_back( TocEntry{title, fileref, htmlfile, parent, dirref, noDir});
+    const int node = int(entries.size()) - 1;
 
-    //std::cerr << "Set explicit TOC node: " << title << " --> " << fileref << std::endl;
-    node = new TreeItem( {QString::fromStdString(title), QString::fromStdString(fileref)}, root);
-
-    // If the section specifies a directory reference then the title must be given and all html files
+    // If the section specifies a directory reference then all html files
     // within the directory will be added to the model under it.
-    if ( !dirref.empty())
+    if ( !dirref.isEmpty())
     {
-        for ( const auto& dirEnt : BFS::directory_iterator{dpath})
+        deps << croots.paths( dirref);
+        for ( const QString &fname : croots.htmlFiles( dirref))
         {
-            const BFS::path& path = dirEnt.path();
-            const std::string lowRelPathStr = boost::algorithm::to_lower_copy(path.string());
-            if ( boost::algorithm::ends_with( lowRelPathStr, ".html"))
-            {
-                const std::string dhtmlfile = dpath + "/" + path.filename().string();
-                const std::string htitle = titleFromHTMLHead( dhtmlfile);
-                if ( !htitle.empty())
-                {
-                    const std::string relfile = dirref + "/" + path.filename().string();
-                    //std::cerr << "Set directory entry TOC node: " << htitle << " --> " << relfile << std::endl;
-                    node->appendChild( new TreeItem( {QString::fromStdString(htitle), QString::fromStdString(relfile)}));
-                }   // end if
-                else
-                    std::cerr << "[WARNING]" << istr << " Skipping " << dhtmlfile << "; no title tag given in its head section." << std::endl;
-            }   // end if
+            const QString relfile = dirref + "/" + fname;
+            entries.push_back( TocEntry{"", relfile, croots.find( relfile), node, "", false});
         }   // end for
     }   // end if
 
@@ -122,7 +395,7 @@ bool readSection( const std::string& tdir, const PTree& section, TreeItem* root)
         if ( v.first != "section")
             continue;
 
-        if ( !readSection( tdir, v.second, node))
+        if ( !readSection( croots, v.second, node, entries, deps))
             return false;
     }   // end for
 
@@ -130,8 +403,83 @@ bool readSection( const std::string& tdir, const PTree& section, TreeItem* root)
 }   // end readSection
 
 
-TreeModel* readTableOfContents( const QString& tdir, const QString& tocXMLFile)
+// Create the model from the entries skipping those without titles (and their children).
+TreeModel* _makeModel( const std::vector<TocEntry>& entries)
+{
+    static const std::string istr = " QTools::HelpAssistant::readTableOfContents: ";
+    TreeModel *toc = new TreeModel;
+    TreeItem *root = toc->setNewRoot({"Table Of Contents"});
+    std::vector<TreeItem*> items( entries.size(), nullptr);
+    for ( size_t i = 0; i < entries.size(); ++i)
+    {
+        const TocEntry &e = entries[i];
+        TreeItem *pitem = e.parent < 0 ? root : items[size_t(e.parent)];
+        if ( !pitem)    // Parent skipped
+            continue;
+        if ( e.title.isEmpty())
+        {
+            std::cerr << "[WARNING]" << istr << "Skipping " << e.file.toStdString() << "; no title given in section or in its head." << std::endl;
+            continue;
+        }   // end if
+        items[i] = new TreeItem( {e.title, e.ref}, pitem);
+    }   // end for
+    return toc;
+}   // end _makeModel
+
+
+// Set the files of the entries keyed by their references.
+void _setPages( const std::vector<TocEntry>& entries, QHash<QString, QString>& pages)
 {
+    for ( const TocEntry &e : entries)
+        if ( !e.file.isEmpty())     // Documents in memory are indexed as they're added
+            pages.insert( e.ref, e.file);
+}   // end _setPages
+
+
+// Return the entries read from the content roots with the documents in memory added under the
+// sections listing their directories (before the files listed from the roots). Sections listing
+// directories that exist neither in the roots nor in memory are dropped (with their children).
+std::vector<TocEntry> _addDocs( const ContentRoots& croots, const std::vector<TocEntry>& fentries)
+{
+    static const std::string istr = " QTools::HelpAssistant::readTableOfContents: ";
+    std::vector<TocEntry> entries;
+    entries.reserve( fentries.size());
+    std::vector<int> idx( fentries.size(), -1);    // Index of each entry in entries (-1 if dropped)
+    for ( size_t i = 0; i < fentries.size(); ++i)
+    {
+        TocEntry e = fentries[i];
+        if ( e.parent >= 0 && idx[size_t(e.parent)] < 0)  // Parent dropped
+            continue;
+        if ( e.noDir && !croots.isVirtualDir( e.dir))
+        {
+            std::cerr << "[WARNING]" << istr << "Skipping section with directory path: " << e.dir.toStdString() << "; it does not exist!" << std::endl;
+            continue;
+        }   // end if
+        if ( e.parent >= 0)
+            e.parent = idx[size_t(e.parent)];
+        idx[i] = int(entries.size());
+        entries.push_back( e);
+        if ( !e.dir.isEmpty())
+            for ( const QString &ref : croots.docs( e.dir))
+                entries.push_back( TocEntry{_docTitle( croots.doc( ref)), ref, "", idx[i], "", false});
+    }   // end for
+    return entries;
+}   // end _addDocs
+
+
+// Only the part of the TOC read from the content roots is cached. Documents
+// in memory are added to it after it's read (or taken from the cache).
+TreeModel* readTableOfContents( const ContentRoots& croots, const QString& tocXMLFile, const QString& cacheFile, QHash<QString, QString>& pages)
+{
+    // Use the cached TOC if nothing it was built from has changed since.
+    TocCache cache;
+    if ( !cacheFile.isEmpty() && cache.load( cacheFile)
+            && cache.roots == croots.roots() && cache.deps.contains( tocXMLFile) && _stamp( cache.deps.keys()) == cache.deps)
+    {
+        _setPages( cache.entries, pages);
+        return _makeModel( _addDocs( croots, cache.entries));
+    }   // end if
+
     QFile tocfile(tocXMLFile);
     if ( !tocfile.open( QIODevice::ReadOnly | QIODevice::Text))
     {
@@ -151,56 +499,77 @@ TreeModel* readTableOfContents( const QString& tdir, const QString& tocXMLFile)
     if ( tree.count("TableOfContents") == 0)
         return nullptr;
 
-    TreeModel *toc = new TreeModel;
-    TreeItem *root = toc->setNewRoot({"Table Of Contents"});
+    std::vector<TocEntry> entries;
+    QStringList deps;
     const PTree& xmltoc = tree.get_child("TableOfContents");
     for ( const PTree::value_type& v : xmltoc)
     {
         if ( v.first != "section")
             continue;
 
-        if ( !readSection( tdir.toStdString(), v.second, root))
-        {
-            delete toc;
-            toc = nullptr;
-            break;
-        }   // end if
+        if ( !readSection( croots, v.second, -1, entries, deps))
+            return nullptr;
     }   // end for
 
-    return toc;
+    // Reuse titles from the cache for files that haven't changed and read the rest.
+    deps << tocXMLFile;
+    for ( const TocEntry &e : entries)
+        if ( !e.file.isEmpty())
+            deps << e.file;
+    deps.removeDuplicates();
+    const QHash<QString, Stamp> stamps = _stamp( deps);
+
+    QHash<QString, QString> titles;
+    std::vector<int> todo;
+    for ( size_t i = 0; i < entries.size(); ++i)
+    {
+        TocEntry &e = entries[i];
+        if ( !e.title.isEmpty())    // Given explicitly
+            continue;
+        if ( cache.titles.contains( e.file) && cache.deps.value( e.file) == stamps.value( e.file))
+            e.title = cache.titles.value( e.file);
+        else
+            todo.push_back( int(i));
+    }   // end for
+    _readTitles( entries, todo);
+
+    if ( !cacheFile.isEmpty())
+    {
+        for ( int i : todo)
+            titles.insert( entries[size_t(i)].file, entries[size_t(i)].title);
+        for ( const TocEntry &e : entries)  // Reused titles
+            if ( !titles.contains( e.file) && cache.titles.contains( e.file))
+                titles.insert( e.file, cache.titles.value( e.file));
+        cache.roots = croots.roots();
+        cache.deps = stamps;
+        cache.titles = titles;
+        cache.entries = entries;
+        if ( !cache.save( cacheFile))
+            std::cerr << "[WARNING] QTools::HelpAssistant::readTableOfContents: Unable to write TOC cache " << cacheFile.toStdString() << std::endl;
+    }   // end if
+
+    _setPages( entries, pages);
+    return _makeModel( _addDocs( croots, entries));
 }   // end readTableOfContents
 
 }   // end namespace
 
 
-HelpAssistant::HelpAssistant( const QString& hdir, QWidget *prnt) : _dialog(new HelpBrowser(prnt))
+HelpAssistant::HelpAssistant( const QString& hdir, QWidget *prnt)
+    : _dialog(new HelpBrowser(prnt)), _srcdir( QDir(hdir).absolutePath()), _useCache(true)
 {
-    _initTempHtmlDir(hdir);
-    _dialog->setRootDir( _workdir.path());
+    const QByteArray hash = QCryptographicHash::hash( _srcdir.toUtf8(), QCryptographicHash::Sha1).toHex();
+    _index = new HelpSearchIndex( QStandardPaths::writableLocation( QStandardPaths::CacheLocation) + "/HelpAssistant/" + hash + ".idx");
+    _dialog->setRootDir( _srcdir);
+    _dialog->setSearchIndex( _index);
 }   // end ctor
 
 
-HelpAssistant::~HelpAssistant() { delete _dialog;}
-
-
-void HelpAssistant::_initTempHtmlDir( const QString& srcDir)
+HelpAssistant::~HelpAssistant()
 {
-    QDir sdir(srcDir);
-    if ( !sdir.exists())
-        return;
-
-    const BFS::path src = sdir.absolutePath().toStdString();
-    const BFS::path dst = _workdir.path().toStdString();
-
-    // Copy all content from hdir into _workdir
-    for ( const auto& dirEnt : BFS::recursive_directory_iterator{src})
-    {
-        const auto& path = dirEnt.path();
-        auto relPathStr = path.string();
-        boost::replace_first( relPathStr, src.string(), "");
-        BFS::copy( path, dst / relPathStr, BFS::copy_options::update_existing);
-    }   // end for
-}   // end _initTempHtmlDir
+    delete _dialog;
+    delete _index;
+}   // end dtor
 
 
 QString HelpAssistant::addDocument( const QString& subdir, const QString& hfile)
@@ -230,59 +599,62 @@ QString HelpAssistant::addDocument( const QString& subdir, const QString& hfile)
 QString HelpAssistant::addContent( const QString& subdir, const QString& content)
 {
     static const std::string werr = "[WARNING] QTools::HelpAssistant::addContent: ";
-    static const std::string istr = "[INFO] QTools::HelpAssistant::addContent: ";
+    static const QString CHARS = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
 
     if ( subdir.isEmpty())
     {
-        std::cerr << werr << "Subdirectory of working temporary directory was not given!" << std::endl;
+        std::cerr << werr << "Subdirectory was not given!" << std::endl;
         return "";
     }   // end if
 
-    QString dstdir = _workdir.path() + "/" + subdir;
-    if ( !QDir(_workdir.path()).mkpath(dstdir))  // Will return true if the path to this directory already exists
+    const QString dir = QDir::cleanPath( subdir);
+    if ( QDir::isAbsolutePath( dir) || dir == "." || dir.startsWith(".."))
     {
-        std::cerr << werr << "Invalid directory: '" << dstdir.toStdString() << "'" << std::endl;
+        std::cerr << werr << "Invalid directory: '" << subdir.toStdString() << "'" << std::endl;
         return "";
     }   // end if
+    _vdirs.insert( dir);
 
     if ( content.isEmpty())
         return "";
 
-    // Append filename (with template for temporary unique filename setting).
-    QString tpath;
-    { QTemporaryFile tmp( dstdir + "/XXXXXX.html");
-        if ( tmp.open())
-            tpath = tmp.fileName();
-    }   // end scope
-
-    if ( tpath.isEmpty())
+    // The token is a random file name (as for a temporary file) in the given subdirectory.
+    QString token;
+    do
     {
-        std::cerr << werr << "Unable to create temporary file in working directory!" << std::endl;
-        return "";
-    }   // end if
-
-    // Write the content to the temporary file location.
-    QFile ofile( tpath);
-    if ( !ofile.open(QIODevice::WriteOnly | QIODevice::Text))
-    {
-        std::cerr << werr << "Unable to open temporary file at location " << tpath.toStdString() << " for writing!" << std::endl;
-        return "";
-    }   // end if
+        QString fname;
+        for ( int i = 0; i < 6; ++i)
+            fname += CHARS.at( QRandomGenerator::global()->bounded( CHARS.size()));
+        token = dir + "/" + fname + ".html";
+    } while ( _dialog->documents().contains( token) || QFileInfo::exists( _srcdir + "/" + token));
+
+    // Kept in memory (never written to file) and shown by the browser from there.
+    _dialog->addDocument( token, content);
+    _index->addPage( token, content);
+    return token;
+}   // end addContent
 
-    QTextStream out(&ofile);
-    out << content << Qt::endl;
-    ofile.close();
 
-    // The token returned is just the name of the temporary file (excluding path) appended to the given subdirectory
-    return subdir + "/" + QFileInfo( tpath).fileName();
-}   // end addContent
+void HelpAssistant::setTocCache( bool enable, const QString& cacheFile)
+{
+    _useCache = enable;
+    _cacheFile = cacheFile;
+}   // end setTocCache
 
 
 void HelpAssistant::refreshContents( const QString& tocXmlFile)
 {
     // Read in the toc.xml file if it exists
-    TreeModel *toc = readTableOfContents( _workdir.path(), tocXmlFile);
+    QString cacheFile;
+    if ( _useCache)
+        cacheFile = _cacheFile.isEmpty() ? _defaultCacheFile( tocXmlFile) : _cacheFile;
+    QHash<QString, QString> pages;
+    const ContentRoots croots( {_srcdir}, _dialog->documents(), _vdirs);
+    TreeModel *toc = readTableOfContents( croots, QFileInfo(tocXmlFile).absoluteFilePath(), cacheFile, pages);
     _dialog->setTableOfContents(toc);
+
+    // Index the pages in the background (documents in memory are indexed as they're added).
+    _index->update( pages);
     //return _dialog->setContent( "index.html");
 }   // end refreshContents
 
@@ -21,11 +21,18 @@
 #include <QPushButton>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
+#include <QAbstractTextDocumentLayout>
 #include <QTextDocument>
+#include <QTextCodec>
+#include <QCache>
+#include <QImage>
+#include <QScrollBar>
 #include <QTextStream>
 #include <QScreen>
 #include <QFile>
 #include <QDir>
+#include <algorithm>
+#include <functional>
 #include <iostream>
 using QTools::HelpBrowser;
 using QTools::TreeModel;
@@ -50,6 +57,228 @@ private:
     HelpBrowser *_hd;
 };  // end class
 
+// Serves documents held in memory before looking for files in the search paths. Parsed
+// documents and decoded images are kept in an LRU cache (with costs in KB) so that going
+// back to a page swaps in its already laid out document instead of loading it again.
+// All navigation (including through the history) goes through _show to keep the shown
+// document and the cache in step with the source.
+class HelpBrowser::TextBrowser : public QTextBrowser
+{
+public:
+    explicit TextBrowser( const QHash<QString, QString>& docs)
+        : _docs(docs), _current(nullptr), _stale(false), _scratch( new QTextDocument(this)), _placeholder(false)
+    {
+        _cache.setMaxCost( 64*1024);
+    }   // end ctor
+
+    void setCacheSize( int kbytes) { _cache.setMaxCost( std::max( 0, kbytes));}
+
+    // The shown document is discarded rather than cached when navigating away from it.
+    void clearCache()
+    {
+        _cache.clear();
+        _stale = _current != nullptr;
+    }   // end clearCache
+
+    void uncache( const QString &ref)
+    {
+        const QString key = _key( QUrl(ref));
+        _cache.remove( key);
+        if ( key == _currentKey)
+            _stale = true;
+    }   // end uncache
+
+    // QTextBrowser restores history entries without calling doSetSource.
+    void backward() override
+    {
+        if ( isBackwardAvailable())
+            _show( historyUrl(-1), true, [this](){ QTextBrowser::backward();});
+    }   // end backward
+
+    void forward() override
+    {
+        if ( isForwardAvailable())
+            _show( historyUrl(1), true, [this](){ QTextBrowser::forward();});
+    }   // end forward
+
+    // Load, parse and lay out the given page into the cache if not already there or showing.
+    void prefetch( const QString &ref)
+    {
+        const QUrl url( ref);
+        const QString key = _key( url);
+        if ( _cache.maxCost() == 0 || _cache.contains( key) || key == _currentKey)
+            return;
+        QTextDocument *doc = _newDocument( url);
+        doc->setHtml( _toHtml( loadResource( QTextDocument::HtmlResource, url)));
+        doc->setMetaInformation( QTextDocument::DocumentUrl, url.toString());
+        doc->setTextWidth( viewport()->width());
+        doc->documentLayout()->documentSize();  // Lays out (loading images) now rather than when shown
+        _insert( key, doc, QPoint());
+    }   // end prefetch
+
+    QVariant loadResource( int type, const QUrl& name) override
+    {
+        if ( type == QTextDocument::HtmlResource)
+        {
+            if ( _placeholder)  // Showing a cached document so there's nothing to parse
+                return QString(" ");
+            // The name may or may not already be resolved against the current source.
+            for ( const QUrl &url : {name, source().resolved( name)})
+            {
+                const auto it = _docs.constFind( _key( url));
+                if ( it != _docs.constEnd())
+                    return it.value();
+            }   // end for
+        }   // end if
+        else if ( type == QTextDocument::ImageResource && _cache.maxCost() > 0)
+        {
+            const QString key = _key( name);
+            if ( const Entry *e = _cache.object( key))
+                return e->image;
+            const QVariant data = QTextBrowser::loadResource( type, name);
+            QImage img;
+            if ( data.userType() == QMetaType::QByteArray)
+                img.loadFromData( data.toByteArray());
+            if ( img.isNull())
+                return data;
+            _cache.insert( key, new Entry( img), _kbytes( img.sizeInBytes()));
+            return img;
+        }   // end else if
+        return QTextBrowser::loadResource( type, name);
+    }   // end loadResource
+
+protected:
+    void doSetSource( const QUrl& url, QTextDocument::ResourceType type) override
+    {
+        _show( url, false, [&](){ QTextBrowser::doSetSource( url, type);});
+    }   // end doSetSource
+
+private:
+    struct Entry
+    {
+        Entry( QTextDocument *d, const QPoint &s) : doc(d), scroll(s) {}
+        explicit Entry( const QImage &img) : doc(nullptr), image(img) {}
+        ~Entry() { delete doc;}
+        QTextDocument *doc;
+        QPoint scroll;  // Scroll bar positions when last shown
+        QImage image;
+    };  // end struct
+
+    const QHash<QString, QString>& _docs;
+    QCache<QString, Entry> _cache;  // Keyed by path relative to the roots
+    QTextDocument *_current;        // Shown (so not in the cache)
+    QString _currentKey;
+    bool _stale;                    // True if the shown document was uncached
+    QTextDocument *_scratch;
+    bool _placeholder;
+
+    // Show the page at url using its cached document if there is one. The base class navigation
+    // (which updates the source and history) is done by load with signals blocked until the shown
+    // document matches the new source. If restoreScroll is true, a cached document is shown
+    // scrolled as it was when last shown (as the base class does when going through the history).
+    void _show( const QUrl &url, bool restoreScroll, const std::function<void()> &load)
+    {
+        const QString key = _key( url);
+        if ( key == _currentKey)    // E.g. just scrolling to an anchor
+        {
+            load();
+            return;
+        }   // end if
+
+        QTextDocument *prev = _current;
+        const QPoint prevScroll( horizontalScrollBar()->value(), verticalScrollBar()->value());
+        QPoint scroll;
+        QTextDocument *doc = _take( key, scroll);
+        {
+            const QSignalBlocker blocker( this);
+            if ( doc)
+            {
+                // QTextBrowser still updates its source and history but only parses a placeholder.
+                setDocument( _scratch);
+                _placeholder = true;
+                load();
+                _placeholder = false;
+                setDocument( doc);
+                if ( restoreScroll)
+                {
+                    horizontalScrollBar()->setValue( scroll.x());
+                    verticalScrollBar()->setValue( scroll.y());
+                }   // end if
+                else if ( url.hasFragment())
+                    scrollToAnchor( url.fragment());
+            }   // end if
+            else
+            {
+                doc = _newDocument( url);
+                setDocument( doc);
+                load();
+            }   // end else
+        }   // end scope
+
+        if ( prev && _stale)
+            delete prev;
+        else if ( prev) // No longer shown so can be evicted
+            _insert( _currentKey, prev, prevScroll);
+        _current = doc;
+        _currentKey = key;
+        _stale = false;
+
+        emit backwardAvailable( isBackwardAvailable());
+        emit forwardAvailable( isForwardAvailable());
+        emit historyChanged();
+        emit sourceChanged( source());
+    }   // end _show
+
+    static QString _key( const QUrl &url)
+    {
+        QString path = QDir::cleanPath( url.path());
+        if ( path.startsWith('/'))
+            path = path.mid(1);
+        return path;
+    }   // end _key
+
+    static int _kbytes( qint64 nbytes) { return int( std::max<qint64>( 1, nbytes / 1024));}
+
+    static QString _toHtml( const QVariant &data)
+    {
+        if ( data.userType() != QMetaType::QByteArray)
+            return data.toString();
+        const QByteArray bytes = data.toByteArray();
+        return Qt::codecForHtml( bytes)->toUnicode( bytes);
+    }   // end _toHtml
+
+    // Documents are parented here to load their resources through loadResource and are
+    // given their own base URL so relative resources resolve whichever page is shown.
+    QTextDocument* _newDocument( const QUrl &url)
+    {
+        QTextDocument *doc = new QTextDocument( this);
+        doc->setDefaultFont( font());
+        doc->setUndoRedoEnabled( false);
+        doc->setBaseUrl( url.adjusted( QUrl::RemoveFilename | QUrl::RemoveQuery | QUrl::RemoveFragment));
+        return doc;
+    }   // end _newDocument
+
+    // Cost is a rough estimate of the text, formats and layout (images are costed separately).
+    void _insert( const QString &key, QTextDocument *doc, const QPoint &scroll)
+    {
+        _cache.insert( key, new Entry( doc, scroll), _kbytes( qint64( doc->characterCount()) * 16));
+    }   // end _insert
+
+    QTextDocument* _take( const QString &key, QPoint &scroll)
+    {
+        const Entry *e = _cache.object( key);
+        if ( !e || !e->doc)
+            return nullptr;
+        Entry *entry = _cache.take( key);
+        QTextDocument *doc = entry->doc;
+        scroll = entry->scroll;
+        entry->doc = nullptr;
+        delete entry;
+        return doc;
+    }   // end _take
+};  // end class
+
+
 namespace {
 
 QToolButton* makeToolButton( HelpBrowser* d, const QString& iconstr)
@@ -69,7 +298,7 @@ QToolButton* makeToolButton( HelpBrowser* d, const QString& iconstr)
 }   // end namespace
 
 
-HelpBrowser::HelpBrowser( QWidget *parent) : QMainWindow(parent)
+HelpBrowser::HelpBrowser( QWidget *parent) : QMainWindow(parent), _index(nullptr)
 {
     if ( parent)
     {
@@ -84,13 +313,29 @@ HelpBrowser::HelpBrowser( QWidget *parent) : QMainWindow(parent)
     _splitter = new QSplitter(this);
     _tview = new TreeView(this);
 
-    _tbrowser = new QTextBrowser;
-    _splitter->addWidget( _tview);
+    // Search results are shown in place of the table of contents while searching.
+    _searchEdit = new QLineEdit;
+    _searchEdit->setPlaceholderText( tr("Search"));
+    _searchEdit->setClearButtonEnabled( true);
+    _searchEdit->setEnabled( false);
+    _results = new QListWidget;
+    _results->hide();
+
+    QWidget *lwidget = new QWidget;
+    QVBoxLayout *llayout = new QVBoxLayout;
+    llayout->setContentsMargins( 0, 0, 0, 0);
+    llayout->addWidget( _searchEdit);
+    llayout->addWidget( _tview);
+    llayout->addWidget( _results);
+    lwidget->setLayout( llayout);
+
+    _tbrowser = new TextBrowser( _docs);
+    _splitter->addWidget( lwidget);
     _splitter->addWidget( _tbrowser);
 
-    QSizePolicy policy = _tview->sizePolicy();
+    QSizePolicy policy = lwidget->sizePolicy();
     policy.setHorizontalStretch(1);
-    _tview->setSizePolicy(policy);
+    lwidget->setSizePolicy(policy);
 
     policy = _tbrowser->sizePolicy();
     policy.setHorizontalStretch(4);
@@ -126,16 +371,56 @@ HelpBrowser::HelpBrowser( QWidget *parent) : QMainWindow(parent)
     _tbrowser->setOpenExternalLinks(true);
     _tbrowser->setVerticalScrollBarPolicy( Qt::ScrollBarAlwaysOn);
 
+    // Sources are relative to the search paths and QTextBrowser only resolves clicked links
+    // against a relative source if they're just a fragment (giving the current page). Other
+    // relative links are resolved here; navigating to them stops the text browser doing so.
+    connect( _tbrowser, &QTextBrowser::anchorClicked, this, [this]( const QUrl &url)
+    {
+        const QUrl src = _tbrowser->source();
+        if ( url.isRelative() && url.adjusted( QUrl::RemoveFragment) != src.adjusted( QUrl::RemoveFragment))
+            _tbrowser->setSource( src.resolved( url));
+    });
+
+    // Pages next to the current one are prefetched one at a time while idle.
+    _prefetch = true;
+    _prefetchTimer = new QTimer(this);
+    _prefetchTimer->setSingleShot( true);
+    _prefetchTimer->setInterval( 300);
+    connect( _prefetchTimer, &QTimer::timeout, this, &HelpBrowser::_doPrefetch);
+
     connect( _tbrowser, &QTextBrowser::sourceChanged, this, &HelpBrowser::_doOnSourceChanged);
+    connect( _searchEdit, &QLineEdit::textChanged, this, &HelpBrowser::_doOnSearch);
+    connect( _results, &QListWidget::itemClicked, this, &HelpBrowser::_doOnResultActivated);
+    connect( _results, &QListWidget::itemActivated, this, &HelpBrowser::_doOnResultActivated);
 
     setGeometry( QStyle::alignedRect( Qt::LeftToRight, Qt::AlignCenter, sizeHint(), QGuiApplication::primaryScreen()->geometry()));
 }   // end ctor
 
 
-void HelpBrowser::setRootDir( const QString& rdir)
+void HelpBrowser::setRootDir( const QString& rdir) { setRootDirs( {rdir});}
+
+
+void HelpBrowser::setRootDirs( const QStringList& rdirs)
+{
+    // Content is loaded using paths relative to these so the
+    // browser only looks for files as they're needed.
+    _tbrowser->setSearchPaths( rdirs);
+    _tbrowser->clearCache();
+}   // end setRootDirs
+
+
+void HelpBrowser::setCacheSize( int mbytes) { _tbrowser->setCacheSize( std::max( 0, mbytes) * 1024);}
+
+
+void HelpBrowser::setPrefetch( bool v)
 {
-    _rootDir = rdir + "/";
-}   // end setRootDir
+    _prefetch = v;
+    if ( !_prefetch)
+    {
+        _prefetchTimer->stop();
+        _prefetchRefs.clear();
+    }   // end if
+}   // end setPrefetch
 
 
 void HelpBrowser::setTableOfContents( TreeModel *tm, bool delExisting)
@@ -143,6 +428,8 @@ void HelpBrowser::setTableOfContents( TreeModel *tm, bool delExisting)
     QItemSelectionModel *delsm = _tview->selectionModel();   // To delete if not null
     QAbstractItemModel *delm = _tview->model();
 
+    if ( tm)    // Pages are looked up by reference on every navigation
+        tm->setIndexed( 1);
     _tview->setModel( tm);
     _tview->expandAll();
 
@@ -159,7 +446,8 @@ bool HelpBrowser::setContent( const QString& htmlfile)
 {
     bool ok = false;
     // Only HTML files defined in the model (table of contents) are allowed.
-    const QModelIndex idx = static_cast<const TreeModel*>(_tview->model())->find( htmlfile, 1);
+    const TreeModel *toc = static_cast<const TreeModel*>(_tview->model());
+    const QModelIndex idx = toc ? toc->find( htmlfile, 1) : QModelIndex();
     if ( idx.isValid())
     {
         _tview->setCurrentIndex( idx); // Ensure corresponding entry in TOC is highlighted.
@@ -170,22 +458,101 @@ bool HelpBrowser::setContent( const QString& htmlfile)
 }   // end setContent
 
 
+void HelpBrowser::addDocument( const QString& ref, const QString& html)
+{
+    _docs.insert( QDir::cleanPath( ref), html);
+    _tbrowser->uncache( ref);
+}   // end addDocument
+
+
+void HelpBrowser::setSearchIndex( HelpSearchIndex *index)
+{
+    if ( _index)
+        _index->disconnect( this);
+    _index = index;
+    _searchEdit->setEnabled( _index != nullptr);
+    if ( _index)   // Rerun the search as pages are indexed
+        connect( _index, &HelpSearchIndex::onUpdated, this, &HelpBrowser::_doOnSearch, Qt::QueuedConnection);
+    _doOnSearch();
+}   // end setSearchIndex
+
+
+void HelpBrowser::_doOnSearch()
+{
+    const QString query = _searchEdit->text().trimmed().isEmpty() ? "" : _searchEdit->text();
+    const bool searching = _index && !query.isEmpty();
+    _results->clear();
+    _results->setVisible( searching);
+    _tview->setVisible( !searching);
+    if ( !searching)
+        return;
+
+    for ( const HelpSearchIndex::Hit &hit : _index->search( query))
+    {
+        QListWidgetItem *item = new QListWidgetItem( hit.title, _results);
+        item->setData( Qt::UserRole, hit.ref);
+        item->setToolTip( hit.ref);
+    }   // end for
+    if ( _results->count() == 0)
+    {
+        QListWidgetItem *item = new QListWidgetItem( tr("No matches"), _results);
+        item->setFlags( Qt::NoItemFlags);
+    }   // end if
+}   // end _doOnSearch
+
+
+void HelpBrowser::_doOnResultActivated( QListWidgetItem *item)
+{
+    const QString ref = item->data( Qt::UserRole).toString();
+    // Pages not in the table of contents (e.g. added content) are shown directly.
+    if ( !ref.isEmpty() && !setContent( ref))
+        _setContent( ref);
+}   // end _doOnResultActivated
+
+
 void HelpBrowser::_setContent( const QString& htmlfile)
 {
     QSignalBlocker blocker(_tbrowser);
-    _tbrowser->setSource( QUrl::fromLocalFile( _rootDir + htmlfile), QTextDocument::HtmlResource);
+    _tbrowser->setSource( QUrl( htmlfile), QTextDocument::HtmlResource);
     setWindowTitle( _wprfx + " | " + _tbrowser->documentTitle());
     _backButton->setEnabled( _tbrowser->isBackwardAvailable());
     _fwrdButton->setEnabled( _tbrowser->isForwardAvailable());
     //std::cerr << "_setContent( " << htmlfile.toStdString() << ")" << std::endl;
+
+    // Queue the pages before and after this one in the table of contents for prefetching.
+    _prefetchRefs.clear();
+    if ( _prefetch)
+    {
+        const QModelIndex idx = _tview->currentIndex();
+        for ( const QModelIndex &nidx : {_tview->indexBelow( idx), _tview->indexAbove( idx)})
+        {
+            const QString ref = nidx.isValid() ? static_cast<QTools::TreeItem*>(nidx.internalPointer())->data(1).toString() : "";
+            if ( !ref.isEmpty() && ref != htmlfile)
+                _prefetchRefs.append( ref);
+        }   // end for
+        if ( !_prefetchRefs.isEmpty())
+            _prefetchTimer->start();
+    }   // end if
 }   // end _setContent
 
 
+void HelpBrowser::_doPrefetch()
+{
+    if ( _prefetchRefs.isEmpty())
+        return;
+    _tbrowser->prefetch( _prefetchRefs.takeFirst());
+    if ( !_prefetchRefs.isEmpty())
+        _prefetchTimer->start();
+}   // end _doPrefetch
+
+
 // This function called if links clicked in the page
 void HelpBrowser::_doOnSourceChanged( const QUrl &src)
 {
     QString path = QDir::fromNativeSeparators( src.path());
-    path.remove(_rootDir);
+    for ( const QString &rdir : _tbrowser->searchPaths())   // In case given as an absolute path
+        if ( path.startsWith( rdir + "/"))
+            path.remove( 0, rdir.size());
     if ( path.startsWith('/'))
         path = path.right( path.size()-1);
     const QModelIndex idx = static_cast<const TreeModel*>(_tview->model())->find( path, 1);
@@ -0,0 +1,614 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#include <HelpSearchIndex.h>
+#include <QDataStream>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QFile>
+#include <QDir>
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+using QTools::HelpSearchIndex;
+
+
+struct HelpSearchIndex::Parsed
+{
+    QString ref;
+    QString file;
+    qint64 size;
+    qint64 mtime;
+    QString title;
+    QStringList titleWords;
+    QStringList words;
+};  // end struct
+
+
+namespace {
+
+const quint32 CACHE_MAGIC = 0x51544853; // "QTHS"
+const quint32 CACHE_VERSION = 1;
+
+const int MAX_PREFIX_TERMS = 256;   // Most terms a prefix is expanded to
+const double BM25_K1 = 1.2;
+const double BM25_B = 0.75;
+
+
+// Decode the character entity starting at html[i] setting i to its end. Returns '&' if not an entity.
+QChar _decodeEntity( const QString &html, int &i)
+{
+    static const QHash<QString, QChar> NAMED = {{"amp", '&'}, {"lt", '<'}, {"gt", '>'}, {"quot", '"'},
+                                                {"apos", '\''}, {"nbsp", QChar(0xa0)}};
+    const int semi = html.indexOf( ';', i);
+    if ( semi < 0 || semi - i > 10)
+        return '&';
+
+    const QString name = html.mid( i + 1, semi - i - 1);
+    QChar c;
+    if ( name.startsWith('#'))
+    {
+        bool ok = false;
+        const uint code = name.startsWith("#x", Qt::CaseInsensitive) ? name.mid(2).toUInt( &ok, 16) : name.mid(1).toUInt( &ok);
+        if ( !ok)
+            return '&';
+        c = code <= 0xffff ? QChar( ushort(code)) : QChar( QChar::ReplacementCharacter);
+    }   // end if
+    else if ( NAMED.contains( name))
+        c = NAMED.value( name);
+    else
+        return '&';
+    i = semi;
+    return c;
+}   // end _decodeEntity
+
+
+// Extract the title and the lower case words of the title and body from the given HTML.
+void _tokenise( const QString &html, QString &title, QStringList &titleWords, QStringList &words)
+{
+    QString titleText;
+    QString word;
+    bool inTitle = false;
+    const auto flush = [&](){
+        if ( !word.isEmpty())
+        {
+            (inTitle ? titleWords : words).append( word);
+            word.clear();
+        }   // end if
+    };
+
+    const int n = html.size();
+    for ( int i = 0; i < n; ++i)
+    {
+        QChar c = html.at(i);
+        if ( c == '<')
+        {
+            flush();
+            if ( html.midRef( i, 4) == QLatin1String("<!--"))
+            {
+                const int j = html.indexOf( "-->", i + 4);
+                i = j < 0 ? n : j + 2;
+                continue;
+            }   // end if
+
+            int j = i + 1;
+            const bool closing = j < n && html.at(j) == '/';
+            if ( closing)
+                j++;
+            int k = j;
+            while ( k < n && html.at(k).isLetterOrNumber())
+                k++;
+            const QString tag = html.mid( j, k - j).toLower();
+            const int gt = html.indexOf( '>', k);
+            i = gt < 0 ? n : gt;
+
+            if ( tag == "title")
+                inTitle = !closing;
+            else if ( !closing && (tag == "script" || tag == "style"))  // Skip to the end of the element
+            {
+                const int e = html.indexOf( "</" + tag, i, Qt::CaseInsensitive);
+                i = e < 0 ? n : html.indexOf( '>', e);
+                if ( i < 0)
+                    i = n;
+            }   // end else if
+            continue;
+        }   // end if
+
+        if ( c == '&')
+            c = _decodeEntity( html, i);
+        if ( inTitle)
+            titleText.append( c);
+        if ( c.isLetterOrNumber())
+            word.append( c.toLower());
+        else
+            flush();
+    }   // end for
+    flush();
+    title = titleText.simplified();
+}   // end _tokenise
+
+
+struct QueryTerm
+{
+    QString word;
+    int phrase;     // Index of the phrase the word is in or -1
+    bool prefix;
+};  // end struct
+
+
+QVector<QueryTerm> _parseQuery( const QString &query)
+{
+    QVector<QueryTerm> terms;
+    QString word;
+    int phrase = -1;
+    int nphrases = 0;
+    const auto flush = [&](){
+        if ( !word.isEmpty())
+        {
+            terms.append( QueryTerm{word, phrase, false});
+            word.clear();
+        }   // end if
+    };
+
+    for ( const QChar c : query)
+    {
+        if ( c == '"')
+        {
+            flush();
+            phrase = phrase < 0 ? nphrases++ : -1;
+        }   // end if
+        else if ( c.isLetterOrNumber())
+            word.append( c.toLower());
+        else
+            flush();
+    }   // end for
+
+    const bool trailing = !word.isEmpty();
+    flush();
+    if ( trailing && terms.last().phrase < 0)
+        terms.last().prefix = true;
+    return terms;
+}   // end _parseQuery
+
+
+bool _contains( const QVector<qint32> &sorted, qint32 v) { return std::binary_search( sorted.begin(), sorted.end(), v);}
+
+}   // end namespace
+
+
+HelpSearchIndex::HelpSearchIndex( const QString &cacheFile, QObject *parent)
+    : QObject(parent), _cacheFile(cacheFile), _totalLength(0), _loaded(false), _modified(false)
+{
+    _pool.setMaxThreadCount(1);
+}   // end ctor
+
+
+HelpSearchIndex::~HelpSearchIndex()
+{
+    _pool.waitForDone();
+    if ( _modified)
+        save();
+}   // end dtor
+
+
+void HelpSearchIndex::update( const QHash<QString, QString> &pages)
+{
+    _pool.start( QRunnable::create( [this, pages](){
+        _update( pages);
+        emit onUpdated();
+    }));
+}   // end update
+
+
+void HelpSearchIndex::addPage( const QString &ref, const QString &html)
+{
+    _pool.start( QRunnable::create( [this, ref, html](){
+        _ensureLoaded();
+        Parsed p;
+        p.ref = ref;
+        p.size = p.mtime = -1;
+        _tokenise( html, p.title, p.titleWords, p.words);
+        QWriteLocker locker( &_lock);
+        _merge( {p});
+        locker.unlock();
+        emit onUpdated();
+    }));
+}   // end addPage
+
+
+bool HelpSearchIndex::isUpdating() const { return _pool.activeThreadCount() > 0;}
+
+
+void HelpSearchIndex::waitForUpdates() { _pool.waitForDone();}
+
+
+int HelpSearchIndex::pageCount() const
+{
+    QReadLocker locker( &_lock);
+    return _pageIds.size();
+}   // end pageCount
+
+
+int HelpSearchIndex::termCount() const
+{
+    QReadLocker locker( &_lock);
+    return _postings.size();
+}   // end termCount
+
+
+void HelpSearchIndex::_ensureLoaded()
+{
+    if ( !_loaded)
+    {
+        _loaded = true;
+        if ( !_cacheFile.isEmpty())
+            _load();
+    }   // end if
+}   // end _ensureLoaded
+
+
+void HelpSearchIndex::_update( const QHash<QString, QString> &pages)
+{
+    _ensureLoaded();
+
+    // Find the pages to (re)read and those to drop. Only this thread modifies the index so reading without the lock is safe.
+    QVector<Parsed> todo;
+    QVector<int> dropped;
+    for ( auto it = _pageIds.constBegin(); it != _pageIds.constEnd(); ++it)
+    {
+        const Page &page = _pages.at( it.value());
+        if ( !page.file.isEmpty() && pages.value( page.ref) != page.file)
+            dropped.append( it.value());
+    }   // end for
+
+    for ( auto it = pages.constBegin(); it != pages.constEnd(); ++it)
+    {
+        const QFileInfo finfo( it.value());
+        Parsed p;
+        p.ref = it.key();
+        p.file = it.value();
+        p.size = finfo.size();
+        p.mtime = finfo.lastModified().toMSecsSinceEpoch();
+        const int id = _pageIds.value( p.ref, -1);
+        if ( id < 0 || _pages.at(id).file != p.file || _pages.at(id).size != p.size || _pages.at(id).mtime != p.mtime)
+            todo.append( p);
+    }   // end for
+
+    // Read and tokenise in parallel.
+    Parsed *parsed = todo.data();
+    QThreadPool pool;
+    for ( int i = 0; i < todo.size(); ++i)
+        pool.start( QRunnable::create( [parsed, i](){
+            Parsed &p = parsed[i];
+            QFile file( p.file);
+            if ( file.open( QIODevice::ReadOnly))
+                _tokenise( QString::fromUtf8( file.readAll()), p.title, p.titleWords, p.words);
+            else
+                std::cerr << "[WARNING] QTools::HelpSearchIndex::update: Unable to read " << p.file.toStdString() << std::endl;
+        }));
+    pool.waitForDone();
+
+    if ( dropped.isEmpty() && todo.isEmpty())
+        return;
+
+    QWriteLocker locker( &_lock);
+    for ( int id : dropped)
+        _drop( id);
+    _merge( todo);
+    locker.unlock();
+
+    if ( !_cacheFile.isEmpty())
+        save();
+}   // end _update
+
+
+void HelpSearchIndex::_merge( const QVector<Parsed> &parsed)
+{
+    for ( const Parsed &p : parsed)
+    {
+        const int oldId = _pageIds.value( p.ref, -1);
+        if ( oldId >= 0)
+            _drop( oldId);
+
+        // Dropped pages' IDs are reused so the pages don't grow with every reindex.
+        qint32 id;
+        if ( _freeIds.isEmpty())
+        {
+            id = qint32(_pages.size());
+            _pages.append( Page());
+        }   // end if
+        else
+            id = _freeIds.takeLast();
+
+        Page page;
+        page.ref = p.ref;
+        page.title = p.title;
+        page.file = p.file;
+        page.size = p.size;
+        page.mtime = p.mtime;
+        page.titleLength = qint32(p.titleWords.size());
+        page.length = page.titleLength + qint32(p.words.size());
+        page.live = true;
+
+        QHash<QString, QVector<qint32>> positions;
+        qint32 pos = 0;
+        for ( const QString &w : p.titleWords)
+            positions[w].append( pos++);
+        for ( const QString &w : p.words)
+            positions[w].append( pos++);
+
+        for ( auto it = positions.constBegin(); it != positions.constEnd(); ++it)
+            _postings[it.key()].append( Posting{id, it.value()});
+        page.terms = positions.keys();
+
+        _pageIds.insert( page.ref, id);
+        _totalLength += page.length;
+        if ( !page.file.isEmpty())
+            _modified = true;
+        _pages[id] = page;
+    }   // end for
+}   // end _merge
+
+
+void HelpSearchIndex::_drop( int id)
+{
+    Page &page = _pages[id];
+    for ( const QString &term : page.terms)
+    {
+        auto pit = _postings.find( term);
+        if ( pit == _postings.end())
+            continue;
+        QVector<Posting> &posts = pit.value();
+        posts.erase( std::remove_if( posts.begin(), posts.end(), [id]( const Posting &p){ return p.page == id;}), posts.end());
+        if ( posts.isEmpty())
+            _postings.erase( pit);
+    }   // end for
+
+    _pageIds.remove( page.ref);
+    _totalLength -= page.length;
+    if ( !page.file.isEmpty())
+        _modified = true;
+    page.ref.clear();
+    page.title.clear();
+    page.file.clear();
+    page.terms.clear();
+    page.live = false;
+    _freeIds.append( id);
+}   // end _drop
+
+
+QVector<HelpSearchIndex::Hit> HelpSearchIndex::search( const QString &query, int maxHits) const
+{
+    QVector<Hit> hits;
+    const QVector<QueryTerm> qterms = _parseQuery( query);
+    if ( qterms.isEmpty() || maxHits <= 0)
+        return hits;
+
+    QReadLocker locker( &_lock);
+    const int npages = _pageIds.size();
+    if ( npages == 0)
+        return hits;
+
+    // The positions of each query term in each page it's in.
+    std::vector<QHash<qint32, QVector<qint32>>> found( size_t(qterms.size()));
+    for ( int i = 0; i < qterms.size(); ++i)
+    {
+        const QueryTerm &qt = qterms.at(i);
+        QHash<qint32, QVector<qint32>> &tpos = found[size_t(i)];
+        if ( qt.prefix)
+        {
+            int nexpanded = 0;
+            for ( auto it = _postings.lowerBound( qt.word); it != _postings.constEnd() && it.key().startsWith( qt.word)
+                                                            && nexpanded < MAX_PREFIX_TERMS; ++it, ++nexpanded)
+                for ( const Posting &p : it.value())
+                    tpos[p.page] += p.positions;
+            for ( QVector<qint32> &pos : tpos)
+                std::sort( pos.begin(), pos.end());
+        }   // end if
+        else
+        {
+            for ( const Posting &p : _postings.value( qt.word))
+                tpos.insert( p.page, p.positions);
+        }   // end else
+
+        if ( tpos.isEmpty())    // All terms are needed
+            return hits;
+    }   // end for
+
+    // Candidates are the pages of the rarest term that have all the other terms.
+    size_t rarest = 0;
+    for ( size_t i = 1; i < found.size(); ++i)
+        if ( found[i].size() < found[rarest].size())
+            rarest = i;
+
+    const double avgLength = std::max( 1.0, double(_totalLength) / npages);
+    for ( auto cit = found[rarest].constBegin(); cit != found[rarest].constEnd(); ++cit)
+    {
+        const qint32 id = cit.key();
+        bool ok = true;
+        for ( size_t i = 0; ok && i < found.size(); ++i)
+            ok = found[i].contains( id);
+
+        // Check the words of each phrase appear consecutively.
+        for ( int i = 0; ok && i < qterms.size(); ++i)
+        {
+            const int phrase = qterms.at(i).phrase;
+            if ( phrase < 0 || (i > 0 && qterms.at(i-1).phrase == phrase))
+                continue;
+            int plen = 1;
+            while ( i + plen < qterms.size() && qterms.at(i + plen).phrase == phrase)
+                plen++;
+            ok = false;
+            for ( qint32 p : found[size_t(i)].value( id))
+            {
+                ok = true;
+                for ( int k = 1; ok && k < plen; ++k)
+                    ok = _contains( found[size_t(i + k)].value( id), p + k);
+                if ( ok)
+                    break;
+            }   // end for
+        }   // end for
+
+        if ( !ok)
+            continue;
+
+        // Okapi BM25 with a boost for terms in the title.
+        const Page &page = _pages.at( id);
+        double score = 0;
+        for ( size_t i = 0; i < found.size(); ++i)
+        {
+            const QVector<qint32> &pos = found[i].value( id);
+            const double df = found[i].size();
+            const double idf = std::log( 1.0 + (npages - df + 0.5) / (df + 0.5));
+            const double tf = pos.size();
+            score += idf * tf * (BM25_K1 + 1) / (tf + BM25_K1 * (1 - BM25_B + BM25_B * page.length / avgLength));
+            if ( pos.first() < page.titleLength)
+                score += idf;
+        }   // end for
+
+        hits.append( Hit{page.ref, page.title.isEmpty() ? page.ref : page.title, score});
+    }   // end for
+
+    std::sort( hits.begin(), hits.end(), []( const Hit &h0, const Hit &h1){
+            return h0.score > h1.score || (h0.score == h1.score && h0.title < h1.title);});
+    if ( hits.size() > maxHits)
+        hits.resize( maxHits);
+    return hits;
+}   // end search
+
+
+bool HelpSearchIndex::_load()
+{
+    QFile file( _cacheFile);
+    if ( !file.open( QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in( &file);
+    in.setVersion( QDataStream::Qt_5_12);
+    quint32 magic, version, npages, nterms;
+    in >> magic >> version >> npages;
+    if ( in.status() != QDataStream::Ok || magic != CACHE_MAGIC || version != CACHE_VERSION)
+        return false;
+
+    QVector<Page> pages( int(npages));
+    QHash<QString, int> pageIds;
+    qint64 totalLength = 0;
+    for ( int i = 0; i < pages.size() && in.status() == QDataStream::Ok; ++i)
+    {
+        Page &page = pages[i];
+        in >> page.ref >> page.title >> page.file >> page.size >> page.mtime >> page.length >> page.titleLength;
+        page.live = true;
+        pageIds.insert( page.ref, i);
+        totalLength += page.length;
+    }   // end for
+
+    QMap<QString, QVector<Posting>> postings;
+    in >> nterms;
+    for ( quint32 i = 0; i < nterms && in.status() == QDataStream::Ok; ++i)
+    {
+        QString term;
+        quint32 nposts;
+        in >> term >> nposts;
+        QVector<Posting> &posts = postings[term];
+        posts.resize( int(nposts));
+        for ( Posting &p : posts)
+        {
+            in >> p.page >> p.positions;
+            if ( p.page < 0 || p.page >= pages.size())
+                in.setStatus( QDataStream::ReadCorruptData);
+            else
+                pages[p.page].terms.append( term);
+        }   // end for
+    }   // end for
+
+    if ( in.status() != QDataStream::Ok)
+    {
+        std::cerr << "[WARNING] QTools::HelpSearchIndex::load: Corrupt index file " << _cacheFile.toStdString() << std::endl;
+        return false;
+    }   // end if
+
+    QWriteLocker locker( &_lock);
+    _pages = pages;
+    _freeIds.clear();
+    _pageIds = pageIds;
+    _postings = postings;
+    _totalLength = totalLength;
+    _modified = false;
+    return true;
+}   // end _load
+
+
+bool HelpSearchIndex::save()
+{
+    if ( _cacheFile.isEmpty())
+        return false;
+
+    // Serialise under the read lock so searching isn't blocked and write the file after.
+    // Cleared of modification first so changes made after unlocking are saved next time.
+    QByteArray data;
+    {
+        QReadLocker locker( &_lock);
+        _modified = false;
+
+        // Only pages read from files are saved (with their IDs made contiguous).
+        QVector<int> newIds( _pages.size(), -1);
+        int npages = 0;
+        for ( int i = 0; i < _pages.size(); ++i)
+            if ( _pages.at(i).live && !_pages.at(i).file.isEmpty())
+                newIds[i] = npages++;
+
+        QDataStream out( &data, QIODevice::WriteOnly);
+        out.setVersion( QDataStream::Qt_5_12);
+        out << CACHE_MAGIC << CACHE_VERSION << quint32(npages);
+        for ( int i = 0; i < _pages.size(); ++i)
+        {
+            const Page &page = _pages.at(i);
+            if ( newIds.at(i) >= 0)
+                out << page.ref << page.title << page.file << page.size << page.mtime << page.length << page.titleLength;
+        }   // end for
+
+        // Only terms with saved postings are written so count them first.
+        quint32 nterms = 0;
+        for ( const QVector<Posting> &posts : _postings)
+            if ( std::any_of( posts.begin(), posts.end(), [&]( const Posting &p){ return newIds.at(p.page) >= 0;}))
+                nterms++;
+
+        out << nterms;
+        for ( auto it = _postings.constBegin(); it != _postings.constEnd(); ++it)
+        {
+            const QVector<Posting> &posts = it.value();
+            const quint32 nposts = quint32( std::count_if( posts.begin(), posts.end(), [&]( const Posting &p){ return newIds.at(p.page) >= 0;}));
+            if ( nposts == 0)
+                continue;
+            out << it.key() << nposts;
+            for ( const Posting &p : posts)
+                if ( newIds.at(p.page) >= 0)
+                    out << qint32(newIds.at(p.page)) << p.positions;
+        }   // end for
+    }   // end scope
+
+    QDir().mkpath( QFileInfo( _cacheFile).absolutePath());
+    QSaveFile file( _cacheFile);
+    if ( !file.open( QIODevice::WriteOnly) || file.write( data) != data.size() || !file.commit())
+    {
+        std::cerr << "[WARNING] QTools::HelpSearchIndex::save: Unable to write " << _cacheFile.toStdString() << std::endl;
+        _modified = true;
+        return false;
+    }   // end if
+
+    return true;
+}   // end save
@@ -0,0 +1,493 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#include <NameMatcher.h>
+#include <algorithm>
+#include <bitset>
+#include <map>
+using QTools::NameMatcher;
+
+
+namespace {
+
+const size_t MAX_DFA_STATES = 4096;
+const uint MAX_SET_CHARS = 256;     // Most non-ASCII characters in a compiled set
+
+typedef std::bitset<256> ByteSet;
+
+ByteSet _range( int lo, int hi)
+{
+    ByteSet bytes;
+    for ( int i = lo; i <= hi; ++i)
+        bytes.set( size_t(i));
+    return bytes;
+}   // end _range
+
+const ByteSet ANY_BYTE = _range( 0, 255);
+const ByteSet ASCII_BYTES = _range( 0, 0x7f);
+const ByteSet CONT_BYTES = _range( 0x80, 0xbf);     // UTF-8 continuation bytes
+const ByteSet LEAD_BYTES = _range( 0xc0, 0xff);     // UTF-8 multi-byte lead bytes
+const ByteSet CHAR_START = ASCII_BYTES | LEAD_BYTES;
+
+
+// Nondeterministic automaton built from the patterns (without epsilon transitions).
+struct Nfa
+{
+    struct Edge
+    {
+        ByteSet bytes;
+        int to;
+    };  // end struct
+
+    std::vector<std::vector<Edge>> edges;
+    std::vector<bool> accept;
+
+    int add()
+    {
+        edges.emplace_back();
+        accept.push_back( false);
+        return int(edges.size()) - 1;
+    }   // end add
+
+    void link( int from, const ByteSet &bytes, int to) { edges[size_t(from)].push_back( {bytes, to});}
+};  // end struct
+
+
+int _utf8( uint cp, unsigned char *b)
+{
+    if ( cp < 0x80)
+    {
+        b[0] = (unsigned char)cp;
+        return 1;
+    }   // end if
+    if ( cp < 0x800)
+    {
+        b[0] = (unsigned char)(0xc0 | (cp >> 6));
+        b[1] = (unsigned char)(0x80 | (cp & 0x3f));
+        return 2;
+    }   // end if
+    if ( cp < 0x10000)
+    {
+        b[0] = (unsigned char)(0xe0 | (cp >> 12));
+        b[1] = (unsigned char)(0x80 | ((cp >> 6) & 0x3f));
+        b[2] = (unsigned char)(0x80 | (cp & 0x3f));
+        return 3;
+    }   // end if
+    b[0] = (unsigned char)(0xf0 | (cp >> 18));
+    b[1] = (unsigned char)(0x80 | ((cp >> 12) & 0x3f));
+    b[2] = (unsigned char)(0x80 | ((cp >> 6) & 0x3f));
+    b[3] = (unsigned char)(0x80 | (cp & 0x3f));
+    return 4;
+}   // end _utf8
+
+
+void _addCaseVariants( uint cp, bool ci, std::vector<uint> &cps)
+{
+    cps.push_back( cp);
+    if ( ci)
+    {
+        const uint lc = QChar::toLower( cp);
+        const uint uc = QChar::toUpper( cp);
+        if ( lc != cp)
+            cps.push_back( lc);
+        if ( uc != cp && uc != lc)
+            cps.push_back( uc);
+    }   // end if
+}   // end _addCaseVariants
+
+
+// Link from -> to by any of the given characters (with their single byte encodings
+// collected into a single transition and multi-byte encodings as chains of states).
+void _linkChars( Nfa &nfa, int from, int to, const std::vector<uint> &cps, ByteSet single=ByteSet())
+{
+    for ( uint cp : cps)
+    {
+        unsigned char b[4];
+        const int n = _utf8( cp, b);
+        if ( n == 1)
+        {
+            single.set( b[0]);
+            continue;
+        }   // end if
+
+        int s = from;
+        for ( int k = 0; k < n-1; ++k)
+        {
+            const int t = nfa.add();
+            nfa.link( s, ByteSet().set( b[k]), t);
+            s = t;
+        }   // end for
+        nfa.link( s, ByteSet().set( b[n-1]), to);
+    }   // end for
+
+    if ( single.any())
+        nfa.link( from, single, to);
+}   // end _linkChars
+
+
+// Parse the set starting at i (just after the opening bracket) into ranges setting i to
+// just after the closing bracket. Returns false (and leaves i) if the set isn't closed.
+bool _parseSet( const QVector<uint> &cps, int &i, bool &neg, std::vector<std::pair<uint, uint>> &ranges)
+{
+    const int n = cps.size();
+    int j = i;
+    neg = j < n && (cps[j] == '!' || cps[j] == '^');
+    if ( neg)
+        j++;
+
+    bool first = true;  // A closing bracket first in the set is part of it
+    while ( j < n && (first || cps[j] != ']'))
+    {
+        uint lo = cps[j++];
+        uint hi = lo;
+        if ( j+1 < n && cps[j] == '-' && cps[j+1] != ']')
+        {
+            hi = cps[j+1];
+            j += 2;
+        }   // end if
+        if ( lo <= hi)
+            ranges.push_back( {lo, hi});
+        first = false;
+    }   // end while
+
+    if ( j >= n)
+        return false;
+    i = j + 1;
+    return true;
+}   // end _parseSet
+
+
+// Add the pattern's states to the automaton starting from the given state.
+// Returns false if the pattern can't be compiled.
+bool _addPattern( Nfa &nfa, int start, const QVector<uint> &cps, bool ci)
+{
+    int cur = start;
+    int i = 0;
+    while ( i < cps.size())
+    {
+        const uint c = cps[i++];
+        if ( c == '*')
+        {
+            nfa.link( cur, ANY_BYTE, cur);
+            continue;
+        }   // end if
+
+        const int next = nfa.add();
+        bool neg = false;
+        std::vector<std::pair<uint, uint>> ranges;
+        if ( c == '?')
+        {
+            nfa.link( cur, CHAR_START, next);
+            nfa.link( next, CONT_BYTES, next);  // Rest of a multi-byte character
+        }   // end if
+        else if ( c == '[' && _parseSet( cps, i, neg, ranges))
+        {
+            ByteSet ascii;
+            std::vector<uint> others;
+            for ( const std::pair<uint, uint> &r : ranges)
+            {
+                for ( uint cp = r.first; cp <= std::min<uint>( r.second, 0x7f); ++cp)
+                {
+                    std::vector<uint> variants;
+                    _addCaseVariants( cp, ci, variants);
+                    for ( uint v : variants)
+                        if ( v < 0x80)
+                            ascii.set( v);
+                }   // end for
+
+                if ( r.second >= 0x80)
+                {
+                    const uint lo = std::max<uint>( r.first, 0x80);
+                    if ( neg || r.second - lo >= MAX_SET_CHARS || others.size() > MAX_SET_CHARS)
+                        return false;
+                    for ( uint cp = lo; cp <= r.second; ++cp)
+                        _addCaseVariants( cp, ci, others);
+                }   // end if
+            }   // end for
+
+            if ( neg)
+            {
+                nfa.link( cur, (ASCII_BYTES & ~ascii) | LEAD_BYTES, next);
+                nfa.link( next, CONT_BYTES, next);
+            }   // end if
+            else
+                _linkChars( nfa, cur, next, others, ascii);
+        }   // end else if
+        else
+        {
+            std::vector<uint> variants;
+            _addCaseVariants( c, ci, variants);
+            _linkChars( nfa, cur, next, variants);
+        }   // end else
+        cur = next;
+    }   // end while
+
+    nfa.accept[size_t(cur)] = true;
+    return true;
+}   // end _addPattern
+
+
+bool _isExtPattern( const QString &p)
+{
+    if ( !p.startsWith("*."))
+        return false;
+    for ( int i = 1; i < p.size(); ++i)
+    {
+        const ushort c = p[i].unicode();
+        if ( c >= 0x80 || c == '*' || c == '?' || c == '[')
+            return false;
+    }   // end for
+    return true;
+}   // end _isExtPattern
+
+
+inline unsigned char _lower( unsigned char c) { return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;}
+
+}   // end namespace
+
+
+NameMatcher::NameMatcher( const QStringList &patterns, Qt::CaseSensitivity cs)
+    : _patterns(patterns), _cs(cs), _all(false), _nclasses(0)
+{
+    std::vector<QString> others;
+    for ( const QString &p : patterns)
+    {
+        if ( p == "*")
+            _all = true;
+        else if ( _isExtPattern( p))
+        {
+            std::string ext = p.mid(1).toStdString();
+            if ( cs == Qt::CaseInsensitive)
+                std::transform( ext.begin(), ext.end(), ext.begin(), _lower);
+            _exts.push_back( ext);
+        }   // end else if
+        else
+            others.push_back( p);
+    }   // end for
+
+    if ( !_all && !others.empty())
+        _compile( others);
+}   // end ctor
+
+
+void NameMatcher::_compile( const std::vector<QString> &patterns)
+{
+    const bool ci = _cs == Qt::CaseInsensitive;
+    Nfa nfa;
+    std::vector<int> starts;
+    std::vector<QString> compiled;
+    for ( const QString &p : patterns)
+    {
+        const int start = nfa.add();
+        if ( _addPattern( nfa, start, p.toUcs4(), ci))
+        {
+            starts.push_back( start);
+            compiled.push_back( p);
+        }   // end if
+        else
+            _slow.emplace_back( QRegularExpression::wildcardToRegularExpression( p),
+                                ci ? QRegularExpression::CaseInsensitiveOption : QRegularExpression::NoPatternOption);
+    }   // end for
+
+    if ( starts.empty())
+        return;
+
+    // Partition bytes into classes that no transition distinguishes between.
+    std::fill( _classes, _classes + 256, 0);
+    _nclasses = 1;
+    for ( const std::vector<Nfa::Edge> &edges : nfa.edges)
+    {
+        for ( const Nfa::Edge &e : edges)
+        {
+            int remap[512];
+            std::fill( remap, remap + 512, -1);
+            int n = 0;
+            for ( int b = 0; b < 256; ++b)
+            {
+                int &k = remap[_classes[b] * 2 + (e.bytes[size_t(b)] ? 1 : 0)];
+                if ( k < 0)
+                    k = n++;
+                _classes[b] = (unsigned char)k;
+            }   // end for
+            _nclasses = n;
+        }   // end for
+    }   // end for
+
+    std::vector<unsigned char> reps( static_cast<size_t>(_nclasses));
+    for ( int b = 255; b >= 0; --b)
+        reps[_classes[b]] = (unsigned char)b;
+
+    // Subset construction.
+    std::map<std::vector<int>, int> ids;
+    std::vector<std::vector<int>> sets;
+    std::sort( starts.begin(), starts.end());
+    ids[starts] = 0;
+    sets.push_back( starts);
+    for ( size_t d = 0; d < sets.size(); ++d)
+    {
+        const std::vector<int> dset = sets[d];
+        bool accept = false;
+        for ( int s : dset)
+            accept |= nfa.accept[size_t(s)];
+        _accept.push_back( accept ? 1 : 0);
+
+        for ( int c = 0; c < _nclasses; ++c)
+        {
+            std::vector<int> to;
+            for ( int s : dset)
+                for ( const Nfa::Edge &e : nfa.edges[size_t(s)])
+                    if ( e.bytes[reps[size_t(c)]])
+                        to.push_back( e.to);
+
+            int id = -1;
+            if ( !to.empty())
+            {
+                std::sort( to.begin(), to.end());
+                to.erase( std::unique( to.begin(), to.end()), to.end());
+                const auto it = ids.find( to);
+                if ( it != ids.end())
+                    id = it->second;
+                else
+                {
+                    id = int(sets.size());
+                    ids[to] = id;
+                    sets.push_back( to);
+                }   // end else
+            }   // end if
+            _table.push_back( id);
+        }   // end for
+
+        if ( sets.size() > MAX_DFA_STATES)
+        {
+            for ( const QString &p : compiled)
+                _slow.emplace_back( QRegularExpression::wildcardToRegularExpression( p),
+                                    ci ? QRegularExpression::CaseInsensitiveOption : QRegularExpression::NoPatternOption);
+            _table.clear();
+            _accept.clear();
+            return;
+        }   // end if
+    }   // end for
+
+    // Accepting states that can't be left can stop matching early.
+    for ( size_t d = 0; d < _accept.size(); ++d)
+    {
+        if ( !_accept[d])
+            continue;
+        bool sink = true;
+        for ( int c = 0; c < _nclasses && sink; ++c)
+            sink = _table[d * size_t(_nclasses) + size_t(c)] == int(d);
+        if ( sink)
+            _accept[d] = 2;
+    }   // end for
+
+    if ( _accept[0] == 2 && _slow.empty())
+        _all = true;
+}   // end _compile
+
+
+bool NameMatcher::matches( const char *name, size_t len) const
+{
+    if ( _all)
+        return true;
+    if ( !_exts.empty() && _matchesExt( name, len))
+        return true;
+
+    if ( !_accept.empty())
+    {
+        int s = 0;
+        for ( size_t i = 0; i < len && s >= 0; ++i)
+        {
+            if ( _accept[size_t(s)] == 2)
+                return true;
+            s = _table[size_t(s) * size_t(_nclasses) + _classes[(unsigned char)name[i]]];
+        }   // end for
+        if ( s >= 0 && _accept[size_t(s)])
+            return true;
+    }   // end if
+
+    return !_slow.empty() && _matchesSlow( QString::fromUtf8( name, int(len)));
+}   // end matches
+
+
+bool NameMatcher::matches( const QString &name) const
+{
+    if ( _all)
+        return true;
+    for ( const std::string &ext : _exts)
+        if ( name.endsWith( QLatin1String( ext.data(), int(ext.size())), _cs))
+            return true;
+
+    if ( !_accept.empty())
+    {
+        // Encode to UTF-8 on the fly.
+        const QChar *chars = name.constData();
+        const int n = name.size();
+        int s = 0;
+        for ( int i = 0; i < n && s >= 0; ++i)
+        {
+            uint cp = chars[i].unicode();
+            if ( chars[i].isHighSurrogate() && i+1 < n && chars[i+1].isLowSurrogate())
+            {
+                cp = QChar::surrogateToUcs4( chars[i], chars[i+1]);
+                i++;
+            }   // end if
+            unsigned char b[4];
+            const int nb = _utf8( cp, b);
+            for ( int k = 0; k < nb && s >= 0; ++k)
+            {
+                if ( _accept[size_t(s)] == 2)
+                    return true;
+                s = _table[size_t(s) * size_t(_nclasses) + _classes[b[k]]];
+            }   // end for
+        }   // end for
+        if ( s >= 0 && _accept[size_t(s)])
+            return true;
+    }   // end if
+
+    return _matchesSlow( name);
+}   // end matches
+
+
+bool NameMatcher::_matchesExt( const char *name, size_t len) const
+{
+    const bool ci = _cs == Qt::CaseInsensitive;
+    for ( const std::string &ext : _exts)
+    {
+        if ( ext.size() > len)
+            continue;
+        const char *tail = name + (len - ext.size());
+        size_t i = 0;
+        if ( ci)
+            while ( i < ext.size() && _lower( (unsigned char)tail[i]) == (unsigned char)ext[i])
+                ++i;
+        else
+            while ( i < ext.size() && tail[i] == ext[i])
+                ++i;
+        if ( i == ext.size())
+            return true;
+    }   // end for
+    return false;
+}   // end _matchesExt
+
+
+bool NameMatcher::_matchesSlow( const QString &name) const
+{
+    for ( const QRegularExpression &re : _slow)
+        if ( re.match( name).hasMatch())
+            return true;
+    return false;
+}   // end _matchesSlow
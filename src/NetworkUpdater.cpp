@@ -19,21 +19,44 @@
 #include <QTools/AppUpdater.h>
 //#include <QNetworkConfigurationManager>
 #include <QNetworkReply>
-#include <QDataStream>
+#include <QJsonDocument>
 #include <QFileInfo>
+#include <algorithm>
 #include <iostream>
 using QTools::NetworkUpdater;
 
+namespace {
+// Milliseconds between refills of the download rate token bucket.
+static const int THROTTLE_TICK_MSECS = 50;
+// Most ticks' worth of tokens the bucket holds to make up for late ticks.
+static const int THROTTLE_BURST_TICKS = 4;
+}   // end namespace
+
 
 NetworkUpdater::NetworkUpdater( const QUrl &url, int tmsecs, int mr)
-    : _manifestUrl(url), _transferTimeout(tmsecs), _maxRedirects(mr), _nman(nullptr), _isManifest(false)
+    : _manifestUrl(url), _transferTimeout(tmsecs), _maxRedirects(mr), _nman(nullptr),
+      _isManifest(false), _paused(false), _maxRate(0), _mtokens(0)
 {
     _nman = new QNetworkAccessManager(this);
+    _throttleTimer = new QTimer(this);
+    _throttleTimer->setInterval( THROTTLE_TICK_MSECS);
+    connect( _throttleTimer, &QTimer::timeout, this, &NetworkUpdater::_doOnThrottleTick);
     connect( &_updater, &AppUpdater::onFinished, this, &NetworkUpdater::_doOnFinishedUpdating);
 }   // end ctor
 
 
-bool NetworkUpdater::isBusy() const { return !_nconns.isEmpty() || _updater.isRunning();}
+bool NetworkUpdater::isBusy() const { return _isDownloading() || _updater.isRunning();}
+
+
+bool NetworkUpdater::_isDownloading() const
+{
+    if ( _paused)
+        return true;
+    for ( const Download &dl : _dloads)
+        if ( dl.reply)
+            return true;
+    return false;
+}   // end _isDownloading
 
 
 bool NetworkUpdater::refreshManifest( int mj, int mn, int pt)
@@ -54,10 +77,10 @@ bool NetworkUpdater::refreshManifest( int mj, int mn, int pt)
 
     _plist.setCurrentVersion( mj, mn, pt);  // Can't be set lower
     _resetDownloads();
+    _metrics.reset();
+    _metrics.startPhase( "manifest");
     _isManifest = true;
-    _nconns.push_back( _startConnection( _manifestUrl, false/*don't emit progress updates*/));
-    _files.push_back( nullptr);  // Corresponding position of the file
-    return true;
+    return _startDownload( _manifestUrl);
 }   // end refreshManifest
 
 
@@ -70,27 +93,130 @@ QString NetworkUpdater::updateDescription() const
 }   // end updateDescription
 
 
-void NetworkUpdater::_resetDownloads()
+void NetworkUpdater::setMaxDownloadRate( qint64 bps)
+{
+    _maxRate = std::max<qint64>( 0, bps);
+    for ( const Download &dl : _dloads)
+    {
+        // A limited read buffer leaves the rest of the data waiting on the
+        // socket so the sender is paced by TCP flow control.
+        if ( dl.reply)
+            dl.reply->setReadBufferSize( _maxRate);
+    }   // end for
+
+    if ( !_isThrottled())
+    {
+        // Read everything buffered so far and complete any finished replies.
+        _throttleTimer->stop();
+        for ( Download &dl : _dloads)
+            if ( dl.reply)
+                _readData( dl, -1);
+        _processDownloads();
+    }   // end if
+    else if ( _isDownloading() && !_throttleTimer->isActive())
+    {
+        _mtokens = 0;
+        _tickClock.start();
+        _throttleTimer->start();
+    }   // end else if
+}   // end setMaxDownloadRate
+
+
+void NetworkUpdater::setBackgroundMode( bool v) { _updater.setBackgroundMode(v);}
+
+
+bool NetworkUpdater::isBackgroundMode() const { return _updater.isBackgroundMode();}
+
+
+void NetworkUpdater::setStagedMode( bool v) { _updater.setStagedMode(v);}
+
+
+bool NetworkUpdater::isStagedMode() const { return _updater.isStagedMode();}
+
+
+bool NetworkUpdater::pause()
+{
+    if ( _paused || !_isDownloading())
+        return false;
+
+    // Keep whatever is already buffered (up to the rate cap) so it isn't downloaded again.
+    _throttleTimer->stop();
+    if ( _isThrottled())
+        _readThrottled();
+    for ( Download &dl : _dloads)
+    {
+        QNetworkReply *nr = dl.reply;
+        if ( !nr)
+            continue;
+        if ( !_isThrottled())
+            _readData( dl, -1);
+        dl.finished = nr->isFinished() && nr->error() == QNetworkReply::NoError && nr->bytesAvailable() == 0;
+        dl.reply = nullptr;
+        disconnect( nr, nullptr, this, nullptr);   // Don't report the cancellation as an error
+        nr->abort();
+        nr->deleteLater();
+    }   // end for
+
+    _paused = true;
+    return true;
+}   // end pause
+
+
+bool NetworkUpdater::resume()
 {
-    for ( QTemporaryFile *tfile : _files)
+    if ( !_paused)
+        return false;
+
+    _paused = false;
+    for ( Download &dl : _dloads)
     {
-        if ( tfile)
+        if ( !dl.finished)
         {
-            tfile->remove();
-            delete tfile;
+            dl.reply = _startConnection( dl);
+            _metrics.add( "resumedTransfers");
         }   // end if
     }   // end for
-    _files.clear();
+
+    if ( _isThrottled() && _isDownloading())
+    {
+        _mtokens = 0;
+        _tickClock.start();
+        _throttleTimer->start();
+    }   // end if
+
+    // Everything may have finished before pausing.
+    if ( !_isDownloading() && !_dloads.isEmpty() && _allRepliesFinished())
+        _processDownloads();
+    return true;
+}   // end resume
+
+
+void NetworkUpdater::_resetDownloads()
+{
     _resetConnections();
+    for ( Download &dl : _dloads)
+    {
+        dl.file->remove();
+        delete dl.file;
+    }   // end for
+    _dloads.clear();
 }   // end _resetDownloads
 
 
 void NetworkUpdater::_resetConnections()
 {
     _isManifest = false;
-    for ( QNetworkReply *nr : _nconns)
-        nr->deleteLater();
-    _nconns.clear();
+    _paused = false;
+    _throttleTimer->stop();
+    for ( Download &dl : _dloads)
+    {
+        if ( dl.reply)
+        {
+            disconnect( dl.reply, nullptr, this, nullptr);
+            dl.reply->deleteLater();
+            dl.reply = nullptr;
+        }   // end if
+    }   // end for
     _nman->clearAccessCache();
     //_nman->clearConnectionCache();
     //QNetworkConfigurationManager config;
@@ -98,7 +224,37 @@ void NetworkUpdater::_resetConnections()
 }   // end _resetConnections
 
 
-QNetworkReply *NetworkUpdater::_startConnection( const QUrl &url, bool emitProgress)
+bool NetworkUpdater::_startDownload( const QUrl &url, PatchArchive::Format fmt)
+{
+    Download dl;
+    dl.url = url;
+    dl.format = fmt;
+    dl.reply = nullptr;
+    dl.file = new QTemporaryFile;
+    dl.total = -1;
+    dl.finished = false;
+    if ( !dl.file->open())
+    {
+        delete dl.file;
+        _err = tr("Unable to open temporary file to write downloaded data!");
+        _resetDownloads();
+        return false;
+    }   // end if
+
+    dl.reply = _startConnection( dl);
+    _dloads.push_back( dl);
+
+    if ( _isThrottled() && !_throttleTimer->isActive())
+    {
+        _mtokens = 0;
+        _tickClock.start();
+        _throttleTimer->start();
+    }   // end if
+    return true;
+}   // end _startDownload
+
+
+QNetworkReply *NetworkUpdater::_startConnection( const Download &dl)
 {
     QNetworkRequest nreq;
     nreq.setAttribute( QNetworkRequest::CacheSaveControlAttribute, false);   // Don't cache
@@ -106,29 +262,134 @@ QNetworkReply *NetworkUpdater::_startConnection( const QUrl &url, bool emitProgr
     nreq.setAttribute( QNetworkRequest::FollowRedirectsAttribute, _maxRedirects > 0);
     nreq.setMaximumRedirectsAllowed( _maxRedirects);
     nreq.setTransferTimeout( _transferTimeout);
-    nreq.setUrl( url);
+    nreq.setUrl( dl.url);
+
+    // Continue from the end of what's already been downloaded.
+    const qint64 offset = dl.file->size();
+    if ( offset > 0)
+        nreq.setRawHeader( "Range", QString("bytes=%1-").arg(offset).toLatin1());
+
     QNetworkReply *nr = _nman->get( nreq);
-    connect( nr, &QNetworkReply::errorOccurred, [=](){ _err = nr->errorString();});
-    connect( nr, &QNetworkReply::finished, [=](){ _doOnReplyFinished( nr);});
-    if ( emitProgress)
-        connect( nr, &QNetworkReply::downloadProgress, [=](){ _doOnDownloadProgress( nr);});
+    nr->setReadBufferSize( _maxRate);  // Unlimited if zero
+    connect( nr, &QNetworkReply::errorOccurred, this, [=](){ _err = nr->errorString();});
+    connect( nr, &QNetworkReply::metaDataChanged, this, [=](){ _doOnMetaDataChanged( nr);});
+    connect( nr, &QNetworkReply::readyRead, this, [=](){ _doOnReadyRead( nr);});
+    connect( nr, &QNetworkReply::finished, this, [=](){ _doOnReplyFinished( nr);});
     return nr;
 }   // end _startConnection
 
 
-void NetworkUpdater::_doOnDownloadProgress( QNetworkReply *nconn)
+int NetworkUpdater::_indexOf( const QNetworkReply *nr) const
+{
+    const int n = _dloads.size();
+    for ( int i = 0; i < n; ++i)
+        if ( _dloads.at(i).reply == nr)
+            return i;
+    return -1;
+}   // end _indexOf
+
+
+void NetworkUpdater::_doOnMetaDataChanged( QNetworkReply *nr)
+{
+    const int i = _indexOf( nr);
+    if ( i < 0)
+        return;
+    Download &dl = _dloads[i];
+    const int status = nr->attribute( QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if ( status != 200 && status != 206)    // Ignore redirects
+        return;
+
+    // If the server ignored the range request the whole file is being sent again.
+    if ( status == 200 && dl.file->size() > 0)
+    {
+        _metrics.add( "restartedTransfers");
+        _metrics.add( "discardedBytes", dl.file->size());
+        dl.file->resize(0);
+        dl.file->seek(0);
+    }   // end if
+
+    const qlonglong clen = nr->header( QNetworkRequest::ContentLengthHeader).toLongLong();
+    dl.total = clen > 0 ? clen + dl.file->size() : -1;
+}   // end _doOnMetaDataChanged
+
+
+qint64 NetworkUpdater::_readData( Download &dl, qint64 maxBytes)
+{
+    if ( maxBytes < 0)
+        maxBytes = dl.reply->bytesAvailable();
+    if ( maxBytes <= 0)
+        return 0;
+    const QByteArray bytes = dl.reply->read( maxBytes);
+    if ( dl.file->write( bytes) != bytes.size())
+        _err = tr("Unable to write downloaded data to file!");
+    _metrics.add( "downloadedBytes", bytes.size());
+    return bytes.size();
+}   // end _readData
+
+
+void NetworkUpdater::_doOnReadyRead( QNetworkReply *nr)
+{
+    // When throttled, data is read on the timer instead.
+    const int i = _indexOf( nr);
+    if ( i < 0 || _isThrottled())
+        return;
+    _readData( _dloads[i], -1);
+    if ( !_isManifest)
+        _doOnDownloadProgress();
+}   // end _doOnReadyRead
+
+
+bool NetworkUpdater::_readThrottled()
+{
+    // Refill the bucket keeping fractions of a byte between ticks and allowing a burst
+    // of a few ticks' worth (but at least a byte) to make up for ticks that fire late.
+    const qint64 maxTokens = std::max<qint64>( 1000, _maxRate * THROTTLE_TICK_MSECS * THROTTLE_BURST_TICKS);
+    _mtokens = std::min( _mtokens + _maxRate * _tickClock.restart(), maxTokens);
+
+    // Share the available whole bytes fairly between the connections with data waiting.
+    QList<int> waiting;
+    for ( int i = 0; i < _dloads.size(); ++i)
+        if ( _dloads.at(i).reply && _dloads.at(i).reply->bytesAvailable() > 0)
+            waiting.append(i);
+
+    const bool readData = !waiting.isEmpty();
+    qint64 tokens = _mtokens / 1000;
+    while ( tokens > 0 && !waiting.isEmpty())
+    {
+        const qint64 share = std::max<qint64>( 1, tokens / waiting.size());
+        for ( int j = waiting.size() - 1; j >= 0 && tokens > 0; --j)
+        {
+            Download &dl = _dloads[waiting.at(j)];
+            const qint64 nread = _readData( dl, std::min( share, tokens));
+            tokens -= nread;
+            _mtokens -= 1000 * nread;
+            if ( dl.reply->bytesAvailable() == 0)
+                waiting.removeAt(j);
+        }   // end for
+    }   // end while
+    return readData;
+}   // end _readThrottled
+
+
+void NetworkUpdater::_doOnThrottleTick()
+{
+    if ( _readThrottled() && !_isManifest)
+        _doOnDownloadProgress();
+    _processDownloads();
+}   // end _doOnThrottleTick
+
+
+void NetworkUpdater::_doOnDownloadProgress()
 {
     qint64 totalBytes = 0;
     qint64 bytesRecv = 0;
-    for ( const QNetworkReply *nr : _nconns)
+    for ( const Download &dl : _dloads)
     {
-        bytesRecv += nr->bytesAvailable();
-        const qlonglong tbs = nr->header( QNetworkRequest::ContentLengthHeader).toLongLong();
-
-        if ( tbs <= 0)
+        bytesRecv += dl.file->size();
+        if ( dl.total <= 0)
             totalBytes = -1;
         if ( totalBytes >= 0)
-            totalBytes += tbs;
+            totalBytes += dl.total;
     }   // end for
     double pcnt = -1;
     if ( totalBytes > 0)
@@ -137,53 +398,77 @@ void NetworkUpdater::_doOnDownloadProgress( QNetworkReply *nconn)
 }   // end _doOnDownloadProgress
 
 
-bool NetworkUpdater::_writeDataToFile( QNetworkReply *nconn)
+bool NetworkUpdater::_allRepliesFinished() const
+{
+    for ( const Download &dl : _dloads)
+        if ( !dl.finished)
+            return false;
+    return true;
+}   // end _allRepliesFinished
+
+
+void NetworkUpdater::_doOnReplyFinished( QNetworkReply *nconn)
 {
-    QTemporaryFile *tfile = new QTemporaryFile;
-    if ( !tfile->open())
+    const int i = _indexOf( nconn);
+    if ( i < 0)
+        return;
+
+    // If throttled, the timer calls back here once the buffered data are read.
+    if ( _isThrottled() && _err.isEmpty() && nconn->error() == QNetworkReply::NoError && nconn->bytesAvailable() > 0)
+        return;
+
+    Download &dl = _dloads[i];
+    if ( _err.isEmpty())
+        _readData( dl, -1);
+    dl.finished = _err.isEmpty() && nconn->error() == QNetworkReply::NoError;
+    dl.reply = nullptr;
+    disconnect( nconn, nullptr, this, nullptr);
+    nconn->deleteLater();
+
+    if ( !dl.finished)
     {
-        delete tfile;
-        _err = tr("Unable to open temporary file to write downloaded data!");
+        if ( _err.isEmpty())
+            _err = tr("Unable to connect to resource!");
+        _metrics.endPhase();
+        _metrics.add( "networkErrors");
+        _resetDownloads();
+        emit onError(_err);
     }   // end if
     else
+        _processDownloads();
+}   // end _doOnReplyFinished
+
+
+void NetworkUpdater::_processDownloads()
+{
+    // Complete any replies that finished with all their data now read.
+    for ( const Download &dl : _dloads)
     {
-        _files[_nconns.indexOf(nconn)] = tfile; // Set the file at the ordered position
-        QFile file( tfile->fileName());
-        if ( file.open( QIODevice::WriteOnly))
+        if ( dl.reply && dl.reply->isFinished() && dl.reply->bytesAvailable() == 0)
         {
-            QDataStream out( &file);
-            const QByteArray bytes = nconn->readAll();
-            if ( out.writeRawData( bytes.constData(), bytes.size()) < 0)
-                _err = tr("Unable to write downloaded data to file!");
+            _doOnReplyFinished( dl.reply);
+            return; // Called back into from _doOnReplyFinished
         }   // end if
-    }   // end else
-
-    return _err.isEmpty();
-}   // end _writeDataToFile
-
+    }   // end for
 
-bool NetworkUpdater::_allRepliesFinished() const
-{
-    for ( const QNetworkReply *nr : _nconns)
-        if ( !nr->isFinished())
-            return false;
-    return true;
-}   // end _allRepliesFinished
+    if ( _paused || _dloads.isEmpty() || !_allRepliesFinished())
+        return;
 
+    _metrics.endPhase();
+    bool ok = _err.isEmpty();
+    for ( Download &dl : _dloads)
+    {
+        ok &= dl.file->size() > 0 && dl.file->flush();
+        if ( !ok)
+            break;
+    }   // end for
 
-void NetworkUpdater::_doOnReplyFinished( QNetworkReply *nconn)
-{
-    bool ok = _err.isEmpty() && nconn->bytesAvailable() > 0;
     if ( ok)
     {
         if ( _isManifest)
         {
-            ok = _writeDataToFile( nconn);
-            if ( ok)
-            {
-                ok = _plist.parse( _files.first()->fileName());
-                _err = _plist.error();  // Will be empty if ok
-            }   // end if
+            ok = _plist.parse( _dloads.first().file->fileName());
+            _err = _plist.error();  // Will be empty if ok
             _resetDownloads();
             if (ok)
             {
@@ -191,17 +476,12 @@ void NetworkUpdater::_doOnReplyFinished( QNetworkReply *nconn)
                 emit onRefreshedManifest();
             }   // end else
         }   // end if
-        else if ( _allRepliesFinished())
+        else
         {
-            for ( QNetworkReply *nc : _nconns)
-                ok |= _writeDataToFile( nc);
             _resetConnections();
-            if ( ok)
-            {
-                emit onFinishedDownloading();
-                _startAppUpdater();
-            }   // end if
-        }   // end else if
+            emit onFinishedDownloading();
+            _startAppUpdater();
+        }   // end else
     }   // end if
 
     if ( !ok)
@@ -211,15 +491,12 @@ void NetworkUpdater::_doOnReplyFinished( QNetworkReply *nconn)
         _resetDownloads();
         emit onError(_err);
     }   // end if
-}   // end _doOnReplyFinished
+}   // end _processDownloads
 
 
 bool NetworkUpdater::_allUpdatesDownloaded() const
 {
-    for ( QTemporaryFile *tfile : _files)
-        if ( !tfile)
-            return false;
-    return !_files.isEmpty();
+    return !_dloads.isEmpty() && _allRepliesFinished();
 }   // end _allUpdatesDownloaded
 
 
@@ -238,14 +515,15 @@ bool NetworkUpdater::updateApp()
     }   // end if
 
     _resetDownloads();
+    _metrics.startPhase( "download");
 
     // Otherwise we have to download all the updates first and start the updater later.
     const QList<QUrl> urls = _plist.patchURLs();
-    for ( const QUrl &url : urls)
-    {
-        _nconns.push_back( _startConnection( url, true/*emit progress updates*/));
-        _files.push_back( nullptr);  // Corresponding position of the file
-    }   // end for
+    const QList<PatchArchive::Format> fmts = _plist.patchFormats();
+    _metrics.add( "downloads", urls.size());
+    for ( int i = 0; i < urls.size(); ++i)
+        if ( !_startDownload( urls.at(i), fmts.at(i)))
+            return false;
     return true;
 }   // end updateApp
 
@@ -266,21 +544,37 @@ bool NetworkUpdater::_startAppUpdater()
 
     // Collect the downloaded temporary patch archives into a string list
     QStringList fnames;
-    for ( const QTemporaryFile *file : _files)
-        fnames.append( file->fileName());
+    QList<PatchArchive::Format> fmts;
+    for ( const Download &dl : _dloads)
+    {
+        fnames.append( dl.file->fileName());
+        fmts.append( dl.format);
+    }   // end for
 
     // Files to remove (specified only from the latest patch!)
     const QStringList &rfiles = _plist.highestVersion().files().rfiles();
 
     // Run the update in a separate thread.
-    _updater.update( fnames, rfiles);
+    _updater.update( fnames, rfiles, fmts);
 
     return true;
 }   // end _startAppUpdater
 
 
+QJsonObject NetworkUpdater::metricsReport() const
+{
+    QJsonObject report;
+    report["network"] = _metrics.toJson();
+    report["updater"] = _updater.metrics().toJson();
+    return report;
+}   // end metricsReport
+
+
 void NetworkUpdater::_doOnFinishedUpdating( const QString &err)
 {
+    // The updater logs its own metrics.
+    const QByteArray json = QJsonDocument( _metrics.toJson()).toJson( QJsonDocument::Compact);
+    std::cerr << "[INFO] QTools::NetworkUpdater: Metrics " << json.toStdString() << std::endl;
     _resetDownloads();
     if ( !err.isEmpty())
         emit onError( err);
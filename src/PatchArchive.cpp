@@ -0,0 +1,560 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#include <PatchArchive.h>
+#include <quazip/JlCompress.h>
+#include <zstd.h>
+#include <QThreadPool>
+#include <QThread>
+#include <QFile>
+#include <QDir>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <vector>
+using QTools::PatchArchive::Format;
+
+namespace {
+
+static const std::string WRNSTR = "[WARNING] QTools::PatchArchive: ";
+
+// Skippable frames (e.g. the seek table of the seekable format) have magic numbers 0x184D2A5?
+static const unsigned int SKIPPABLE_MAGIC = 0x184D2A50;
+static const unsigned int SKIPPABLE_MASK = 0xFFFFFFF0;
+
+
+// Frames of at most this (declared) size in archives of many frames are decompressed whole in
+// parallel. Anything else (including the single frame that zstd writes by default) is streamed.
+static const unsigned long long MAX_BATCH_FRAME_SIZE = 32 << 20;
+
+
+struct Frame
+{
+    const uchar *src;
+    size_t srcSize;
+    bool skip;      // Skippable frame
+    bool batch;     // Decompressed whole as part of a parallel batch
+    QByteArray data;
+    bool ok;
+};  // end struct
+
+
+bool _isSkippableFrame( const uchar *src)
+{
+    const unsigned int magic = unsigned(src[0]) | (unsigned(src[1]) << 8) | (unsigned(src[2]) << 16) | (unsigned(src[3]) << 24);
+    return (magic & SKIPPABLE_MASK) == SKIPPABLE_MAGIC;
+}   // end _isSkippableFrame
+
+
+// Decompress a frame of known size no larger than MAX_BATCH_FRAME_SIZE in one go.
+bool _decompressFrame( Frame &f)
+{
+    const unsigned long long csize = ZSTD_getFrameContentSize( f.src, f.srcSize);
+    if ( csize == ZSTD_CONTENTSIZE_ERROR || csize == ZSTD_CONTENTSIZE_UNKNOWN || csize > MAX_BATCH_FRAME_SIZE)
+        return false;
+    f.data.resize( int(csize));
+    const size_t rv = ZSTD_decompress( f.data.data(), size_t(f.data.size()), f.src, f.srcSize);
+    return !ZSTD_isError(rv) && rv == csize;
+}   // end _decompressFrame
+
+
+// Reads a POSIX/GNU tar stream in arbitrary sized pieces writing entries beneath the given directory.
+class TarReader
+{
+public:
+    TarReader( const QString &dir, QStringList &paths)
+        : _dir(dir), _paths(paths), _remaining(0), _padding(0), _mode(0), _type(0), _end(false) {}
+
+    bool feed( const char*, qint64);
+
+    // True iff the stream ended cleanly on an entry boundary.
+    bool isComplete() const { return _remaining == 0 && _padding == 0 && _hbuf.isEmpty();}
+
+private:
+    const QString _dir;
+    QStringList &_paths;
+    QByteArray _hbuf;       // Partially read header
+    QByteArray _meta;       // Data of the current long name or pax header entry
+    QString _nextPath;      // Path given by a preceding long name or pax header entry
+    QFile _out;
+    qint64 _remaining;      // Bytes of entry data left to read
+    qint64 _padding;        // Bytes of padding left after entry data
+    qint64 _mode;
+    char _type;
+    bool _end;
+
+    bool _readHeader( const char*);
+    bool _finishEntry();
+    bool _isThroughLink( const QString&) const;
+    bool _isWithin( const QString&, const QString&) const;
+};  // end class
+
+
+qint64 _parseNumber( const char *f, int len)
+{
+    qint64 v = 0;
+    if ( uchar(f[0]) & 0x80)    // GNU base-256 encoding for large values
+    {
+        v = f[0] & 0x7f;
+        for ( int i = 1; i < len; ++i)
+            v = (v << 8) | uchar(f[i]);
+        return v;
+    }   // end if
+
+    for ( int i = 0; i < len && f[i]; ++i)
+        if ( f[i] >= '0' && f[i] <= '7')
+            v = (v << 3) | (f[i] - '0');
+    return v;
+}   // end _parseNumber
+
+
+QString _parseString( const char *f, size_t len)
+{
+    return QString::fromUtf8( f, int(strnlen( f, len)));
+}   // end _parseString
+
+
+QFileDevice::Permissions _permissions( qint64 mode)
+{
+    QFileDevice::Permissions p;
+    if ( mode & 0400) p |= QFileDevice::ReadOwner | QFileDevice::ReadUser;
+    if ( mode & 0200) p |= QFileDevice::WriteOwner | QFileDevice::WriteUser;
+    if ( mode & 0100) p |= QFileDevice::ExeOwner | QFileDevice::ExeUser;
+    if ( mode & 0040) p |= QFileDevice::ReadGroup;
+    if ( mode & 0020) p |= QFileDevice::WriteGroup;
+    if ( mode & 0010) p |= QFileDevice::ExeGroup;
+    if ( mode & 0004) p |= QFileDevice::ReadOther;
+    if ( mode & 0002) p |= QFileDevice::WriteOther;
+    if ( mode & 0001) p |= QFileDevice::ExeOther;
+    return p;
+}   // end _permissions
+
+
+// Returns the value of the path record from pax extended header data (empty if none).
+QString _paxPath( const QByteArray &pax)
+{
+    int pos = 0;
+    while ( pos < pax.size())
+    {
+        const int sp = pax.indexOf( ' ', pos);
+        if ( sp < 0)
+            break;
+        const int len = pax.mid( pos, sp - pos).toInt();
+        if ( len <= 0)
+            break;
+        const QByteArray rec = pax.mid( sp + 1, len - (sp - pos) - 2);    // Strip the length and newline
+        if ( rec.startsWith( "path="))
+            return QString::fromUtf8( rec.mid(5));
+        pos += len;
+    }   // end while
+    return "";
+}   // end _paxPath
+
+
+bool TarReader::feed( const char *data, qint64 n)
+{
+    qint64 pos = 0;
+    while ( pos < n && !_end)
+    {
+        if ( _remaining > 0)
+        {
+            const qint64 k = std::min( _remaining, n - pos);
+            if ( _out.isOpen())
+            {
+                if ( _out.write( data + pos, k) != k)
+                {
+                    std::cerr << WRNSTR << "Unable to write \"" << _out.fileName().toStdString() << "\"!" << std::endl;
+                    return false;
+                }   // end if
+            }   // end if
+            else if ( _type == 'L' || _type == 'x')
+                _meta.append( data + pos, int(k));
+            _remaining -= k;
+            pos += k;
+            if ( _remaining == 0 && !_finishEntry())
+                return false;
+        }   // end if
+        else if ( _padding > 0)
+        {
+            const qint64 k = std::min( _padding, n - pos);
+            _padding -= k;
+            pos += k;
+        }   // end else if
+        else
+        {
+            const qint64 k = std::min( qint64(512 - _hbuf.size()), n - pos);
+            _hbuf.append( data + pos, int(k));
+            pos += k;
+            if ( _hbuf.size() == 512)
+            {
+                const bool ok = _readHeader( _hbuf.constData());
+                _hbuf.clear();
+                if ( !ok)
+                    return false;
+            }   // end if
+        }   // end else
+    }   // end while
+    return true;
+}   // end feed
+
+
+bool TarReader::_readHeader( const char *h)
+{
+    // A zero block marks the end of the archive.
+    if ( std::all_of( h, h + 512, [](char c){ return c == 0;}))
+    {
+        _end = true;
+        return true;
+    }   // end if
+
+    // Checksum is calculated with the checksum field itself taken as spaces.
+    qint64 chksum = 0;
+    for ( int i = 0; i < 512; ++i)
+        chksum += (i >= 148 && i < 156) ? ' ' : uchar(h[i]);
+    if ( chksum != _parseNumber( h + 148, 8))
+    {
+        std::cerr << WRNSTR << "Bad tar header checksum!" << std::endl;
+        return false;
+    }   // end if
+
+    QString path = _nextPath;
+    _nextPath = "";
+    if ( path.isEmpty())
+    {
+        path = _parseString( h, 100);
+        const QString prefix = _parseString( h + 345, 155);
+        if ( std::memcmp( h + 257, "ustar", 5) == 0 && !prefix.isEmpty())
+            path = prefix + "/" + path;
+    }   // end if
+
+    _type = h[156];
+    _mode = _parseNumber( h + 100, 8);
+    _remaining = _parseNumber( h + 124, 12);
+    _padding = (512 - _remaining % 512) % 512;
+    _meta.clear();
+
+    // Don't allow anything to be written outside of the extraction directory.
+    path = QDir::cleanPath( path);
+    if ( path.isEmpty() || QDir::isAbsolutePath( path) || path == ".." || path.startsWith("../"))
+    {
+        std::cerr << WRNSTR << "Invalid path in tar archive: \"" << path.toStdString() << "\"!" << std::endl;
+        return false;
+    }   // end if
+
+    // Nor anything to be written through a link extracted earlier.
+    if ( _isThroughLink( path))
+    {
+        std::cerr << WRNSTR << "Path in tar archive is through a symbolic link: \"" << path.toStdString() << "\"!" << std::endl;
+        return false;
+    }   // end if
+
+    const QString fpath = _dir + "/" + path;
+    if ( _type == '0' || _type == '\0' || _type == '7')    // Regular file
+    {
+        QDir().mkpath( QFileInfo( fpath).path());
+        QFile::remove( fpath);
+        _out.setFileName( fpath);
+        if ( !_out.open( QIODevice::WriteOnly))
+        {
+            std::cerr << WRNSTR << "Unable to open \"" << fpath.toStdString() << "\" for writing!" << std::endl;
+            return false;
+        }   // end if
+    }   // end if
+    else if ( _type == '5')    // Directory
+    {
+        if ( !QDir().mkpath( fpath))
+            return false;
+        _paths.append( fpath);
+    }   // end else if
+    else if ( _type == '2')    // Symbolic link
+    {
+        // Links may only point within the extraction directory.
+        const QString target = _parseString( h + 157, 100);
+        if ( !_isWithin( path, target))
+        {
+            std::cerr << WRNSTR << "Invalid link target in tar archive: \"" << path.toStdString()
+                      << "\" -> \"" << target.toStdString() << "\"!" << std::endl;
+            return false;
+        }   // end if
+        QDir().mkpath( QFileInfo( fpath).path());
+        QFile::remove( fpath);
+        if ( !QFile::link( target, fpath))
+            std::cerr << WRNSTR << "Unable to create link \"" << fpath.toStdString() << "\"!" << std::endl;
+        _paths.append( fpath);
+    }   // end else if
+    // Other entry types (hard links, devices, global pax headers) are skipped.
+
+    if ( _remaining == 0)
+        return _finishEntry();
+    return true;
+}   // end _readHeader
+
+
+// Returns true if any existing directory on the given (clean relative) path is a symbolic link.
+bool TarReader::_isThroughLink( const QString &path) const
+{
+    const QStringList parts = path.split('/');
+    QString dpath = _dir;
+    for ( int i = 0; i < parts.size() - 1; ++i)
+    {
+        dpath += "/" + parts.at(i);
+        const QFileInfo finfo( dpath);
+        if ( finfo.isSymLink())
+            return true;
+        if ( !finfo.exists())   // Nothing below here exists yet
+            break;
+    }   // end for
+    return false;
+}   // end _isThroughLink
+
+
+// Returns true if the target of a link at the given path stays within the extraction directory.
+// Components are resolved in order rather than with cleanPath since ".." after an existing link
+// is relative to wherever the link points (so that's refused).
+bool TarReader::_isWithin( const QString &path, const QString &target) const
+{
+    if ( target.isEmpty() || QDir::isAbsolutePath( target))
+        return false;
+    QStringList parts = QFileInfo( path).path().split('/', Qt::SkipEmptyParts);
+    if ( parts == QStringList("."))
+        parts.clear();
+    bool afterLink = false;
+    for ( const QString &c : target.split('/', Qt::SkipEmptyParts))
+    {
+        if ( c == ".")
+            continue;
+        if ( c == "..")
+        {
+            if ( parts.isEmpty() || afterLink)
+                return false;
+            parts.removeLast();
+        }   // end if
+        else
+        {
+            parts.append( c);
+            afterLink = afterLink || QFileInfo( _dir + "/" + parts.join('/')).isSymLink();
+        }   // end else
+    }   // end for
+    return true;
+}   // end _isWithin
+
+
+bool TarReader::_finishEntry()
+{
+    bool ok = true;
+    if ( _out.isOpen())
+    {
+        _out.close();
+        ok = _out.error() == QFileDevice::NoError;
+        _out.setPermissions( _permissions( _mode));
+        _paths.append( _out.fileName());
+    }   // end if
+    else if ( _type == 'L')    // GNU long name for the next entry
+        _nextPath = QString::fromUtf8( _meta.constData(), int(strnlen( _meta.constData(), _meta.size())));
+    else if ( _type == 'x')    // Pax extended header for the next entry
+        _nextPath = _paxPath( _meta);
+    _meta.clear();
+    return ok;
+}   // end _finishEntry
+
+
+// Decompress the given frame in fixed size chunks feeding each to the tar reader as it's produced.
+bool _streamFrame( const Frame &f, TarReader &tar)
+{
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    if ( !dctx)
+        return false;
+    ZSTD_inBuffer in = { f.src, f.srcSize, 0};
+    std::vector<char> buf( ZSTD_DStreamOutSize());
+    bool ok = false;
+    while ( true)
+    {
+        ZSTD_outBuffer out = { buf.data(), buf.size(), 0};
+        const size_t rv = ZSTD_decompressStream( dctx, &out, &in);
+        if ( ZSTD_isError(rv))
+        {
+            std::cerr << WRNSTR << "Failed to decompress Zstandard frame: " << ZSTD_getErrorName( rv) << std::endl;
+            break;
+        }   // end if
+        if ( out.pos > 0 && !tar.feed( buf.data(), qint64(out.pos)))
+            break;
+        if ( rv == 0)   // End of frame
+        {
+            ok = true;
+            break;
+        }   // end if
+        // Input exhausted with the frame incomplete and no more output pending
+        if ( in.pos == in.size && out.pos < out.size)
+        {
+            std::cerr << WRNSTR << "Truncated Zstandard frame!" << std::endl;
+            break;
+        }   // end if
+    }   // end while
+    ZSTD_freeDCtx( dctx);
+    return ok;
+}   // end _streamFrame
+
+
+bool _extractTarZstd( const QString &archive, const QString &dir, QStringList &paths)
+{
+    QFile file( archive);
+    if ( !file.open( QIODevice::ReadOnly))
+        return false;
+    const size_t total = size_t( file.size());
+    const uchar *src = file.map( 0, file.size());
+    if ( !src)
+        return false;
+
+    // Find the frame boundaries from the frame headers without decompressing.
+    std::vector<Frame> frames;
+    size_t nData = 0;
+    size_t pos = 0;
+    while ( pos < total)
+    {
+        const size_t fsize = ZSTD_findFrameCompressedSize( src + pos, total - pos);
+        if ( ZSTD_isError( fsize))
+        {
+            std::cerr << WRNSTR << "Corrupt Zstandard frame: " << ZSTD_getErrorName( fsize) << std::endl;
+            return false;
+        }   // end if
+        const bool skip = _isSkippableFrame( src + pos);
+        if ( !skip)
+            nData++;
+        frames.push_back( {src + pos, fsize, skip, false, QByteArray(), false});
+        pos += fsize;
+    }   // end while
+
+    // Only archives of many frames are decompressed in parallel and then only the frames that
+    // declare a bounded size. The rest are streamed so memory use doesn't scale with the archive.
+    if ( nData > 1)
+    {
+        for ( Frame &f : frames)
+        {
+            if ( f.skip)
+                continue;
+            const unsigned long long csize = ZSTD_getFrameContentSize( f.src, f.srcSize);
+            f.batch = csize != ZSTD_CONTENTSIZE_ERROR && csize != ZSTD_CONTENTSIZE_UNKNOWN && csize <= MAX_BATCH_FRAME_SIZE;
+        }   // end for
+    }   // end if
+
+    // Consecutive batchable frames are decompressed in parallel in batches of up to the ideal thread
+    // count and each batch is fed to the tar reader in order before the next is started.
+    TarReader tar( dir, paths);
+    const size_t nframes = frames.size();
+    const size_t batchSize = size_t( std::max( 1, QThread::idealThreadCount()));
+    QThreadPool pool;
+    size_t i = 0;
+    while ( i < nframes)
+    {
+        if ( frames[i].skip)
+        {
+            i++;
+            continue;
+        }   // end if
+
+        if ( !frames[i].batch)
+        {
+            if ( !_streamFrame( frames[i], tar))
+                return false;
+            i++;
+            continue;
+        }   // end if
+
+        size_t j = i;
+        while ( j < nframes && j - i < batchSize && (frames[j].batch || frames[j].skip))
+        {
+            Frame *f = &frames[j++];
+            if ( f->batch)
+                pool.start( QRunnable::create( [f](){ f->ok = _decompressFrame( *f);}));
+        }   // end while
+        pool.waitForDone();
+
+        for ( ; i < j; ++i)
+        {
+            Frame &f = frames[i];
+            if ( f.skip)
+                continue;
+            if ( !f.ok)
+            {
+                std::cerr << WRNSTR << "Failed to decompress Zstandard frame!" << std::endl;
+                return false;
+            }   // end if
+            if ( !tar.feed( f.data.constData(), f.data.size()))
+                return false;
+            f.data = QByteArray();
+        }   // end for
+    }   // end while
+
+    return tar.isComplete();
+}   // end _extractTarZstd
+
+}   // end namespace
+
+
+Format QTools::PatchArchive::formatFromName( const QString &nm)
+{
+    const QString lnm = nm.trimmed().toLower();
+    if ( lnm == "zip" || lnm.endsWith(".zip"))
+        return Format::Zip;
+    if ( lnm == "tar.zst" || lnm == "tzst" || lnm.endsWith(".tar.zst") || lnm.endsWith(".tzst"))
+        return Format::TarZstd;
+    return Format::Unknown;
+}   // end formatFromName
+
+
+Format QTools::PatchArchive::formatOfFile( const QString &fname)
+{
+    QFile file( fname);
+    if ( !file.open( QIODevice::ReadOnly))
+        return Format::Unknown;
+    const QByteArray magic = file.read(4);
+    if ( magic == QByteArray( "PK\x03\x04", 4) || magic == QByteArray( "PK\x05\x06", 4))
+        return Format::Zip;
+    if ( magic == QByteArray( "\x28\xB5\x2F\xFD", 4))
+        return Format::TarZstd;
+    return Format::Unknown;
+}   // end formatOfFile
+
+
+QStringList QTools::PatchArchive::extract( const QString &archive, const QString &dir, Format expected)
+{
+    QStringList paths;
+    const Format fmt = formatOfFile( archive);
+    if ( expected != Format::Unknown && fmt != expected)
+    {
+        std::cerr << WRNSTR << "\"" << archive.toStdString() << "\" is not in the declared format!" << std::endl;
+        return paths;
+    }   // end if
+
+    switch ( fmt)
+    {
+        case Format::Zip:
+            paths = JlCompress::extractDir( archive, dir);
+            break;
+        case Format::TarZstd:
+            if ( !QDir().mkpath( dir) || !_extractTarZstd( archive, dir, paths))
+            {
+                std::cerr << WRNSTR << "Failed to extract \"" << archive.toStdString() << "\"!" << std::endl;
+                paths.clear();
+            }   // end if
+            break;
+        default:
+            std::cerr << WRNSTR << "Unrecognised format for \"" << archive.toStdString() << "\"!" << std::endl;
+            break;
+    }   // end switch
+    return paths;
+}   // end extract
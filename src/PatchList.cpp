@@ -17,7 +17,6 @@
 
 #include <QTools/PatchList.h>
 #include <rlib/StringUtil.h>
-#include <quazip/JlCompress.h>
 #include <boost/property_tree/xml_parser.hpp>
 #include <QTemporaryDir>
 #include <QFile>
@@ -81,11 +80,20 @@ QList<QUrl> PatchList::patchURLs() const
 }   // end patchURLs
 
 
+QList<PatchArchive::Format> PatchList::patchFormats() const
+{
+    QList<PatchArchive::Format> fmts;
+    for ( const PatchMeta &pm : _patches)
+        fmts.push_back( pm.files().archiveFormat());
+    return fmts;
+}   // end patchFormats
+
+
 namespace {
-std::string extractFile( const QString &zipfile)
+std::string extractFile( const QString &archive)
 {
     QTemporaryDir extractDir;
-    QStringList flst = JlCompress::extractDir( zipfile, extractDir.path());
+    QStringList flst = QTools::PatchArchive::extract( archive, extractDir.path());
     const QString xmlpath = flst.size() == 1 ?  flst.first() : "";
 
     if ( xmlpath.isEmpty() || !xmlpath.endsWith(".xml"))
@@ -346,6 +354,22 @@ bool PatchList::_parsePatchFiles( PatchMeta &meta, const PTree &pnode)
         return false;
     }   // end if
 
+    // The archive format is given explicitly or by the archive's extension. If neither, it's zip.
+    boost::optional<std::string> fmtstr = pnode.get_optional<std::string>("Archive.<xmlattr>.format");
+    PatchArchive::Format fmt = PatchArchive::formatFromName( pfiles.archive());
+    if ( fmtstr)
+    {
+        fmt = PatchArchive::formatFromName( QString::fromStdString( rlib::trim( (const std::string)(*fmtstr))));
+        if ( fmt == PatchArchive::Format::Unknown)
+        {
+            _err = "Unsupported Archive format in Platform!";
+            return false;
+        }   // end if
+    }   // end if
+    else if ( fmt == PatchArchive::Format::Unknown)
+        fmt = PatchArchive::Format::Zip;
+    pfiles.setArchiveFormat( fmt);
+
     const PTree &mnode = pnode.get_child("Modify");
     for ( const PTree::value_type &fval : mnode)
     {
@@ -385,7 +409,7 @@ bool PatchList::_parsePatchFiles( PatchMeta &meta, const PTree &pnode)
 /************ PatchFiles *************/
 /*************************************/
 
-PatchFiles::PatchFiles() {}
+PatchFiles::PatchFiles() : _format(PatchArchive::Format::Zip) {}
 
 
 bool PatchFiles::setArchive( const QString &v)
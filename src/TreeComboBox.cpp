@@ -18,16 +18,255 @@
 #include <TreeComboBox.h>
 #include <QTreeView>
 #include <QMouseEvent>
+#include <QKeyEvent>
+#include <QToolTip>
+#include <QTimer>
+#include <QHash>
+#include <algorithm>
+#include <iterator>
 using QTools::TreeComboBox;
 
 
-TreeComboBox::TreeComboBox( QWidget* prnt) : QComboBox(prnt), _skipNextHide(false)
+// The items of the model in depth first order with an index of the trigrams of their
+// (lower cased) text. A query is narrowed from the matches of the last query when it
+// extends it (as when typing) and otherwise from the items having all its trigrams.
+class TreeComboBox::FilterIndex
+{
+public:
+    struct Node
+    {
+        QModelIndex idx;    // Column 0
+        int parent;         // -1 for top level items
+        QString text;
+        bool hidden;        // Hidden in the view by the filter
+    };  // end struct
+
+    FilterIndex( const QAbstractItemModel *model, int col)
+    {
+        struct Todo { QModelIndex idx; int parent;};
+        QVector<Todo> stack;
+        for ( int r = model->rowCount() - 1; r >= 0; --r)
+            stack.append( Todo{ model->index( r, 0), -1});
+        while ( !stack.isEmpty())
+        {
+            const Todo todo = stack.takeLast();
+            const int id = nodes.size();
+            _add( todo.idx, todo.parent, model->index( todo.idx.row(), col, todo.idx.parent()).data().toString().toLower());
+            // Children are pushed in reverse so they're visited in row order.
+            for ( int r = model->rowCount( todo.idx) - 1; r >= 0; --r)
+                stack.append( Todo{ model->index( r, 0, todo.idx), id});
+        }   // end while
+    }   // end ctor
+
+    QVector<Node> nodes;
+
+    // Return the ids of the nodes whose text contains the (lower case) query in order.
+    const QVector<int> &match( const QString &query)
+    {
+        QVector<int> cands;
+        const bool narrow = !_lastQuery.isEmpty() && query.startsWith( _lastQuery);
+        if ( narrow)
+            cands = _matches;
+        else if ( query.size() >= 3)
+            cands = _withTrigrams( query);
+
+        QVector<int> matches;
+        if ( narrow || query.size() >= 3)
+        {
+            for ( int i : cands)
+                if ( nodes.at(i).text.contains( query))
+                    matches.append(i);
+        }   // end if
+        else
+        {
+            for ( int i = 0; i < nodes.size(); ++i)
+                if ( nodes.at(i).text.contains( query))
+                    matches.append(i);
+        }   // end else
+
+        _lastQuery = query;
+        _matches = matches;
+        return _matches;
+    }   // end match
+
+private:
+    QHash<quint64, QVector<int> > _trigrams;
+    QString _lastQuery;
+    QVector<int> _matches;
+
+    static quint64 _trigram( const QString &s, int i)
+    {
+        return quint64( s.at(i).unicode()) << 32 | quint64( s.at(i+1).unicode()) << 16 | quint64( s.at(i+2).unicode());
+    }   // end _trigram
+
+    void _add( const QModelIndex &idx, int parent, const QString &text)
+    {
+        const int id = nodes.size();
+        nodes.append( Node{ idx, parent, text, false});
+        for ( int i = 0; i + 3 <= text.size(); ++i)
+        {
+            QVector<int> &ids = _trigrams[_trigram( text, i)];
+            if ( ids.isEmpty() || ids.last() != id)
+                ids.append( id);
+        }   // end for
+    }   // end _add
+
+    // The nodes having all the trigrams of the query (intersecting the shortest lists first).
+    QVector<int> _withTrigrams( const QString &query) const
+    {
+        QVector<const QVector<int>*> lists;
+        for ( int i = 0; i + 3 <= query.size(); ++i)
+        {
+            const auto it = _trigrams.constFind( _trigram( query, i));
+            if ( it == _trigrams.constEnd())
+                return QVector<int>();
+            lists.append( &it.value());
+        }   // end for
+        std::sort( lists.begin(), lists.end(), []( const QVector<int> *a, const QVector<int> *b){ return a->size() < b->size();});
+
+        QVector<int> ids = *lists.first();
+        for ( int i = 1; i < lists.size() && !ids.isEmpty(); ++i)
+        {
+            QVector<int> common;
+            std::set_intersection( ids.begin(), ids.end(), lists.at(i)->begin(), lists.at(i)->end(), std::back_inserter( common));
+            ids.swap( common);
+        }   // end for
+        return ids;
+    }   // end _withTrigrams
+};  // end class
+
+
+TreeComboBox::TreeComboBox( QWidget* prnt)
+    : QComboBox(prnt), _skipNextHide(false), _findex(nullptr), _reapplyQueued(false)
 {
     setView( new QTreeView(this));
     view()->viewport()->installEventFilter(this);
+    view()->installEventFilter(this);
 }   // end ctor
 
 
+TreeComboBox::~TreeComboBox() { delete _findex;}
+
+
+void TreeComboBox::setFilterText( const QString &txt)
+{
+    if ( txt == _filter)
+        return;
+    _filter = txt;
+    _applyFilter();
+    if ( _filter.isEmpty())
+        QToolTip::hideText();
+    else if ( view()->isVisible())
+        QToolTip::showText( view()->mapToGlobal( QPoint( 0, 0)), _filter, view());
+}   // end setFilterText
+
+
+void TreeComboBox::_applyFilter()
+{
+    _reapplyQueued = false;
+    if ( !_findex && _filter.isEmpty())
+        return;
+
+    if ( _fmodel != model())  // Setting a model on the view unhides all of its rows
+    {
+        delete _findex;
+        _findex = nullptr;
+        for ( const QMetaObject::Connection &conn : _fconns)
+            disconnect( conn);
+        _fconns.clear();
+        _fmodel = model();
+        // The index is dropped (with the view's rows unhidden) before the model changes.
+        if ( _fmodel)
+        {
+            for ( const auto sig : {&QAbstractItemModel::rowsAboutToBeInserted, &QAbstractItemModel::rowsAboutToBeRemoved,
+                                    &QAbstractItemModel::columnsAboutToBeInserted, &QAbstractItemModel::columnsAboutToBeRemoved})
+                _fconns.append( connect( _fmodel.data(), sig, this, &TreeComboBox::_doOnModelChanging));
+            _fconns.append( connect( _fmodel.data(), &QAbstractItemModel::rowsAboutToBeMoved, this, &TreeComboBox::_doOnModelChanging));
+            _fconns.append( connect( _fmodel.data(), &QAbstractItemModel::modelAboutToBeReset, this, &TreeComboBox::_doOnModelChanging));
+            _fconns.append( connect( _fmodel.data(), &QAbstractItemModel::layoutAboutToBeChanged, this, &TreeComboBox::_doOnModelChanging));
+            _fconns.append( connect( _fmodel.data(), &QAbstractItemModel::dataChanged, this, &TreeComboBox::_doOnModelChanging));
+        }   // end if
+    }   // end if
+
+    if ( _filter.isEmpty() || !_fmodel)
+    {
+        _unhideAll();
+        return;
+    }   // end if
+
+    if ( !_findex)
+        _findex = new FilterIndex( _fmodel, modelColumn());
+
+    QTreeView *tview = static_cast<QTreeView*>(view());
+    QVector<FilterIndex::Node> &nodes = _findex->nodes;
+    const QString query = _filter.toLower();
+    const QVector<int> &matches = _findex->match( query);
+
+    // Matches and their ancestors are shown and the ancestors expanded.
+    QVector<char> shown( nodes.size(), 0);
+    int best = -1;
+    for ( int m : matches)
+    {
+        if ( best < 0 || ( nodes.at(m).text.startsWith( query) && !nodes.at(best).text.startsWith( query)))
+            best = m;
+        shown[m] = 1;
+        for ( int p = nodes.at(m).parent; p >= 0 && shown.at(p) != 2; p = nodes.at(p).parent)
+        {
+            shown[p] = 2;
+            tview->expand( nodes.at(p).idx);
+        }   // end for
+    }   // end for
+
+    // Only the topmost of the items not shown need hiding and only changes are made.
+    for ( int i = 0; i < nodes.size(); ++i)
+    {
+        FilterIndex::Node &node = nodes[i];
+        const bool hide = !shown.at(i) && (node.parent < 0 || shown.at(node.parent));
+        if ( hide != node.hidden)
+        {
+            tview->setRowHidden( node.idx.row(), node.idx.parent(), hide);
+            node.hidden = hide;
+        }   // end if
+    }   // end for
+
+    if ( best >= 0)
+    {
+        const QModelIndex idx = nodes.at(best).idx;
+        tview->setCurrentIndex( idx.sibling( idx.row(), modelColumn()));
+    }   // end if
+}   // end _applyFilter
+
+
+void TreeComboBox::_unhideAll()
+{
+    if ( !_findex)
+        return;
+    QTreeView *tview = static_cast<QTreeView*>(view());
+    for ( FilterIndex::Node &node : _findex->nodes)
+    {
+        if ( node.hidden)
+        {
+            tview->setRowHidden( node.idx.row(), node.idx.parent(), false);
+            node.hidden = false;
+        }   // end if
+    }   // end for
+}   // end _unhideAll
+
+
+void TreeComboBox::_doOnModelChanging()
+{
+    _unhideAll();
+    delete _findex;
+    _findex = nullptr;
+    // Filter again (rebuilding the index) once the model has changed.
+    if ( !_filter.isEmpty() && !_reapplyQueued)
+    {
+        _reapplyQueued = true;
+        QTimer::singleShot( 0, this, [this](){ _applyFilter();});
+    }   // end if
+}   // end _doOnModelChanging
+
+
 bool TreeComboBox::eventFilter( QObject* obj, QEvent* ev)
 {
     if ( ev->type() == QEvent::MouseButtonPress && obj == view()->viewport())
@@ -37,6 +276,27 @@ bool TreeComboBox::eventFilter( QObject* obj, QEvent* ev)
         if ( !view()->visualRect(idx).contains(mev->pos()))
             _skipNextHide = true;
     }   // end if
+    else if ( ev->type() == QEvent::KeyPress && obj == view())
+    {
+        // Typing filters the items rather than jumping between them.
+        const QKeyEvent* kev = static_cast<QKeyEvent*>(ev);
+        const QString txt = kev->text();
+        if ( kev->key() == Qt::Key_Backspace && !_filter.isEmpty())
+        {
+            setFilterText( _filter.left( _filter.size() - 1));
+            return true;
+        }   // end if
+        if ( kev->key() == Qt::Key_Escape && !_filter.isEmpty())
+        {
+            setFilterText( "");
+            return true;
+        }   // end if
+        if ( !txt.isEmpty() && txt.at(0).isPrint() && !(kev->modifiers() & (Qt::ControlModifier | Qt::AltModifier)))
+        {
+            setFilterText( _filter + txt);
+            return true;
+        }   // end if
+    }   // end else if
     return false;
 }   // end eventFilter
 
@@ -55,5 +315,8 @@ void TreeComboBox::hidePopup()
     if ( _skipNextHide)
         _skipNextHide = false;
     else
+    {
+        setFilterText( "");
         QComboBox::hidePopup();
+    }   // end else
 }   // end hidePopup
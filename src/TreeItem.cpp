@@ -16,11 +16,101 @@
  ************************************************************************/
 
 #include <TreeItem.h>
+#include <TreeModel.h>
+#include <atomic>
+#include <new>
 using QTools::TreeItem;
 
+namespace {
+
+// TreeItems are carved out of blocks aligned to their size so an item's block is found from its
+// address. Each thread hands out slots in order from its own current block without locking and
+// slots aren't reused. A block is freed as soon as all of its items are deleted (from any thread)
+// and it's no longer a thread's current block, so a long lived tree only keeps the blocks holding
+// its own items.
+const size_t BLOCK_BYTES = 1 << 16;
+
+struct Block
+{
+    std::atomic<size_t> refs;   // Slots not yet freed plus one while a thread's current block
+};  // end struct
+
+const size_t FIRST_SLOT = (sizeof(Block) + alignof(TreeItem) - 1) / alignof(TreeItem) * alignof(TreeItem);
+const size_t NSLOTS = (BLOCK_BYTES - FIRST_SLOT) / sizeof(TreeItem);
+
+
+void _unref( Block *block, size_t n)
+{
+    if ( block->refs.fetch_sub( n, std::memory_order_acq_rel) == n)
+    {
+        block->~Block();
+        qFreeAligned( block);
+    }   // end if
+}   // end _unref
+
+
+Block* _blockOf( void *p) { return reinterpret_cast<Block*>( reinterpret_cast<quintptr>(p) & ~quintptr(BLOCK_BYTES - 1));}
+
+
+// The block the calling thread is allocating from.
+class CurrentBlock
+{
+public:
+    CurrentBlock() : _block(nullptr), _next(0) {}
+    ~CurrentBlock() { _retire();}
+
+    void* allocate()
+    {
+        if ( !_block || _next == NSLOTS)
+        {
+            _retire();
+            void *mem = qMallocAligned( BLOCK_BYTES, BLOCK_BYTES);
+            if ( !mem)
+                throw std::bad_alloc();
+            _block = new (mem) Block;
+            _block->refs = NSLOTS + 1;  // All slots are counted up front so allocating needs no atomics
+            _next = 0;
+        }   // end if
+        return reinterpret_cast<char*>(_block) + FIRST_SLOT + sizeof(TreeItem) * _next++;
+    }   // end allocate
+
+private:
+    Block *_block;
+    size_t _next;
+
+    // Drop the references for the slots not handed out and for being current.
+    void _retire()
+    {
+        if ( _block)
+            _unref( _block, NSLOTS - _next + 1);
+        _block = nullptr;
+    }   // end _retire
+};  // end class
+
+thread_local CurrentBlock _currentBlock;
+
+}   // end namespace
+
+
+void* TreeItem::operator new( size_t sz)
+{
+    return sz == sizeof(TreeItem) ? _currentBlock.allocate() : ::operator new(sz);
+}   // end operator new
+
+
+void TreeItem::operator delete( void *p, size_t sz)
+{
+    if ( !p)
+        return;
+    if ( sz == sizeof(TreeItem))
+        _unref( _blockOf(p), 1);
+    else
+        ::operator delete(p);
+}   // end operator delete
+
 
 TreeItem::TreeItem( const QVector<QVariant>& data, TreeItem *prnt)
-    : _data(data), _parent(nullptr)
+    : _data( data.cbegin(), data.cend()), _parent(nullptr), _model(nullptr), _row(0), _canFetch(false)
 {
     if ( prnt)
     {
@@ -40,9 +130,15 @@ void TreeItem::appendChild( TreeItem *item)
 {
     if ( item)
     {
+        item->_row = _children.size();
         _children.append(item);
-        _rowHash[item] = _children.size() - 1;
         item->_parent = this;
+
+        const TreeItem *root = this;
+        while ( root->_parent)
+            root = root->_parent;
+        if ( root->_model)
+            root->_model->_addToIndexes( item);
     }   // end if
 }   // end appendChild
 
@@ -61,13 +157,13 @@ int TreeItem::childCount() const { return _children.count();}
 
 int TreeItem::row() const
 {
-    return _parent ? _parent->_children.indexOf(const_cast<TreeItem*>(this)) : 0;
+    return _parent ? _row : 0;
 }   // end row
 
 
 int TreeItem::childRow( const TreeItem* item) const
 {
-    return _rowHash.count(item) > 0 ? _rowHash.at(item) : -1;
+    return item && item->_parent == this ? item->_row : -1;
 }   // end childRow
 
 
@@ -78,3 +174,36 @@ QVariant TreeItem::data( int col) const
 {
     return col >= 0 && col < _data.size() ? _data.at(col) : QVariant();
 }   // end data
+
+
+void TreeItem::_insertChildren( int row, const QVector<TreeItem*>& items)
+{
+    _children.insert( row, items.size(), nullptr);
+    for ( int i = 0; i < items.size(); ++i)
+    {
+        _children[row+i] = items.at(i);
+        items.at(i)->_parent = this;
+    }   // end for
+    _renumber( row);
+}   // end _insertChildren
+
+
+QVector<TreeItem*> TreeItem::_takeChildren( int row, int count)
+{
+    const QVector<TreeItem*> items = _children.mid( row, count);
+    _children.remove( row, count);
+    for ( TreeItem *item : items)
+    {
+        item->_parent = nullptr;
+        item->_row = 0;
+    }   // end for
+    _renumber( row);
+    return items;
+}   // end _takeChildren
+
+
+void TreeItem::_renumber( int from)
+{
+    for ( int i = from; i < _children.size(); ++i)
+        _children.at(i)->_row = i;
+}   // end _renumber
@@ -16,16 +16,43 @@
  ************************************************************************/
 
 #include <TreeModel.h>
+#include <QTimer>
+#include <algorithm>
 #include <cassert>
 using QTools::TreeModel;
 using QTools::TreeItem;
 
+namespace {
 
-TreeModel::TreeModel( QObject *prnt) : QAbstractItemModel(prnt), _rootItem(nullptr) {}
+// The rows of the item and its ancestors from the root down.
+QVector<int> _rowPath( TreeItem *item)
+{
+    QVector<int> path;
+    for ( TreeItem *prnt = item->parent(); prnt; item = prnt, prnt = prnt->parent())
+        path.prepend( prnt->childRow( item));
+    return path;
+}   // end _rowPath
+
+
+// Returns true iff a comes before b in a depth first traversal.
+bool _precedes( TreeItem *a, TreeItem *b)
+{
+    const QVector<int> pa = _rowPath(a);
+    const QVector<int> pb = _rowPath(b);
+    return std::lexicographical_compare( pa.begin(), pa.end(), pb.begin(), pb.end());
+}   // end _precedes
+
+}   // end namespace
+
+
+TreeModel::TreeModel( QObject *prnt)
+    : QAbstractItemModel(prnt), _rootItem(nullptr),
+      _threaded(false), _batchSize(256), _lastFetch(0), _batchQueued(false) {}
 
 
 TreeModel::~TreeModel()
 {
+    _pool.waitForDone();
     if ( _rootItem)
         delete _rootItem;
 }   // end dtor
@@ -36,10 +63,116 @@ TreeItem* TreeModel::setNewRoot( const QVector<QVariant>& data)
     if ( _rootItem)
         delete _rootItem;
     _rootItem = new TreeItem( data, nullptr);
+    _rootItem->_model = this;
+    _rootItem->_canFetch = true;
+    for ( auto it = _indexes.begin(); it != _indexes.end(); ++it)
+        it->clear();
+    _addToIndexes( _rootItem);
+    _fetches.clear();   // Results for the old tree are ignored
+    _pending.clear();
     return _rootItem;
 }   // end setNewRoot
 
 
+void TreeModel::setProvider( const ChildProvider &provider, bool threaded, int batchSize)
+{
+    _provider = provider;
+    _threaded = threaded;
+    _batchSize = std::max( 1, batchSize);
+    _fetches.clear();
+    _pending.clear();
+}   // end setProvider
+
+
+bool TreeModel::hasChildren( const QModelIndex &parent) const
+{
+    if ( parent.column() > 0)
+        return false;
+    const TreeItem *item = _item( parent);
+    return item && (item->childCount() > 0 || (_provider && item->_canFetch));
+}   // end hasChildren
+
+
+bool TreeModel::canFetchMore( const QModelIndex &parent) const
+{
+    TreeItem *item = _item( parent);
+    return _provider && item && item->_canFetch && item->childCount() == 0 && !_fetches.contains( item);
+}   // end canFetchMore
+
+
+void TreeModel::fetchMore( const QModelIndex &parent)
+{
+    if ( !canFetchMore( parent))
+        return;
+
+    TreeItem *item = _item( parent);
+    const quint64 id = ++_lastFetch;
+    _fetches.insert( item, id);
+    const QVector<QVariant> data( item->_data.cbegin(), item->_data.cend());
+    if ( !_threaded)
+    {
+        _onFetched( item, id, _provider( data));
+        return;
+    }   // end if
+
+    // The item is only used back on this thread and only if it's still being fetched for.
+    const ChildProvider provider = _provider;
+    _pool.start( QRunnable::create( [this, provider, item, id, data](){
+        const QVector<LazyItem> children = provider( data);
+        QMetaObject::invokeMethod( this, [this, item, id, children](){ _onFetched( item, id, children);}, Qt::QueuedConnection);
+    }));
+}   // end fetchMore
+
+
+void TreeModel::_onFetched( TreeItem *item, quint64 id, const QVector<LazyItem> &children)
+{
+    const auto it = _fetches.constFind( item);
+    if ( it == _fetches.constEnd() || it.value() != id)    // Removed since (or the tree was replaced)
+        return;
+    _fetches.remove( item);
+    item->_canFetch = false;
+    _pending.append( {item, children, 0});
+    if ( !_batchQueued)
+        _insertBatch();
+}   // end _onFetched
+
+
+void TreeModel::_insertBatch()
+{
+    _batchQueued = false;
+    if ( _pending.isEmpty())
+        return;
+
+    Pending &p = _pending.first();
+    const int n = std::min( _batchSize, p.children.size() - p.next);
+    QVector<TreeItem*> items( n);
+    for ( int i = 0; i < n; ++i)
+    {
+        const LazyItem &lazy = p.children.at( p.next + i);
+        items[i] = new TreeItem( lazy.data);
+        items[i]->_canFetch = lazy.hasChildren;
+    }   // end for
+    p.next += n;
+
+    TreeItem *prnt = p.item;
+    if ( p.next >= p.children.size())
+        _pending.removeFirst();
+    appendItems( prnt, items);
+
+    if ( !_pending.isEmpty())
+    {
+        _batchQueued = true;
+        QTimer::singleShot( 0, this, [this](){ _insertBatch();});
+    }   // end if
+}   // end _insertBatch
+
+
+TreeItem* TreeModel::_item( const QModelIndex &idx) const
+{
+    return idx.isValid() ? static_cast<TreeItem*>(idx.internalPointer()) : _rootItem;
+}   // end _item
+
+
 QModelIndex TreeModel::index( int row, int col, const QModelIndex &parent) const
 {
     if ( !hasIndex(row, col, parent))
@@ -124,7 +257,149 @@ QModelIndex TreeModel::_find( TreeItem* item, const QVariant& data, int col) con
 }   // end _find
 
 
+QModelIndex TreeModel::indexOf( TreeItem *item) const
+{
+    if ( !item || item == _rootItem || !item->parent())
+        return QModelIndex();
+    return createIndex( item->row(), 0, item);
+}   // end indexOf
+
+
+int TreeModel::insertItems( TreeItem *prnt, int row, const QVector<TreeItem*>& items)
+{
+    assert(prnt);
+    QVector<TreeItem*> toAdd;
+    toAdd.reserve( items.size());
+    for ( TreeItem *item : items)
+        if ( item && !item->parent() && item != _rootItem)
+            toAdd.append( item);
+    if ( toAdd.isEmpty())
+        return 0;
+
+    row = std::max( 0, std::min( row, prnt->childCount()));
+    beginInsertRows( indexOf( prnt), row, row + toAdd.size() - 1);
+    prnt->_insertChildren( row, toAdd);
+    for ( TreeItem *item : toAdd)
+        _addToIndexes( item);
+    endInsertRows();
+    return toAdd.size();
+}   // end insertItems
+
+
+int TreeModel::appendItems( TreeItem *prnt, const QVector<TreeItem*>& items)
+{
+    assert(prnt);
+    return insertItems( prnt, prnt->childCount(), items);
+}   // end appendItems
+
+
+bool TreeModel::removeItems( TreeItem *prnt, int row, int count)
+{
+    assert(prnt);
+    if ( row < 0 || count <= 0 || row + count > prnt->childCount())
+        return false;
+
+    beginRemoveRows( indexOf( prnt), row, row + count - 1);
+    const QVector<TreeItem*> items = prnt->_takeChildren( row, count);
+    for ( TreeItem *item : items)
+        _removing( item);
+    endRemoveRows();
+    qDeleteAll( items);
+    return true;
+}   // end removeItems
+
+
+bool TreeModel::moveItems( TreeItem *srcPrnt, int srcRow, int count, TreeItem *dstPrnt, int dstRow)
+{
+    assert(srcPrnt);
+    assert(dstPrnt);
+    if ( srcRow < 0 || count <= 0 || srcRow + count > srcPrnt->childCount() || dstRow < 0 || dstRow > dstPrnt->childCount())
+        return false;
+
+    // Qt refuses moves into the moved rows, onto themselves or into their descendants.
+    if ( !beginMoveRows( indexOf( srcPrnt), srcRow, srcRow + count - 1, indexOf( dstPrnt), dstRow))
+        return false;
+    const QVector<TreeItem*> items = srcPrnt->_takeChildren( srcRow, count);
+    if ( srcPrnt == dstPrnt && dstRow > srcRow)
+        dstRow -= count;
+    dstPrnt->_insertChildren( dstRow, items);
+    endMoveRows();
+    return true;
+}   // end moveItems
+
+
 QModelIndex TreeModel::find( const QVariant& data, int col) const
 {
-    return _find( _rootItem, data, col);
+    if ( !_rootItem)
+        return QModelIndex();
+
+    const auto iit = _indexes.constFind( col);
+    if ( iit == _indexes.constEnd())
+        return _find( _rootItem, data, col);
+
+    // The string keys may match data of other types so check the data are equal.
+    TreeItem *found = nullptr;
+    const QMultiHash<QString, TreeItem*> &index = *iit;
+    const QString key = data.toString();
+    for ( auto it = index.constFind( key); it != index.constEnd() && it.key() == key; ++it)
+        if ( it.value()->data(col) == data && ( !found || _precedes( it.value(), found)))
+            found = it.value();
+    return found ? createIndex( found->row(), col, found) : QModelIndex();
 }   // end find
+
+
+void TreeModel::setIndexed( int col, bool enable)
+{
+    if ( !enable)
+        _indexes.remove( col);
+    else if ( !_indexes.contains( col))
+    {
+        QMultiHash<QString, TreeItem*> &index = _indexes[col];
+        if ( !_rootItem)
+            return;
+        QVector<TreeItem*> stack( 1, _rootItem);
+        while ( !stack.isEmpty())
+        {
+            TreeItem *item = stack.takeLast();
+            index.insert( item->data(col).toString(), item);
+            for ( int i = 0; i < item->childCount(); ++i)
+                stack.append( item->child(i));
+        }   // end while
+    }   // end else if
+}   // end setIndexed
+
+
+void TreeModel::_addToIndexes( TreeItem *item)
+{
+    if ( _indexes.isEmpty())
+        return;
+    // The item may be appended with descendants already.
+    QVector<TreeItem*> stack( 1, item);
+    while ( !stack.isEmpty())
+    {
+        TreeItem *titem = stack.takeLast();
+        for ( auto it = _indexes.begin(); it != _indexes.end(); ++it)
+            it->insert( titem->data( it.key()).toString(), titem);
+        for ( int i = 0; i < titem->childCount(); ++i)
+            stack.append( titem->child(i));
+    }   // end while
+}   // end _addToIndexes
+
+
+// Forget the item and its descendants which are about to be deleted.
+void TreeModel::_removing( TreeItem *item)
+{
+    if ( _indexes.isEmpty() && _fetches.isEmpty() && _pending.isEmpty())
+        return;
+    QVector<TreeItem*> stack( 1, item);
+    while ( !stack.isEmpty())
+    {
+        TreeItem *titem = stack.takeLast();
+        for ( auto it = _indexes.begin(); it != _indexes.end(); ++it)
+            it->remove( titem->data( it.key()).toString(), titem);
+        _fetches.remove( titem);
+        _pending.erase( std::remove_if( _pending.begin(), _pending.end(), [titem]( const Pending &p){ return p.item == titem;}), _pending.end());
+        for ( int i = 0; i < titem->childCount(); ++i)
+            stack.append( titem->child(i));
+    }   // end while
+}   // end _removing
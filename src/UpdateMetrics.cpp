@@ -0,0 +1,108 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#include <UpdateMetrics.h>
+#include <QMutexLocker>
+using QTools::UpdateMetrics;
+
+
+UpdateMetrics::UpdateMetrics() { _total.start();}
+
+
+void UpdateMetrics::reset()
+{
+    QMutexLocker locker( &_lock);
+    _phase = "";
+    _phases.clear();
+    _counts.clear();
+    _total.start();
+}   // end reset
+
+
+void UpdateMetrics::startPhase( const QString &nm)
+{
+    QMutexLocker locker( &_lock);
+    _endPhase();
+    _phase = nm;
+    if ( !_phases.contains( nm))
+        _phases[nm] = 0;
+    _phaseTimer.start();
+}   // end startPhase
+
+
+void UpdateMetrics::endPhase()
+{
+    QMutexLocker locker( &_lock);
+    _endPhase();
+}   // end endPhase
+
+
+void UpdateMetrics::_endPhase()
+{
+    if ( !_phase.isEmpty())
+        _phases[_phase] += _phaseTimer.elapsed();
+    _phase = "";
+}   // end _endPhase
+
+
+void UpdateMetrics::add( const QString &nm, qint64 n)
+{
+    QMutexLocker locker( &_lock);
+    _counts[nm] += n;
+}   // end add
+
+
+qint64 UpdateMetrics::count( const QString &nm) const
+{
+    QMutexLocker locker( &_lock);
+    return _counts.value( nm, 0);
+}   // end count
+
+
+qint64 UpdateMetrics::phaseMsecs( const QString &nm) const
+{
+    QMutexLocker locker( &_lock);
+    qint64 msecs = _phases.value( nm, -1);
+    if ( nm == _phase)  // Still in progress
+        msecs += _phaseTimer.elapsed();
+    return msecs;
+}   // end phaseMsecs
+
+
+qint64 UpdateMetrics::totalMsecs() const
+{
+    QMutexLocker locker( &_lock);
+    return _total.elapsed();
+}   // end totalMsecs
+
+
+QJsonObject UpdateMetrics::toJson() const
+{
+    QMutexLocker locker( &_lock);
+    QJsonObject phases;
+    for ( auto it = _phases.constBegin(); it != _phases.constEnd(); ++it)
+        phases[it.key()] = double( it.value() + (it.key() == _phase ? _phaseTimer.elapsed() : 0));
+    QJsonObject counts;
+    for ( auto it = _counts.constBegin(); it != _counts.constEnd(); ++it)
+        counts[it.key()] = double( it.value());
+
+    QJsonObject json;
+    json["totalMsecs"] = double( _total.elapsed());
+    json["phasesMsecs"] = phases;
+    json["counts"] = counts;
+    return json;
+}   // end toJson
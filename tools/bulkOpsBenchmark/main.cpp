@@ -0,0 +1,198 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+/**
+ * Benchmark of BulkFileOps. Creates many small files then times statting, copying,
+ * renaming and removing them all using io_uring (if available) and using Qt one
+ * file at a time. The two are run in alternating order over a number of rounds so
+ * that neither consistently gets the page cache warmed by the other. Reports the
+ * mean times over the rounds as JSON.
+ */
+
+#include <QTools/BulkFileOps.h>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QFile>
+#include <QDir>
+#include <algorithm>
+#include <iostream>
+namespace BulkFileOps = QTools::BulkFileOps;
+
+namespace {
+
+bool generate( const QString &dir, int nfiles, int fileSize)
+{
+    const QByteArray bytes( fileSize, 'x');
+    for ( int i = 0; i < nfiles; ++i)
+    {
+        QFile file( QString("%1/f%2").arg(dir).arg(i));
+        if ( !file.open( QIODevice::WriteOnly) || file.write( bytes) != bytes.size())
+            return false;
+    }   // end for
+    return true;
+}   // end generate
+
+
+QStringList paths( const QString &dir, const QString &prefix, int n)
+{
+    QStringList lst;
+    for ( int i = 0; i < n; ++i)
+        lst.append( QString("%1/%2%3").arg(dir).arg(prefix).arg(i));
+    return lst;
+}   // end paths
+
+
+// Time each operation over all the files returning msecs for each and whether all succeeded.
+QJsonObject timeOps( const QString &root, int nfiles, bool uring)
+{
+    BulkFileOps::setUseUring( uring);
+    const QString src = root + "/src";
+    const QString dst = root + (uring ? "/uring" : "/qt");
+    QDir().mkpath( dst);
+
+    const QStringList srcs = paths( src, "f", nfiles);
+    const QStringList copies = paths( dst, "f", nfiles);
+    const QStringList renamed = paths( dst, "r", nfiles);
+    const auto allTrue = []( const QVector<bool> &v){ return std::all_of( v.begin(), v.end(), []( bool b){ return b;});};
+
+    QJsonObject msecs;
+    bool ok = true;
+    QElapsedTimer timer;
+
+    timer.start();
+    const QVector<BulkFileOps::FileStat> stats = BulkFileOps::statFiles( srcs);
+    msecs["stat"] = double( timer.elapsed());
+    ok &= std::all_of( stats.begin(), stats.end(), []( const BulkFileOps::FileStat &s){ return s.exists;});
+
+    timer.start();
+    ok &= allTrue( BulkFileOps::copyFiles( srcs, copies));
+    msecs["copy"] = double( timer.elapsed());
+
+    timer.start();
+    ok &= allTrue( BulkFileOps::renameFiles( copies, renamed));
+    msecs["rename"] = double( timer.elapsed());
+
+    timer.start();
+    ok &= allTrue( BulkFileOps::removeFiles( renamed));
+    msecs["remove"] = double( timer.elapsed());
+
+    QJsonObject result;
+    result["msecs"] = msecs;
+    result["ok"] = ok;
+    return result;
+}   // end timeOps
+
+
+// Add the times of a run to the totals in sum.
+void accumulate( QJsonObject &sum, const QJsonObject &run)
+{
+    QJsonObject msecs = sum.value("msecs").toObject();
+    const QJsonObject rmsecs = run.value("msecs").toObject();
+    for ( auto it = rmsecs.constBegin(); it != rmsecs.constEnd(); ++it)
+        msecs[it.key()] = msecs.value( it.key()).toDouble() + it.value().toDouble();
+    sum["msecs"] = msecs;
+    sum["ok"] = sum.value("ok").toBool( true) && run.value("ok").toBool();
+}   // end accumulate
+
+
+// Divide the totals in sum by the number of rounds.
+QJsonObject mean( const QJsonObject &sum, int nrounds)
+{
+    QJsonObject msecs = sum.value("msecs").toObject();
+    for ( auto it = msecs.begin(); it != msecs.end(); ++it)
+        it.value() = it.value().toDouble() / nrounds;
+    QJsonObject result = sum;
+    result["msecs"] = msecs;
+    return result;
+}   // end mean
+
+}   // end namespace
+
+
+int main( int argc, char *argv[])
+{
+    QCoreApplication app( argc, argv);
+    QCoreApplication::setApplicationName( "bulkOpsBenchmark");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription( "Times bulk file operations with and without io_uring.");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"files", "Number of files.", "n", "20000"},
+        {"size", "Size of each file in bytes.", "bytes", "4096"},
+        {"depth", "io_uring queue depth.", "n", "64"},
+        {"rounds", "Number of rounds (the order of Qt and io_uring alternates each round).", "n", "4"},
+        {"dir", "Directory to work in (a temporary directory if not given).", "path"},
+        {"out", "Write the JSON report to this file instead of stdout.", "file"}});
+    parser.process( app);
+
+    const int nfiles = std::max( 1, parser.value("files").toInt());
+    const int fileSize = std::max( 0, parser.value("size").toInt());
+    const int nrounds = std::max( 1, parser.value("rounds").toInt());
+    BulkFileOps::setQueueDepth( parser.value("depth").toInt());
+
+    QTemporaryDir tmp( parser.isSet("dir") ? parser.value("dir") + "/bulkOpsBenchmark-XXXXXX"
+                                           : QDir::tempPath() + "/bulkOpsBenchmark-XXXXXX");
+    if ( !tmp.isValid() || !QDir().mkpath( tmp.path() + "/src") || !generate( tmp.path() + "/src", nfiles, fileSize))
+    {
+        std::cerr << "Unable to create the files!" << std::endl;
+        return EXIT_FAILURE;
+    }   // end if
+
+    QJsonObject config;
+    config["files"] = nfiles;
+    config["fileSize"] = fileSize;
+    config["queueDepth"] = BulkFileOps::queueDepth();
+    config["rounds"] = nrounds;
+
+    QJsonObject report;
+    report["config"] = config;
+    report["uringAvailable"] = BulkFileOps::isUringAvailable();
+
+    const bool uring = BulkFileOps::isUringAvailable();
+    QJsonObject qtSum, uringSum;
+    for ( int r = 0; r < nrounds; ++r)
+    {
+        if ( uring && r % 2 == 1)
+            accumulate( uringSum, timeOps( tmp.path(), nfiles, true));
+        accumulate( qtSum, timeOps( tmp.path(), nfiles, false));
+        if ( uring && r % 2 == 0)
+            accumulate( uringSum, timeOps( tmp.path(), nfiles, true));
+    }   // end for
+    report["qt"] = mean( qtSum, nrounds);
+    if ( uring)
+        report["uring"] = mean( uringSum, nrounds);
+
+    const QByteArray json = QJsonDocument( report).toJson( QJsonDocument::Indented);
+    if ( parser.isSet("out"))
+    {
+        QFile file( parser.value("out"));
+        if ( !file.open( QIODevice::WriteOnly) || file.write( json) != json.size())
+        {
+            std::cerr << "Unable to write report!" << std::endl;
+            return EXIT_FAILURE;
+        }   // end if
+    }   // end if
+    else
+        std::cout << json.toStdString();
+
+    return EXIT_SUCCESS;
+}   // end main
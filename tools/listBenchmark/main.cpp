@@ -0,0 +1,253 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+/**
+ * Benchmark of file discovery. Generates a synthetic tree (or uses an existing one) and
+ * times FileIO::recursivelyListFiles against a serial QDir listing using the same name
+ * filters, then times NameMatcher against QDir::match and QRegularExpression over a
+ * large set of names. Reports the results as JSON.
+ */
+
+#include <QTools/NameMatcher.h>
+#include <QTools/FileIO.h>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QRandomGenerator>
+#include <QRegularExpression>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QFile>
+#include <QDir>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+using QTools::NameMatcher;
+
+namespace {
+
+const char *EXTS[] = {"cpp", "h", "hpp", "txt", "png", "json", "md", "CPP", "o", "py"};
+const int NEXTS = sizeof(EXTS) / sizeof(EXTS[0]);
+
+
+std::string randomName()
+{
+    QRandomGenerator *rng = QRandomGenerator::global();
+    std::string nm;
+    const int len = 4 + rng->bounded(16);
+    for ( int i = 0; i < len; ++i)
+        nm += char('a' + rng->bounded(26));
+    if ( rng->bounded(20) == 0)   // Some names with more than one dot
+        nm += ".tmp";
+    nm += ".";
+    nm += EXTS[rng->bounded( NEXTS)];
+    return nm;
+}   // end randomName
+
+
+// Creates nfiles empty files spread over directories of perDir files nested two deep.
+bool generate( const QString &root, int nfiles, int perDir)
+{
+    for ( int i = 0; i < nfiles; ++i)
+    {
+        const int d = i / perDir;
+        const QString dpath = QString("%1/d%2/d%3").arg(root).arg( d / 32).arg(d);
+        if ( i % perDir == 0 && !QDir().mkpath( dpath))
+            return false;
+        QFile file( dpath + "/" + QString::fromStdString( randomName()));
+        if ( !file.open( QIODevice::WriteOnly))
+            return false;
+    }   // end for
+    return true;
+}   // end generate
+
+
+// The serial QDir listing that FileIO used before file discovery was reworked.
+void qdirListFiles( const QDir &dir, const QStringList &nameFilters, QFileInfoList &files)
+{
+    for ( const QFileInfo &finfo : dir.entryInfoList( nameFilters, QDir::Files | QDir::Readable))
+        files.append( finfo);
+    for ( const QFileInfo &finfo : dir.entryInfoList( QDir::AllDirs | QDir::NoDotAndDotDot | QDir::Readable))
+        qdirListFiles( QDir( finfo.filePath()), nameFilters, files);
+}   // end qdirListFiles
+
+
+// Returns the least milliseconds taken by fn over the given number of repeats.
+template <typename F>
+qint64 timeBest( int repeats, F &&fn)
+{
+    qint64 best = -1;
+    for ( int i = 0; i < repeats; ++i)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        fn();
+        const qint64 msecs = timer.elapsed();
+        if ( best < 0 || msecs < best)
+            best = msecs;
+    }   // end for
+    return best;
+}   // end timeBest
+
+
+QJsonObject timeListing( const QDir &root, const QStringList &filters, int nthreads, int repeats)
+{
+    int nqdir = 0, nserial = 0, nparallel = 0;
+    const qint64 qdirMsecs = timeBest( repeats, [&](){
+        QFileInfoList files;
+        qdirListFiles( root, filters, files);
+        nqdir = files.size();
+    });
+    const qint64 serialMsecs = timeBest( repeats, [&](){ nserial = QTools::FileIO::recursivelyListFiles( root, filters, 1).size();});
+    const qint64 parallelMsecs = timeBest( repeats, [&](){ nparallel = QTools::FileIO::recursivelyListFiles( root, filters, nthreads).size();});
+
+    QJsonObject msecs;
+    msecs["qdir"] = double( qdirMsecs);
+    msecs["recursivelyListFiles1"] = double( serialMsecs);
+    msecs["recursivelyListFiles"] = double( parallelMsecs);
+
+    QJsonObject result;
+    result["msecs"] = msecs;
+    result["found"] = nqdir;
+    result["countsAgree"] = nqdir == nserial && nqdir == nparallel;
+    return result;
+}   // end timeListing
+
+
+QJsonObject timeMatching( const QStringList &filters, int nnames, int repeats)
+{
+    std::vector<std::string> names( size_t(std::max( 1, nnames)));
+    for ( std::string &nm : names)
+        nm = randomName();
+
+    std::vector<QRegularExpression> regexes;
+    for ( const QString &f : filters)
+        regexes.emplace_back( QRegularExpression::wildcardToRegularExpression( f), QRegularExpression::CaseInsensitiveOption);
+    const NameMatcher matcher( filters);
+
+    // Names are converted to QString as part of the QDir and regular expression
+    // timings since that's what discovery using them needs to do for each entry.
+    int nqdir = 0, nregex = 0, nmatcher = 0;
+    const qint64 qdirMsecs = timeBest( repeats, [&](){
+        nqdir = 0;
+        for ( const std::string &nm : names)
+            nqdir += QDir::match( filters, QString::fromUtf8( nm.data(), int(nm.size()))) ? 1 : 0;
+    });
+    const qint64 regexMsecs = timeBest( repeats, [&](){
+        nregex = 0;
+        for ( const std::string &nm : names)
+        {
+            const QString qnm = QString::fromUtf8( nm.data(), int(nm.size()));
+            nregex += std::any_of( regexes.begin(), regexes.end(), [&]( const QRegularExpression &re){ return re.match( qnm).hasMatch();}) ? 1 : 0;
+        }   // end for
+    });
+    const qint64 matcherMsecs = timeBest( repeats, [&](){
+        nmatcher = 0;
+        for ( const std::string &nm : names)
+            nmatcher += matcher.matches( nm.data(), nm.size()) ? 1 : 0;
+    });
+
+    const auto nsPerName = [&]( qint64 msecs){ return 1e6 * double(msecs) / double(names.size());};
+    QJsonObject ns;
+    ns["qdirMatch"] = nsPerName( qdirMsecs);
+    ns["regex"] = nsPerName( regexMsecs);
+    ns["nameMatcher"] = nsPerName( matcherMsecs);
+
+    QJsonObject result;
+    result["names"] = int(names.size());
+    result["nsPerName"] = ns;
+    result["matched"] = nmatcher;
+    result["matcherStates"] = matcher.stateCount();
+    result["countsAgree"] = nqdir == nmatcher && nregex == nmatcher;
+    return result;
+}   // end timeMatching
+
+}   // end namespace
+
+
+int main( int argc, char *argv[])
+{
+    QCoreApplication app( argc, argv);
+    QCoreApplication::setApplicationName( "listBenchmark");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription( "Times file discovery and name filter matching.");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"files", "Number of files in the generated tree.", "n", "1000000"},
+        {"per-dir", "Number of files per generated directory.", "n", "1000"},
+        {"dir", "List this existing directory instead of generating a tree.", "path"},
+        {"filters", "Comma separated name filters.", "filters", "*.cpp,*.h,*.hpp,[a-c]*.json"},
+        {"names", "Number of names for the matching benchmark.", "n", "2000000"},
+        {"threads", "Threads for parallel listing (0 for default).", "n", "0"},
+        {"repeats", "Times to repeat each measurement (best is reported).", "n", "3"},
+        {"out", "Write the JSON report to this file instead of stdout.", "file"}});
+    parser.process( app);
+
+    const QStringList filters = parser.value("filters").split( ',', Qt::SkipEmptyParts);
+    const int repeats = std::max( 1, parser.value("repeats").toInt());
+
+    QTemporaryDir tmp;
+    QString root = parser.value("dir");
+    qint64 genMsecs = 0;
+    if ( root.isEmpty())
+    {
+        if ( !tmp.isValid())
+        {
+            std::cerr << "Unable to create temporary directory!" << std::endl;
+            return EXIT_FAILURE;
+        }   // end if
+        root = tmp.path();
+        QElapsedTimer genTimer;
+        genTimer.start();
+        if ( !generate( root, std::max( 1, parser.value("files").toInt()), std::max( 1, parser.value("per-dir").toInt())))
+        {
+            std::cerr << "Failed to generate synthetic tree!" << std::endl;
+            return EXIT_FAILURE;
+        }   // end if
+        genMsecs = genTimer.elapsed();
+    }   // end if
+
+    QJsonObject config;
+    config["root"] = root;
+    config["files"] = parser.isSet("dir") ? -1 : parser.value("files").toInt();
+    config["filters"] = filters.join(',');
+    config["repeats"] = repeats;
+
+    QJsonObject report;
+    report["config"] = config;
+    report["generateMsecs"] = double( genMsecs);
+    report["listing"] = timeListing( QDir( root), filters, parser.value("threads").toInt(), repeats);
+    report["matching"] = timeMatching( filters, parser.value("names").toInt(), repeats);
+
+    const QByteArray json = QJsonDocument( report).toJson( QJsonDocument::Indented);
+    if ( parser.isSet("out"))
+    {
+        QFile file( parser.value("out"));
+        if ( !file.open( QIODevice::WriteOnly) || file.write( json) != json.size())
+        {
+            std::cerr << "Unable to write report!" << std::endl;
+            return EXIT_FAILURE;
+        }   // end if
+    }   // end if
+    else
+        std::cout << json.toStdString();
+
+    return EXIT_SUCCESS;
+}   // end main
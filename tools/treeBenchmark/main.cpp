@@ -0,0 +1,146 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+/**
+ * Benchmark of TreeModel. Builds a synthetic tree with a given number of nodes then
+ * times looking up random nodes with TreeModel::find on a column with and without
+ * a hash index on it, and times tearing the tree down. Reports the results as JSON.
+ */
+
+#include <QTools/TreeModel.h>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QRandomGenerator>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QFile>
+#include <algorithm>
+#include <iostream>
+using QTools::TreeModel;
+using QTools::TreeItem;
+
+namespace {
+
+// Adds nodes breadth first with up to fanout children each until there are nnodes (excluding the root).
+void generate( TreeModel &model, int nnodes, int fanout)
+{
+    TreeItem *root = model.setNewRoot({"Name", "Ref"});
+    QVector<TreeItem*> parents( 1, root);
+    int n = 0;
+    for ( int p = 0; n < nnodes; ++p)
+    {
+        TreeItem *prnt = parents.at(p);
+        for ( int i = 0; i < fanout && n < nnodes; ++i, ++n)
+            parents.append( new TreeItem( {QString("Item %1").arg(n), QString("d%1/page%2.html").arg(p).arg(n)}, prnt));
+    }   // end for
+}   // end generate
+
+
+// Returns the mean microseconds per lookup and sets found to the number found.
+double timeFinds( const TreeModel &model, const QStringList &refs, int &found)
+{
+    found = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for ( const QString &ref : refs)
+        found += model.find( ref, 1).isValid() ? 1 : 0;
+    return 1e-3 * double( timer.nsecsElapsed()) / double( refs.size());
+}   // end timeFinds
+
+}   // end namespace
+
+
+int main( int argc, char *argv[])
+{
+    QCoreApplication app( argc, argv);
+    QCoreApplication::setApplicationName( "treeBenchmark");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription( "Times building and searching a large TreeModel.");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"nodes", "Number of nodes in the tree.", "n", "100000"},
+        {"fanout", "Number of children per node.", "n", "10"},
+        {"lookups", "Number of random lookups.", "n", "500"},
+        {"out", "Write the JSON report to this file instead of stdout.", "file"}});
+    parser.process( app);
+
+    const int nnodes = std::max( 1, parser.value("nodes").toInt());
+    const int fanout = std::max( 1, parser.value("fanout").toInt());
+    const int nlookups = std::max( 1, parser.value("lookups").toInt());
+
+    TreeModel *model = new TreeModel;
+    QElapsedTimer timer;
+    timer.start();
+    generate( *model, nnodes, fanout);
+    const qint64 buildMsecs = timer.elapsed();
+
+    // Lookups of existing nodes plus one in ten that don't exist (the worst case for searching).
+    QStringList refs;
+    QRandomGenerator *rng = QRandomGenerator::global();
+    for ( int i = 0; i < nlookups; ++i)
+    {
+        const int n = rng->bounded( nnodes);
+        refs.append( i % 10 == 9 ? QString("missing%1.html").arg(n) : QString("d%1/page%2.html").arg( n / fanout).arg(n));
+    }   // end for
+
+    int foundLinear = 0, foundIndexed = 0;
+    const double linearUsecs = timeFinds( *model, refs, foundLinear);
+    timer.start();
+    model->setIndexed( 1);
+    const qint64 indexMsecs = timer.elapsed();
+    const double indexedUsecs = timeFinds( *model, refs, foundIndexed);
+
+    timer.start();
+    delete model;
+    const qint64 teardownMsecs = timer.elapsed();
+
+    QJsonObject config;
+    config["nodes"] = nnodes;
+    config["fanout"] = fanout;
+    config["lookups"] = nlookups;
+
+    QJsonObject usecs;
+    usecs["linear"] = linearUsecs;
+    usecs["indexed"] = indexedUsecs;
+
+    QJsonObject report;
+    report["config"] = config;
+    report["itemBytes"] = int( sizeof(TreeItem));
+    report["buildMsecs"] = double( buildMsecs);
+    report["teardownMsecs"] = double( teardownMsecs);
+    report["indexMsecs"] = double( indexMsecs);
+    report["usecsPerFind"] = usecs;
+    report["found"] = foundIndexed;
+    report["countsAgree"] = foundLinear == foundIndexed;
+
+    const QByteArray json = QJsonDocument( report).toJson( QJsonDocument::Indented);
+    if ( parser.isSet("out"))
+    {
+        QFile file( parser.value("out"));
+        if ( !file.open( QIODevice::WriteOnly) || file.write( json) != json.size())
+        {
+            std::cerr << "Unable to write report!" << std::endl;
+            return EXIT_FAILURE;
+        }   // end if
+    }   // end if
+    else
+        std::cout << json.toStdString();
+
+    return EXIT_SUCCESS;
+}   // end main
@@ -0,0 +1,463 @@
+/************************************************************************
+ * Copyright (C) 2022 Richard Palmer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+/**
+ * Benchmark of the update pipeline. Generates a synthetic installation, a chain of
+ * patch archives and their manifest, serves them from an in-process HTTP server with
+ * configurable latency and bandwidth, then runs NetworkUpdater over them and reports
+ * the time taken by each phase as JSON.
+ */
+
+#include <QTools/NetworkUpdater.h>
+#include <quazip/JlCompress.h>
+#include <zstd.h>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QRandomGenerator>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QTimer>
+#include <QFile>
+#include <QDir>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <memory>
+#include <atomic>
+using QTools::NetworkUpdater;
+using QTools::AppUpdater;
+
+namespace {
+
+struct Config
+{
+    int nfiles;         // Number of files in the synthetic installation
+    qint64 fileSize;    // Size of each file in bytes
+    int chainLength;    // Number of patches needed to bring the installation up to date
+    int nremove;        // Number of files removed by the latest patch
+    int latency;        // Milliseconds before the server responds to each request
+    qint64 bandwidth;   // Server bytes per second per connection (zero for unlimited)
+    qint64 rateCap;     // NetworkUpdater download rate cap (zero for none)
+    QString format;     // "zip" or "tar.zst"
+};  // end struct
+
+
+QByteArray randomContent( qint64 n)
+{
+    // Draw from a small alphabet so the content is moderately compressible.
+    QByteArray bytes( int(n), Qt::Uninitialized);
+    QRandomGenerator *rng = QRandomGenerator::global();
+    for ( int i = 0; i < bytes.size(); ++i)
+        bytes[i] = char('a' + rng->bounded(16));
+    return bytes;
+}   // end randomContent
+
+
+bool writeFile( const QString &fpath, const QByteArray &bytes)
+{
+    QDir().mkpath( QFileInfo( fpath).path());
+    QFile file( fpath);
+    return file.open( QIODevice::WriteOnly) && file.write( bytes) == bytes.size();
+}   // end writeFile
+
+
+QString fileName( int i) { return QString("data/d%1/file%2.bin").arg( i % 16).arg(i);}
+
+
+void appendTarEntry( QByteArray &tar, const QString &path, const QByteArray &data)
+{
+    char h[512] = {0};
+    const QByteArray name = path.toUtf8();
+    std::memcpy( h, name.constData(), size_t( std::min( name.size(), 99)));
+    std::memcpy( h + 100, "0000644", 7);
+    std::memcpy( h + 108, "0000000", 7);
+    std::memcpy( h + 116, "0000000", 7);
+    std::snprintf( h + 124, 12, "%011llo", (unsigned long long)data.size());
+    std::memcpy( h + 136, "00000000000", 11);
+    h[156] = '0';
+    std::memcpy( h + 257, "ustar", 6);
+    std::memcpy( h + 263, "00", 2);
+
+    unsigned int chksum = 0;
+    std::memset( h + 148, ' ', 8);
+    for ( int i = 0; i < 512; ++i)
+        chksum += (unsigned char)h[i];
+    std::snprintf( h + 148, 8, "%06o", chksum);
+
+    tar.append( h, 512);
+    tar.append( data);
+    tar.append( QByteArray( (512 - data.size() % 512) % 512, '\0'));
+}   // end appendTarEntry
+
+
+// Compress as independent 1 MiB frames so extraction can decompress in parallel.
+bool writeTarZstd( const QString &archive, const QByteArray &tar)
+{
+    static const int FRAME_SIZE = 1 << 20;
+    QByteArray out;
+    for ( int pos = 0; pos < tar.size(); pos += FRAME_SIZE)
+    {
+        const int n = std::min( FRAME_SIZE, tar.size() - pos);
+        QByteArray frame( int(ZSTD_compressBound( size_t(n))), Qt::Uninitialized);
+        const size_t csize = ZSTD_compress( frame.data(), size_t(frame.size()), tar.constData() + pos, size_t(n), 3);
+        if ( ZSTD_isError( csize))
+            return false;
+        out.append( frame.constData(), int(csize));
+    }   // end for
+    return writeFile( archive, out);
+}   // end writeTarZstd
+
+
+bool writeArchive( const Config &cfg, const QString &archive, const QString &srcDir, const QStringList &rpaths)
+{
+    if ( cfg.format == "zip")
+        return JlCompress::compressDir( archive, srcDir);
+
+    QByteArray tar;
+    for ( const QString &rpath : rpaths)
+    {
+        QFile file( srcDir + "/" + rpath);
+        if ( !file.open( QIODevice::ReadOnly))
+            return false;
+        appendTarEntry( tar, rpath, file.readAll());
+    }   // end for
+    tar.append( QByteArray( 1024, '\0'));
+    return writeTarZstd( archive, tar);
+}   // end writeArchive
+
+
+// Creates the installation under root/install and the served patches and manifest under root/www.
+// Returns the number of bytes in the patch archives or -1 on error.
+qint64 generate( const Config &cfg, const QString &root, const QString &targetDir, const QString &baseUrl)
+{
+    for ( int i = 0; i < cfg.nfiles; ++i)
+        if ( !writeFile( root + "/install/" + fileName(i), randomContent( cfg.fileSize)))
+            return -1;
+
+    const QString ext = cfg.format == "zip" ? "zip" : "tar.zst";
+    QString xml;
+    QTextStream xout( &xml);
+    xout << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<PatchList version=\"1.0\">\n"
+         << "<Application>updateBenchmark</Application>\n"
+         << "<TargetDir>" << targetDir << "</TargetDir>\n<Patches>\n";
+
+    qint64 nbytes = 0;
+    for ( int k = 1; k <= cfg.chainLength; ++k)
+    {
+        // Patch k modifies every chainLength'th file so each patch in the chain is needed.
+        const QString pdir = root + QString("/patch%1").arg(k);
+        QStringList rpaths;
+        for ( int i = k - 1; i < cfg.nfiles; i += cfg.chainLength)
+        {
+            if ( !writeFile( pdir + "/" + fileName(i), randomContent( cfg.fileSize)))
+                return -1;
+            rpaths << fileName(i);
+        }   // end for
+
+        const QString archive = QString("patch%1.%2").arg(k).arg(ext);
+        if ( !writeArchive( cfg, root + "/www/" + archive, pdir, rpaths))
+            return -1;
+        nbytes += QFileInfo( root + "/www/" + archive).size();
+
+        xout << QString("<Patch major=\"1\" minor=\"0\" patch=\"%1\">\n").arg(k)
+             << "<BaseURL>" << baseUrl << "</BaseURL>\n"
+             << "<Description>Patch " << k << "</Description>\n"
+             << "<Platforms><Platform name=\"Linux\">\n"
+             << "<Archive>" << archive << "</Archive>\n<Modify>\n";
+        for ( const QString &rpath : rpaths)
+            xout << "<File>" << rpath << "</File>\n";
+        xout << "</Modify>\n<Remove>\n";
+        if ( k == cfg.chainLength)
+            for ( int i = 0; i < cfg.nremove && i < cfg.nfiles; ++i)
+                xout << "<File>" << fileName( cfg.nfiles - 1 - i) << "</File>\n";
+        xout << "</Remove>\n</Platform></Platforms>\n</Patch>\n";
+    }   // end for
+    xout << "</Patches>\n</PatchList>\n";
+    xout.flush();
+
+    const QString xmlFile = root + "/manifest/manifest.xml";
+    if ( !writeFile( xmlFile, xml.toUtf8()) || !JlCompress::compressFile( root + "/www/manifest.zip", xmlFile))
+        return -1;
+    return nbytes;
+}   // end generate
+
+
+// Serves files from a directory over HTTP/1.1 delaying each response by the
+// given latency and writing bodies no faster than the given bandwidth.
+class LocalHttpServer
+{
+public:
+    LocalHttpServer( const QString &rootDir, int latency, qint64 bandwidth)
+        : _rootDir(rootDir), _latency(latency), _bandwidth(bandwidth)
+    {
+        QObject::connect( &_server, &QTcpServer::newConnection, [this](){ _doOnNewConnection();});
+    }   // end ctor
+
+    bool listen() { return _server.listen( QHostAddress::LocalHost);}
+    quint16 port() const { return _server.serverPort();}
+
+private:
+    QTcpServer _server;
+    const QString _rootDir;
+    const int _latency;
+    const qint64 _bandwidth;
+
+    void _doOnNewConnection()
+    {
+        while ( QTcpSocket *sock = _server.nextPendingConnection())
+        {
+            std::shared_ptr<QByteArray> request = std::make_shared<QByteArray>();
+            QObject::connect( sock, &QTcpSocket::disconnected, sock, &QObject::deleteLater);
+            QObject::connect( sock, &QTcpSocket::readyRead, sock, [=](){
+                request->append( sock->readAll());
+                if ( request->contains("\r\n\r\n"))
+                {
+                    const QByteArray req = *request;
+                    request->clear();
+                    QTimer::singleShot( _latency, sock, [=](){ _respond( sock, req);});
+                }   // end if
+            });
+        }   // end while
+    }   // end _doOnNewConnection
+
+    void _respond( QTcpSocket *sock, const QByteArray &req)
+    {
+        const QList<QByteArray> lines = req.split('\n');
+        const QList<QByteArray> reqLine = lines.first().trimmed().split(' ');
+        const QString path = reqLine.size() > 1 ? QString::fromUtf8( reqLine.at(1)) : "";
+        qint64 offset = 0;
+        for ( const QByteArray &ln : lines)
+            if ( ln.toLower().startsWith("range: bytes="))
+                offset = ln.trimmed().mid(13).split('-').first().toLongLong();
+
+        QFile file( _rootDir + path);
+        QByteArray body;
+        if ( path.contains("..") || !file.open( QIODevice::ReadOnly))
+        {
+            sock->write( "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+            sock->disconnectFromHost();
+            return;
+        }   // end if
+
+        body = file.readAll();
+        offset = std::min<qint64>( offset, body.size());
+
+        QByteArray header = offset > 0 ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+        header += "Content-Length: " + QByteArray::number( body.size() - offset) + "\r\n";
+        if ( offset > 0)
+            header += "Content-Range: bytes " + QByteArray::number(offset) + "-" + QByteArray::number( body.size()-1)
+                    + "/" + QByteArray::number( body.size()) + "\r\n";
+        header += "Connection: close\r\n\r\n";
+        sock->write( header);
+        _writeBody( sock, std::make_shared<QByteArray>( body.mid( int(offset))));
+    }   // end _respond
+
+    void _writeBody( QTcpSocket *sock, std::shared_ptr<QByteArray> body)
+    {
+        if ( _bandwidth <= 0)
+        {
+            sock->write( *body);
+            sock->disconnectFromHost();
+            return;
+        }   // end if
+
+        // Write a slice every 10 milliseconds.
+        static const int TICK_MSECS = 10;
+        const int slice = int( std::max<qint64>( 1, _bandwidth * TICK_MSECS / 1000));
+        QTimer *timer = new QTimer( sock);
+        std::shared_ptr<int> pos = std::make_shared<int>(0);
+        QObject::connect( timer, &QTimer::timeout, sock, [=](){
+            const int n = std::min( slice, body->size() - *pos);
+            sock->write( body->constData() + *pos, n);
+            *pos += n;
+            if ( *pos >= body->size())
+            {
+                timer->stop();
+                sock->disconnectFromHost();
+            }   // end if
+        });
+        timer->start( TICK_MSECS);
+    }   // end _writeBody
+};  // end class
+
+}   // end namespace
+
+
+int main( int argc, char *argv[])
+{
+    QCoreApplication app( argc, argv);
+    QCoreApplication::setApplicationName( "updateBenchmark");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription( "Times each phase of updating from a local HTTP server.");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"files", "Number of files in the installation.", "n", "1000"},
+        {"size", "Size of each file in bytes.", "bytes", "16384"},
+        {"chain", "Number of patches in the patch chain.", "n", "3"},
+        {"remove", "Number of files removed by the latest patch.", "n", "10"},
+        {"latency", "Server response latency in milliseconds.", "msecs", "0"},
+        {"bandwidth", "Server bandwidth per connection in bytes per second (0 for unlimited).", "bps", "0"},
+        {"rate-cap", "Client download rate cap in bytes per second (0 for none).", "bps", "0"},
+        {"format", "Patch archive format (zip or tar.zst).", "format", "zip"},
+        {"out", "Write the JSON report to this file instead of stdout.", "file"}});
+    parser.process( app);
+
+    Config cfg;
+    cfg.nfiles = std::max( 1, parser.value("files").toInt());
+    cfg.fileSize = std::max<qint64>( 1, parser.value("size").toLongLong());
+    cfg.chainLength = std::max( 1, parser.value("chain").toInt());
+    cfg.nremove = std::max( 0, parser.value("remove").toInt());
+    cfg.latency = std::max( 0, parser.value("latency").toInt());
+    cfg.bandwidth = std::max<qint64>( 0, parser.value("bandwidth").toLongLong());
+    cfg.rateCap = std::max<qint64>( 0, parser.value("rate-cap").toLongLong());
+    cfg.format = parser.value("format");
+    if ( cfg.format != "zip" && cfg.format != "tar.zst")
+    {
+        std::cerr << "Format must be zip or tar.zst!" << std::endl;
+        return EXIT_FAILURE;
+    }   // end if
+
+    QTemporaryDir root;
+    if ( !root.isValid())
+    {
+        std::cerr << "Unable to create temporary directory!" << std::endl;
+        return EXIT_FAILURE;
+    }   // end if
+
+    LocalHttpServer server( root.path() + "/www", cfg.latency, cfg.bandwidth);
+    if ( !server.listen())
+    {
+        std::cerr << "Unable to start local HTTP server!" << std::endl;
+        return EXIT_FAILURE;
+    }   // end if
+    const QString baseUrl = QString("http://127.0.0.1:%1").arg( server.port());
+
+    // Patches are applied relative to this executable's directory.
+    const QString targetDir = QDir( QCoreApplication::applicationDirPath()).relativeFilePath( root.path() + "/install");
+    QElapsedTimer genTimer;
+    genTimer.start();
+    const qint64 patchBytes = generate( cfg, root.path(), targetDir, baseUrl);
+    if ( patchBytes < 0)
+    {
+        std::cerr << "Failed to generate synthetic patches!" << std::endl;
+        return EXIT_FAILURE;
+    }   // end if
+    const qint64 genMsecs = genTimer.elapsed();
+
+    NetworkUpdater updater( QUrl( baseUrl + "/manifest.zip"), 60000);
+    updater.setMaxDownloadRate( cfg.rateCap);
+    const AppUpdater &appUpdater = updater.appUpdater();
+
+    // Timestamps (msecs since start) for each phase boundary. Those from AppUpdater are
+    // recorded directly in its thread (so event loop latency isn't included) hence atomic.
+    QElapsedTimer clock;
+    qint64 tManifest0 = 0, tManifest1 = 0, tDownload0 = 0, tDownload1 = 0;
+    std::atomic<qint64> tExtract(-1), tUpdate(-1), tRemove(-1), tRepack(-1), tFinish(-1);
+    const auto stamp = [&clock]( std::atomic<qint64> &t){ return [&t, &clock](){ t = clock.elapsed();};};
+    QObject::connect( &appUpdater, &AppUpdater::onExtracting, &appUpdater, stamp( tExtract), Qt::DirectConnection);
+    QObject::connect( &appUpdater, &AppUpdater::onUpdating, &appUpdater, stamp( tUpdate), Qt::DirectConnection);
+    QObject::connect( &appUpdater, &AppUpdater::onRemoving, &appUpdater, stamp( tRemove), Qt::DirectConnection);
+    QObject::connect( &appUpdater, &AppUpdater::onRepacking, &appUpdater, stamp( tRepack), Qt::DirectConnection);
+    QObject::connect( &appUpdater, &AppUpdater::onFinished, &appUpdater, stamp( tFinish), Qt::DirectConnection);
+
+    int exitCode = EXIT_SUCCESS;
+    QString error;
+    QObject::connect( &updater, &NetworkUpdater::onError, [&]( const QString &err){
+        error = err;
+        exitCode = EXIT_FAILURE;
+        app.quit();
+    });
+    QObject::connect( &updater, &NetworkUpdater::onRefreshedManifest, [&](){
+        tManifest1 = tDownload0 = clock.elapsed();
+        if ( !updater.updateApp())
+        {
+            error = updater.error();
+            exitCode = EXIT_FAILURE;
+            app.quit();
+        }   // end if
+    });
+    QObject::connect( &updater, &NetworkUpdater::onFinishedDownloading, [&](){ tDownload1 = clock.elapsed();});
+    QObject::connect( &updater, &NetworkUpdater::onFinishedUpdating, [&](){ app.quit();});
+
+    QTimer::singleShot( 0, [&](){
+        clock.start();
+        tManifest0 = clock.elapsed();
+        if ( !updater.refreshManifest( 1, 0, 0))
+        {
+            error = updater.error();
+            exitCode = EXIT_FAILURE;
+            app.quit();
+        }   // end if
+    });
+    app.exec();
+
+    // Phases not reached are reported as -1.
+    const auto span = []( qint64 t0, qint64 t1){ return t0 >= 0 && t1 >= t0 ? t1 - t0 : qint64(-1);};
+    const qint64 tMoveEnd = tRemove >= 0 ? tRemove.load() : tFinish.load();
+    const qint64 tRemoveEnd = tRepack >= 0 ? tRepack.load() : tFinish.load();
+
+    QJsonObject config;
+    config["files"] = cfg.nfiles;
+    config["fileSize"] = double( cfg.fileSize);
+    config["chainLength"] = cfg.chainLength;
+    config["remove"] = cfg.nremove;
+    config["latencyMsecs"] = cfg.latency;
+    config["bandwidth"] = double( cfg.bandwidth);
+    config["rateCap"] = double( cfg.rateCap);
+    config["format"] = cfg.format;
+
+    QJsonObject phases;
+    phases["generate"] = double( genMsecs);
+    phases["manifest"] = double( span( tManifest0, tManifest1));
+    phases["download"] = double( span( tDownload0, tDownload1));
+    phases["extract"] = double( span( tExtract, tUpdate));
+    phases["move"] = double( span( tUpdate, tMoveEnd));
+    phases["remove"] = double( span( tRemove, tRemoveEnd));
+    phases["repack"] = double( span( tRepack, tFinish));
+    phases["total"] = double( span( tManifest0, tFinish));
+
+    QJsonObject report;
+    report["config"] = config;
+    report["phasesMsecs"] = phases;
+    report["patchBytes"] = double( patchBytes);
+    report["skippedFiles"] = appUpdater.skippedFileCount();
+    report["metrics"] = updater.metricsReport();
+    report["ok"] = exitCode == EXIT_SUCCESS;
+    if ( !error.isEmpty())
+        report["error"] = error;
+
+    const QByteArray json = QJsonDocument( report).toJson( QJsonDocument::Indented);
+    if ( parser.isSet("out"))
+    {
+        if ( !writeFile( parser.value("out"), json))
+        {
+            std::cerr << "Unable to write report!" << std::endl;
+            return EXIT_FAILURE;
+        }   // end if
+    }   // end if
+    else
+        std::cout << json.toStdString();
+
+    return exitCode;
+}   // end main
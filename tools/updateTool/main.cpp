@@ -18,8 +18,29 @@
 #include <QTemporaryDir>
 #include <QFileInfo>
 #include <iostream>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+#endif
 
 namespace {
+
+// Atomically exchange the two paths if the kernel and file system allow it.
+bool exchange( const QString &p0, const QString &p1)
+{
+#if defined(__linux__) && defined(SYS_renameat2)
+    return syscall( SYS_renameat2, AT_FDCWD, QFile::encodeName( p0).constData(),
+                                   AT_FDCWD, QFile::encodeName( p1).constData(), RENAME_EXCHANGE) == 0;
+#else
+    return false;
+#endif
+}   // end exchange
+
+
 bool moveFiles( const QString &src, const QString &dst, const QString &bck)
 {
     bool ok = true;
@@ -33,6 +54,8 @@ bool moveFiles( const QString &src, const QString &dst, const QString &bck)
         if ( ok)    // Remove the source directory since now empty
             ok = QDir().rmdir(src);
     }   // end if
+    else if ( QFileInfo::exists(dst) && exchange( src, dst))
+        ok = QDir().rename( src, bck);  // The displaced file is now at src
     else
     {
         if ( QFileInfo::exists(dst))
@@ -72,6 +95,24 @@ int doMove( const QString &src, const QString &dst, const QString &bck)
     return rv;
 }   // end doMove
 
+
+// Move fcur to fold and fnew to fcur (exchanging fnew and fcur first if possible so fcur is never missing).
+int doSwap( const QString &fnew, const QString &fcur, const QString &fold)
+{
+    if ( !QFileInfo::exists(fnew) || !QFileInfo::exists(fcur) || QFileInfo::exists(fold))
+    {
+        std::cerr << "New and current must exist and old must not!" << std::endl;
+        return EXIT_FAILURE;
+    }   // end if
+
+    bool ok = true;
+    if ( exchange( fnew, fcur))
+        ok = QDir().rename( fnew, fold);
+    else
+        ok = QDir().rename( fcur, fold) && QDir().rename( fnew, fcur);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}   // end doSwap
+
 }   // end namespace
 
 
@@ -93,6 +134,12 @@ int main( int argc, char *argv[])
             return EXIT_FAILURE;
         exitCode = doMove( argv[3], argv[4], argv[5]);
     }   // end if
+    else if ( cmd == "swap")
+    {
+        if ( argc != 6)
+            return EXIT_FAILURE;
+        exitCode = doSwap( argv[3], argv[4], argv[5]);
+    }   // end else if
     else if ( cmd == "remove")
     {
         if ( argc < 4)
@@ -102,7 +149,7 @@ int main( int argc, char *argv[])
     }   // end else if
     else
     {
-        std::cerr << "Invalid update command! Use \"move\" or \"remove\" only." << std::endl;
+        std::cerr << "Invalid update command! Use \"move\", \"swap\" or \"remove\" only." << std::endl;
         exitCode = EXIT_FAILURE;
     }   // end else
 